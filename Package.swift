@@ -10,8 +10,13 @@ let package = Package(
         .executable(name: "openflow", targets: ["OpenFlow"])
     ],
     targets: [
+        .target(
+            name: "CPCMRing",
+            path: "Sources/CPCMRing"
+        ),
         .executableTarget(
             name: "OpenFlow",
+            dependencies: ["CPCMRing"],
             path: "Sources/OpenFlow",
             resources: [
                 .process("Resources")
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Atomic access to the --pcm-ring header (layout in transcriber/transcription/pcm-ring.h) for the
+// Swift producer, which has no atomics over raw mapped memory of its own.
+
+// The transcriber's read position at offset 8. It is stored with memory_order_release after the
+// transcriber has copied the slots out, so the acquire keeps the producer's slot writes after it.
+static inline uint64_t openflow_pcm_ring_read_position(const void *header) {
+    return __atomic_load_n((const uint64_t *)((const uint8_t *)header + 8), __ATOMIC_ACQUIRE);
+}
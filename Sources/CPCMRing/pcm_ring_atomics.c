@@ -0,0 +1,2 @@
+// Everything is inline in include/pcm_ring_atomics.h; SwiftPM needs a source file for the target.
+#include "pcm_ring_atomics.h"
@@ -3,6 +3,7 @@ import SwiftUI
 @preconcurrency import AVFoundation
 import AudioToolbox
 import CoreAudio
+import CPCMRing
 
 private let silentFalsePositiveTranscriptKey = "thanks for watching"
 
@@ -100,7 +101,6 @@ final class OpenFlowApp: NSObject, NSApplicationDelegate {
     private var didShowMicDeniedAlert = false
     private var selectedMicUID: String?
     private var selectedModelName = "small"
-    private var needsTranscriberRestart = false
     private var fnPressActive = false
     private var lastFnUpTime: Date?
     private static let fnCooldown: TimeInterval = 0.15
@@ -358,16 +358,11 @@ final class OpenFlowApp: NSObject, NSApplicationDelegate {
         audioRecorder.stopStreaming()
         let runner = transcriptionRunner
         let refiner = llmRefiner
-        let shouldRestartTranscriber = needsTranscriberRestart
-        needsTranscriberRestart = false
         let tRelease = Date()
 
         let context = AccessibilityContext.capture(maxBefore: 500, maxAfter: 500)
         runner.stopStreaming { [weak self] text in
             guard let self else { return }
-            if shouldRestartTranscriber {
-                runner.shutdown()
-            }
             let filtered = suppressSilentFalsePositiveIfNeeded(text)
             let trimmed = filtered.trimmingCharacters(in: .whitespacesAndNewlines)
             guard !trimmed.isEmpty else {
@@ -478,8 +473,8 @@ final class OpenFlowApp: NSObject, NSApplicationDelegate {
 
     private func rebuildModelMenu(_ menu: NSMenu) {
         menu.removeAllItems()
-        for model in ["small", "base"] {
-            let label = model == "small" ? "Small (Default)" : "Base"
+        for model in Paths.whisperModelNames where Paths.whisperModelAvailable(modelName: model) {
+            let label = modelMenuLabel(model)
             let item = NSMenuItem(title: label, action: #selector(selectModel(_:)), keyEquivalent: "")
             item.target = self
             item.representedObject = model
@@ -501,15 +496,11 @@ final class OpenFlowApp: NSObject, NSApplicationDelegate {
         let normalized = normalizedModelName(model)
         guard normalized != selectedModelName else { return }
         selectedModelName = normalized
-        transcriptionRunner.modelName = normalized
+        // The running transcriber loads the new model alongside the old one and switches between
+        // jobs, so a dictation in progress finishes on the model it started with.
+        transcriptionRunner.setModel(normalized)
         configStore.setModelName(normalized)
         refreshModelMenu()
-
-        if bubbleState.isListening {
-            needsTranscriberRestart = true
-        } else {
-            transcriptionRunner.shutdown()
-        }
     }
 
     @objc private func selectStyle(_ sender: NSMenuItem) {
@@ -528,11 +519,20 @@ final class OpenFlowApp: NSObject, NSApplicationDelegate {
     }
 
     private func normalizedModelName(_ name: String?) -> String {
-        switch (name ?? "small").lowercased() {
+        let name = (name ?? "small").lowercased()
+        return Paths.whisperModelNames.contains(name) ? name : "small"
+    }
+
+    private func modelMenuLabel(_ model: String) -> String {
+        switch model {
+        case "small":
+            return "Small (Default)"
         case "base":
-            return "base"
+            return "Base"
         default:
-            return "small"
+            // "small-q5_1" -> "Small (q5_1)"
+            let parts = model.split(separator: "-", maxSplits: 1)
+            return "\(parts[0].capitalized) (\(parts.count > 1 ? parts[1] : ""))"
         }
     }
 
@@ -1691,6 +1691,8 @@ final class TranscriptionRunner: @unchecked Sendable {
     var vadStart: Double?
     var vadStop: Double?
     private var persistent: PersistentTranscriber?
+    // Set when the running transcriber couldn't load the selected model; the next job restarts it.
+    private var restartPending = false
     private var streaming = false
     private var streamSessionID: Int = 0
     private var activePartialSessionID: Int?
@@ -1755,6 +1757,24 @@ final class TranscriptionRunner: @unchecked Sendable {
         }
     }
 
+    // Hands the model to the running transcriber instead of restarting it; the next job to start
+    // after the load finishes runs on it.
+    func setModel(_ name: String) {
+        queue.async {
+            self.modelName = name
+            guard let persistent = self.persistent, persistent.isAlive, !self.restartPending,
+                  let modelPath = Paths.whisperModelURL(modelName: name) else { return }
+            persistent.switchModel(to: modelPath.path)
+        }
+    }
+
+    private func discardIfRestartPending() {
+        guard restartPending else { return }
+        restartPending = false
+        persistent?.shutdown()
+        persistent = nil
+    }
+
     private func runVadTranscriber(audioURL: URL) -> String {
         guard let vadPath = Paths.vadTranscriberURL,
               let modelPath = Paths.whisperModelURL(modelName: modelName),
@@ -1796,6 +1816,7 @@ final class TranscriptionRunner: @unchecked Sendable {
     }
 
     private func ensurePersistent() -> PersistentTranscriber? {
+        discardIfRestartPending()
         if let persistent, persistent.isAlive {
             return persistent
         }
@@ -1814,7 +1835,7 @@ final class TranscriptionRunner: @unchecked Sendable {
            FileManager.default.fileExists(atPath: dictionaryURL.path) {
             args += ["--dictionary-file", dictionaryURL.path]
         }
-        args += ["--stdin-audio"]
+        args += ["--stdin-audio", "--output-format", "binary-delta"]
         let persistent = PersistentTranscriber(executableURL: vadPath, arguments: args)
         persistent?.onJobEnd = { [weak self] text in
             guard let self else { return }
@@ -1831,11 +1852,16 @@ final class TranscriptionRunner: @unchecked Sendable {
             guard sessionID == self.activePartialSessionID else { return }
             self.onPartialText?(text)
         }
+        persistent?.onModelError = { [weak self] in
+            guard let self else { return }
+            self.queue.async { self.restartPending = true }
+        }
         self.persistent = persistent
         return persistent
     }
 
     private func ensurePersistentStreaming() -> PersistentTranscriber? {
+        discardIfRestartPending()
         if let persistent, persistent.isAlive {
             return persistent
         }
@@ -1854,8 +1880,12 @@ final class TranscriptionRunner: @unchecked Sendable {
            FileManager.default.fileExists(atPath: dictionaryURL.path) {
             args += ["--dictionary-file", dictionaryURL.path]
         }
-        args += ["--stdin-pcm", "--stream-final-full-pass"]
-        let persistent = PersistentTranscriber(executableURL: vadPath, arguments: args)
+        args += ["--stdin-pcm", "--stream-final-full-pass", "--output-format", "binary-delta"]
+        let ring = PCMRing(capacity: 16000 * 10)
+        if let ring {
+            args += ["--pcm-ring", ring.path]
+        }
+        let persistent = PersistentTranscriber(executableURL: vadPath, arguments: args, pcmRing: ring)
         persistent?.onJobEnd = { [weak self] text in
             guard let self else { return }
             if let completion = self.pendingCompletion {
@@ -1871,6 +1901,10 @@ final class TranscriptionRunner: @unchecked Sendable {
             guard sessionID == self.activePartialSessionID else { return }
             self.onPartialText?(text)
         }
+        persistent?.onModelError = { [weak self] in
+            guard let self else { return }
+            self.queue.async { self.restartPending = true }
+        }
         self.persistent = persistent
         return persistent
     }
@@ -1881,11 +1915,23 @@ final class TranscriptionRunner: @unchecked Sendable {
             "--model", modelPath.path,
             "--pre-padding-ms", "400",
             "--post-padding-ms", "300",
-            "--step", "100"
+            "--step", "100",
+            "--step-max", "600",
+            "--incremental-partials"
         ]
         let start = vadStart ?? 0.2
         let stop = vadStop ?? 0.1
         args += ["--start-threshold", "\(start)", "--stop-threshold", "\(stop)"]
+        // VAD stays on one low-QoS CPU thread so decode keeps the fast cores; the encoder goes to
+        // the ANE when the bundle ships a Core ML encoder for this model.
+        args.append("--vad-background")
+        // Quantized models share the f16 model's encoder (whisper drops the -qX_Y suffix).
+        let stem = modelPath.deletingPathExtension().path
+        let encoderStem = stem.range(of: "-q[0-9]_[0-9]$", options: .regularExpression).map { String(stem[..<$0.lowerBound]) } ?? stem
+        let coreMLEncoder = encoderStem + "-encoder.mlmodelc"
+        if FileManager.default.fileExists(atPath: coreMLEncoder) {
+            args.append("--coreml")
+        }
         return args
     }
 
@@ -1915,6 +1961,64 @@ final class TranscriptionRunner: @unchecked Sendable {
     }
 }
 
+// Producer side of the transcriber's --pcm-ring; the layout is documented in
+// transcriber/transcription/pcm-ring.h. Samples are copied into the mapped file and an `R u64 end`
+// doorbell on stdin tells the transcriber how far to read. The transcriber publishes its read
+// position in the header, so a full ring is detected here and the caller falls back to a 'J' frame.
+final class PCMRing {
+    private static let headerBytes = 64
+    let path: String
+    private let capacity: UInt64
+    private let base: UnsafeMutableRawPointer
+    private let mappedBytes: Int
+    private var writePosition: UInt64 = 0
+
+    init?(capacity: Int) {
+        let path = NSTemporaryDirectory() + "openflow-pcm-\(getpid()).ring"
+        let bytes = PCMRing.headerBytes + capacity * MemoryLayout<Float>.size
+        unlink(path)
+        let fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0o600)
+        guard fd >= 0 else { return nil }
+        defer { close(fd) }
+        guard ftruncate(fd, off_t(bytes)) == 0,
+              let map = mmap(nil, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0),
+              map != UnsafeMutableRawPointer(bitPattern: -1) else {
+            unlink(path)
+            return nil
+        }
+        map.storeBytes(of: UInt32(0x5250464f).littleEndian, toByteOffset: 0, as: UInt32.self)  // "OFPR"
+        map.storeBytes(of: UInt32(capacity).littleEndian, toByteOffset: 4, as: UInt32.self)
+        self.path = path
+        self.capacity = UInt64(capacity)
+        self.base = map
+        self.mappedBytes = bytes
+    }
+
+    deinit {
+        munmap(base, mappedBytes)
+        unlink(path)
+    }
+
+    // Copies samples into the ring and returns the doorbell position, or nil if they don't fit yet.
+    func write(_ samples: [Float]) -> UInt64? {
+        let count = UInt64(samples.count)
+        // Acquire: the transcriber releases the slots with this store, so the copies below can't
+        // overwrite samples it is still reading.
+        let readPosition = openflow_pcm_ring_read_position(base)
+        guard count > 0, writePosition + count - readPosition <= capacity else { return nil }
+        let slots = (base + PCMRing.headerBytes).assumingMemoryBound(to: Float.self)
+        let slot = Int(writePosition % capacity)
+        let first = min(samples.count, Int(capacity) - slot)
+        samples.withUnsafeBufferPointer { src in
+            guard let src = src.baseAddress else { return }
+            memcpy(slots + slot, src, first * MemoryLayout<Float>.size)
+            memcpy(slots, src + first, (samples.count - first) * MemoryLayout<Float>.size)
+        }
+        writePosition += count
+        return writePosition
+    }
+}
+
 final class PersistentTranscriber: @unchecked Sendable {
     struct Job {
         let audioPath: String
@@ -1928,13 +2032,23 @@ final class PersistentTranscriber: @unchecked Sendable {
     private let stdoutHandle: FileHandle
     private let queue = DispatchQueue(label: "openflow.transcriber.ipc")
     private var buffer = Data()
+    // With --output-format binary/binary-delta, stdout is a stream of `u32 length | type | payload`
+    // frames instead of NDJSON: 'J' wraps one JSON event, 'S' is a full segment and 'D' a segment
+    // delta against the last record for the same segment_index (see format_segment in
+    // openflow_transcriber.cpp).
+    private let framed: Bool
+    // --stdin-pcm takes tagged frames on stdin; --stdin-audio takes lines.
+    private let pcmInput: Bool
+    private let pcmRing: PCMRing?
+    private var segmentTokens: [Int32: [Data]] = [:]
     private var pending: [Job] = []
     private var current: Job?
     var onJobEnd: ((String) -> Void)?
     var onPartialText: ((Int?, String) -> Void)?
+    var onModelError: (() -> Void)?
     private(set) var isAlive: Bool = false
 
-    init?(executableURL: URL, arguments: [String]) {
+    init?(executableURL: URL, arguments: [String], pcmRing: PCMRing? = nil) {
         let process = Process()
         process.executableURL = executableURL
         process.arguments = arguments
@@ -1952,6 +2066,11 @@ final class PersistentTranscriber: @unchecked Sendable {
         }
 
         self.process = process
+        self.pcmRing = pcmRing
+        self.framed = zip(arguments, arguments.dropFirst()).contains { flag, value in
+            flag == "--output-format" && value.hasPrefix("binary")
+        }
+        self.pcmInput = arguments.contains("--stdin-pcm")
         self.stdinHandle = stdinPipe.fileHandleForWriting
         self.stdoutHandle = stdoutPipe.fileHandleForReading
         self.isAlive = true
@@ -1990,6 +2109,13 @@ final class PersistentTranscriber: @unchecked Sendable {
     func sendPCM(_ samples: [Float]) {
         queue.async {
             guard self.isAlive else { return }
+            if let end = self.pcmRing?.write(samples) {
+                var doorbell = Data([UInt8(ascii: "R")])
+                var e = end
+                doorbell.append(Data(bytes: &e, count: MemoryLayout<UInt64>.size))
+                try? self.stdinHandle.write(contentsOf: doorbell)
+                return
+            }
             let count = UInt32(samples.count)
             var header = Data()
             header.append("J".data(using: .utf8)!)
@@ -2011,6 +2137,24 @@ final class PersistentTranscriber: @unchecked Sendable {
         }
     }
 
+    // The transcriber loads the model in the background (model_loading, then model_ready or
+    // model_error) and swaps it in between jobs (model_swap).
+    func switchModel(to modelPath: String) {
+        queue.async {
+            guard self.isAlive else { return }
+            if self.pcmInput {
+                let path = Data(modelPath.utf8)
+                var frame = Data([UInt8(ascii: "M")])
+                var n = UInt32(path.count)
+                frame.append(Data(bytes: &n, count: MemoryLayout<UInt32>.size))
+                frame.append(path)
+                try? self.stdinHandle.write(contentsOf: frame)
+            } else if let data = "__model__ \(modelPath)\n".data(using: .utf8) {
+                try? self.stdinHandle.write(contentsOf: data)
+            }
+        }
+    }
+
     func shutdown() {
         queue.async {
             self.isAlive = false
@@ -2038,6 +2182,10 @@ final class PersistentTranscriber: @unchecked Sendable {
     private func handleData(_ data: Data) {
         queue.async {
             self.buffer.append(data)
+            if self.framed {
+                self.drainFrames()
+                return
+            }
             while let range = self.buffer.firstRange(of: Data([0x0A])) {
                 let lineData = self.buffer.subdata(in: 0..<range.lowerBound)
                 self.buffer.removeSubrange(0...range.lowerBound)
@@ -2047,6 +2195,89 @@ final class PersistentTranscriber: @unchecked Sendable {
         }
     }
 
+    private func drainFrames() {
+        while buffer.count >= 4 {
+            var reader = FrameReader(buffer)
+            guard let length = reader.u32() else { return }
+            let frameEnd = buffer.startIndex + 4 + Int(length)
+            guard buffer.endIndex >= frameEnd else { return }
+            let frame = buffer.subdata(in: (buffer.startIndex + 4)..<frameEnd)
+            buffer.removeSubrange(buffer.startIndex..<frameEnd)
+            handleFrame(frame)
+        }
+    }
+
+    private func handleFrame(_ frame: Data) {
+        guard let type = frame.first else { return }
+        let payload = frame.dropFirst()
+        switch type {
+        case UInt8(ascii: "J"):
+            if let line = String(data: payload, encoding: .utf8) {
+                handleLine(line)
+            }
+        case UInt8(ascii: "S"), UInt8(ascii: "D"):
+            handleSegmentFrame(payload, isDelta: type == UInt8(ascii: "D"))
+        default:
+            break
+        }
+    }
+
+    private func handleSegmentFrame(_ payload: Data, isDelta: Bool) {
+        var reader = FrameReader(payload)
+        guard let segmentIndex = reader.i32(),
+              reader.skip(8 + 8 + 4),  // start_ms, end_ms, avg_vad
+              let finalFlag = reader.u8(),
+              reader.skip(4 + 4) else {  // partial_seq, stable_tokens
+            return
+        }
+        var tokens: [Data] = []
+        if isDelta {
+            guard let keep = reader.u32() else { return }
+            tokens = Array((segmentTokens[segmentIndex] ?? []).prefix(Int(keep)))
+        }
+        guard let count = reader.u32() else { return }
+        for _ in 0..<count {
+            guard reader.skip(4 + 4 + 1),  // t0_ms, t1_ms, leading_space
+                  let length = reader.u16(),
+                  let text = reader.bytes(Int(length)) else {
+                return
+            }
+            tokens.append(text)
+        }
+
+        let isFinal = finalFlag != 0
+        if isFinal {
+            segmentTokens.removeValue(forKey: segmentIndex)
+        } else {
+            segmentTokens[segmentIndex] = tokens
+        }
+        // Token texts are byte pieces; join them before decoding so split UTF-8 sequences survive.
+        let text = String(decoding: tokens.reduce(into: Data()) { $0.append($1) }, as: UTF8.self)
+        handleSegment(text: text, isFinal: isFinal)
+    }
+
+    private func handleSegment(text: String, isFinal: Bool) {
+        let trimmed = text.trimmingCharacters(in: .whitespacesAndNewlines)
+        guard !trimmed.isEmpty else { return }
+        if isFinal {
+            if var current = current {
+                current.segments.append(trimmed)
+                self.current = current
+            }
+        }
+        // Stream mode drives a compact rolling UI (latest chunk only), while job_end
+        // still returns all finalized chunks joined together.
+        if let current = current {
+            let soFar: String
+            if current.audioPath == "<stream>" {
+                soFar = trimmed
+            } else {
+                soFar = isFinal ? current.segments.joined(separator: " ") : (current.segments + [trimmed]).joined(separator: " ")
+            }
+            onPartialText?(current.sessionID, soFar)
+        }
+    }
+
     private func handleLine(_ line: String) {
         guard let jsonData = line.data(using: .utf8),
               let obj = try? JSONSerialization.jsonObject(with: jsonData) as? [String: Any],
@@ -2057,26 +2288,14 @@ final class PersistentTranscriber: @unchecked Sendable {
         switch event {
         case "segment":
             guard let text = obj["text"] as? String else { return }
-            let trimmed = text.trimmingCharacters(in: .whitespacesAndNewlines)
-            guard !trimmed.isEmpty else { return }
-            let isFinal = (obj["final"] as? Bool) == true
-            if isFinal {
-                if var current = current {
-                    current.segments.append(trimmed)
-                    self.current = current
-                }
-            }
-            // Stream mode drives a compact rolling UI (latest chunk only), while job_end
-            // still returns all finalized chunks joined together.
-            if let current = current {
-                let soFar: String
-                if current.audioPath == "<stream>" {
-                    soFar = trimmed
-                } else {
-                    soFar = isFinal ? current.segments.joined(separator: " ") : (current.segments + [trimmed]).joined(separator: " ")
-                }
-                onPartialText?(current.sessionID, soFar)
-            }
+            handleSegment(text: text, isFinal: (obj["final"] as? Bool) == true)
+        case "job_start":
+            segmentTokens.removeAll()
+        case "model_swap":
+            print("[transcription] model_swap: \(obj["path"] as? String ?? "")")
+        case "model_error":
+            print("[transcription] model_error: \(obj["path"] as? String ?? ""): \(obj["error"] as? String ?? "")")
+            onModelError?()
         case "job_end":
             if let current = current {
                 let output = current.segments.joined(separator: " ")
@@ -2098,6 +2317,45 @@ final class PersistentTranscriber: @unchecked Sendable {
     }
 }
 
+// Little-endian cursor over a binary stdout frame.
+private struct FrameReader {
+    private let data: Data
+    private var offset: Data.Index
+
+    init(_ data: Data) {
+        self.data = data
+        self.offset = data.startIndex
+    }
+
+    mutating func bytes(_ count: Int) -> Data? {
+        guard count >= 0, data.endIndex - offset >= count else { return nil }
+        defer { offset += count }
+        return data.subdata(in: offset..<(offset + count))
+    }
+
+    mutating func skip(_ count: Int) -> Bool {
+        bytes(count) != nil
+    }
+
+    mutating func u8() -> UInt8? {
+        bytes(1)?.first
+    }
+
+    mutating func u16() -> UInt16? {
+        guard let raw = bytes(2) else { return nil }
+        return raw.reversed().reduce(0) { $0 << 8 | UInt16($1) }
+    }
+
+    mutating func u32() -> UInt32? {
+        guard let raw = bytes(4) else { return nil }
+        return raw.reversed().reduce(0) { $0 << 8 | UInt32($1) }
+    }
+
+    mutating func i32() -> Int32? {
+        u32().map { Int32(bitPattern: $0) }
+    }
+}
+
 struct HistoryEntry: Codable, Hashable {
     let id: UUID
     let timestamp: Date
@@ -2750,16 +3008,32 @@ enum Paths {
         transcriberDirURL?.appendingPathComponent("build/bin/openflow_transcriber")
     }
 
+    // "<size>" is the f16 model; "<size>-q5_1" and "<size>-q8_0" are the quantized ggml variants
+    // setup_whisper.sh fetches with OPENFLOW_QUANT_MODELS.
+    static let whisperModelNames = ["small", "base", "small-q8_0", "small-q5_1", "base-q8_0", "base-q5_1"]
+
+    private static func whisperModelFile(modelName: String) -> String {
+        let parts = modelName.lowercased().split(separator: "-", maxSplits: 1)
+        let size = parts.first == "base" ? "base" : "small"
+        if parts.count == 2 {
+            return "ggml-\(size).en-\(parts[1]).bin"
+        }
+        return "ggml-\(size).en.bin"
+    }
+
+    static func whisperModelAvailable(modelName: String) -> Bool {
+        guard let url = transcriberDirURL?.appendingPathComponent("whisper.cpp/models/\(whisperModelFile(modelName: modelName))") else {
+            return false
+        }
+        return FileManager.default.fileExists(atPath: url.path)
+    }
+
+    // A quantized variant that isn't installed falls back to the f16 model of the same size.
     static func whisperModelURL(modelName: String?) -> URL? {
         let name = (modelName ?? "small").lowercased()
-        let file: String
-        switch name {
-        case "base":
-            file = "ggml-base.en.bin"
-        case "small":
-            file = "ggml-small.en.bin"
-        default:
-            file = "ggml-small.en.bin"
+        var file = whisperModelFile(modelName: whisperModelNames.contains(name) ? name : "small")
+        if !whisperModelAvailable(modelName: name) {
+            file = whisperModelFile(modelName: name.hasPrefix("base") ? "base" : "small")
         }
         return transcriberDirURL?.appendingPathComponent("whisper.cpp/models/\(file)")
     }
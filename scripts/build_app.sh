@@ -112,5 +112,15 @@ cp "${TRANSCRIBER_BUILD_BIN}/transcriber" "${RESOURCES_DIR}/transcriber/build/bi
 cp "${SMALL_MODEL}" "${RESOURCES_DIR}/transcriber/whisper.cpp/models/"
 cp "${BASE_MODEL}" "${RESOURCES_DIR}/transcriber/whisper.cpp/models/"
 cp "${SILERO_MODEL}" "${RESOURCES_DIR}/transcriber/whisper.cpp/models/"
+# Quantized variants, when setup_whisper.sh downloaded them (OPENFLOW_QUANT_MODELS).
+for model in "${WHISPER_MODELS_DIR}"/ggml-{small,base}.en-q*.bin; do
+  [ -f "${model}" ] || continue
+  cp "${model}" "${RESOURCES_DIR}/transcriber/whisper.cpp/models/"
+done
+# Core ML encoders, when setup_whisper.sh generated them (OPENFLOW_COREML=ON).
+for encoder in "${WHISPER_MODELS_DIR}"/ggml-{small,base}.en-encoder.mlmodelc; do
+  [ -d "${encoder}" ] || continue
+  cp -R "${encoder}" "${RESOURCES_DIR}/transcriber/whisper.cpp/models/"
+done
 
 echo "✅ Built ${APP_DIR}"
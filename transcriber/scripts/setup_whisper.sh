@@ -41,6 +41,7 @@ git -C "${WHISPER_DIR}" reset --hard
 PATCH_DIR="${SCRIPT_DIR}/patches"
 WHISPER_PATCHES=(
   "${PATCH_DIR}/whispercpp-arm-repack-neon-guard.patch"
+  "${PATCH_DIR}/whispercpp-set-signal.patch"
 )
 
 echo "==> Applying local whisper.cpp patches (if needed)"
@@ -69,11 +70,39 @@ bash "${WHISPER_DIR}/models/download-ggml-model.sh" base.en
 echo "==> Downloading ggml model (small.en)"
 bash "${WHISPER_DIR}/models/download-ggml-model.sh" small.en
 
+# Step 2.6: Quantized variants, e.g. OPENFLOW_QUANT_MODELS="q5_1 q8_0" (smaller and faster to load;
+# the app lists the ones present and switches to them without restarting the transcriber)
+OPENFLOW_QUANT_MODELS="${OPENFLOW_QUANT_MODELS:-}"
+for QUANT in ${OPENFLOW_QUANT_MODELS}; do
+  for MODEL in base.en small.en; do
+    echo "==> Downloading ggml model (${MODEL}-${QUANT})"
+    if ! bash "${WHISPER_DIR}/models/download-ggml-model.sh" "${MODEL}-${QUANT}"; then
+      echo "==> Warning: no ${MODEL}-${QUANT} download; skipping it."
+    fi
+  done
+done
+
 # Step 2.75: Download Silero VAD ggml model
 echo "==> Downloading Silero VAD ggml model (silero-v5.1.2)"
 bash "${WHISPER_DIR}/models/download-vad-model.sh" silero-v5.1.2 "${WHISPER_DIR}/models"
 
 
+# Step 2.9: Core ML encoders (OPENFLOW_COREML=ON); needs python3 with coremltools, ane_transformers
+# and openai-whisper, plus Xcode's coremlc.
+OPENFLOW_COREML="${OPENFLOW_COREML:-OFF}"
+if [ "${OPENFLOW_COREML}" = "ON" ]; then
+  for MODEL in base.en small.en; do
+    if [ -d "${WHISPER_DIR}/models/ggml-${MODEL}-encoder.mlmodelc" ]; then
+      echo "==> Core ML encoder already present (${MODEL})"
+      continue
+    fi
+    echo "==> Generating Core ML encoder (${MODEL})"
+    if ! (cd "${WHISPER_DIR}" && bash models/generate-coreml-model.sh "${MODEL}"); then
+      echo "==> Warning: Core ML encoder generation failed for ${MODEL}; it will run on Metal."
+    fi
+  done
+fi
+
 # Step 3: Configure + build transcriber
 echo "==> Running CMake configure + build"
 BUILD_DIR="${TRANSCRIBER_DIR}/build"
@@ -85,6 +114,7 @@ CMAKE_ARGS=(
   -DGGML_METAL=ON
   -DGGML_METAL_EMBED_LIBRARY=ON
   -DWHISPER_SDL2=ON
+  -DOPENFLOW_COREML="${OPENFLOW_COREML}"
 )
 
 cmake -S "${TRANSCRIBER_DIR}" -B "${BUILD_DIR}" \
@@ -1,6 +1,7 @@
 #include "common-sdl.h"
 
 #include <cstdio>
+#include <algorithm>
 #include <cstring> // memcpy
 
 audio_async::audio_async(int len_ms) {
@@ -73,12 +74,9 @@ bool audio_async::init(int capture_id, int sample_rate) {
     m_audio.resize((m_sample_rate * m_len_ms) / 1000);
 
     // Initialize timeline
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_total_samples = 0;
-        m_audio_pos = 0;
-        m_audio_len = 0;
-    }
+    m_total_samples.store(0);
+    m_write_reserved.store(0);
+    m_clear_pos.store(0);
 
     return true;
 }
@@ -94,13 +92,11 @@ bool audio_async::resume() {
         return false;
     }
 
-    // Reset timeline at the start of a new capture session
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_total_samples = 0;
-        m_audio_pos = 0;
-        m_audio_len = 0;
-    }
+    // Reset timeline at the start of a new capture session. The device is paused here, so the
+    // callback can't be running concurrently.
+    m_total_samples.store(0);
+    m_write_reserved.store(0);
+    m_clear_pos.store(0);
 
     SDL_PauseAudioDevice(m_dev_id_in, 0);
     m_running = true;
@@ -134,12 +130,8 @@ bool audio_async::clear() {
         return false;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_audio_pos = 0;
-        m_audio_len = 0;
-        // Note: we intentionally do NOT reset m_total_samples here so the timeline keeps advancing.
-    }
+    // Note: we intentionally do NOT reset m_total_samples here so the timeline keeps advancing.
+    m_clear_pos.store(m_total_samples.load(std::memory_order_acquire), std::memory_order_release);
 
     return true;
 }
@@ -150,35 +142,67 @@ void audio_async::callback(uint8_t *stream, int len) {
         return;
     }
 
+    const size_t capacity = m_audio.size();
+
     // How many samples arrived in this callback:
-    size_t samples_in = static_cast<size_t>(len) / sizeof(float);
+    const size_t samples_in = static_cast<size_t>(len) / sizeof(float);
 
     // We'll write at most the ring buffer size worth of newest samples:
     size_t n_samples = samples_in;
-    if (n_samples > m_audio.size()) {
+    if (n_samples > capacity) {
         // Keep only the latest portion; drop the oldest part of this callback
-        stream += (len - (m_audio.size() * sizeof(float)));
-        n_samples = m_audio.size();
+        stream += (len - (capacity * sizeof(float)));
+        n_samples = capacity;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        // Copy into ring buffer
-        if (m_audio_pos + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - m_audio_pos;
-            memcpy(&m_audio[m_audio_pos], stream, n0 * sizeof(float));
-            memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(&m_audio[m_audio_pos], stream, n_samples * sizeof(float));
-        }
+    // Only this thread writes the timeline, so a relaxed load sees our own last store.
+    const uint64_t total = m_total_samples.load(std::memory_order_relaxed);
+    const uint64_t new_total = total + samples_in;
+    const uint64_t first = new_total - n_samples;
 
-        m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-        m_audio_len = std::min(m_audio_len + n_samples, m_audio.size());
+    m_write_reserved.store(new_total, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-        // Advance the timeline by ALL samples that actually arrived (even if buffer truncated)
-        m_total_samples += samples_in;
+    // Copy into ring buffer
+    const size_t pos = static_cast<size_t>(first % capacity);
+    if (pos + n_samples > capacity) {
+        const size_t n0 = capacity - pos;
+        memcpy(&m_audio[pos], stream, n0 * sizeof(float));
+        memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
+    } else {
+        memcpy(&m_audio[pos], stream, n_samples * sizeof(float));
     }
+
+    // Advance the timeline by ALL samples that actually arrived (even if buffer truncated)
+    m_total_samples.store(new_total, std::memory_order_release);
+}
+
+size_t audio_async::copy_range(uint64_t begin, uint64_t end, std::vector<float> &result) const {
+    const size_t capacity = m_audio.size();
+    const size_t n_samples = static_cast<size_t>(end - begin);
+    result.resize(n_samples);
+    if (n_samples == 0) {
+        return 0;
+    }
+
+    const size_t pos = static_cast<size_t>(begin % capacity);
+    if (pos + n_samples > capacity) {
+        const size_t n0 = capacity - pos;
+        memcpy(result.data(), &m_audio[pos], n0 * sizeof(float));
+        memcpy(&result[n0], &m_audio[0], (n_samples - n0) * sizeof(float));
+    } else {
+        memcpy(result.data(), &m_audio[pos], n_samples * sizeof(float));
+    }
+
+    // Anything older than (reserved - capacity) may have been overwritten mid-copy.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t reserved = m_write_reserved.load(std::memory_order_relaxed);
+    if (reserved > capacity && begin < reserved - capacity) {
+        const size_t n_torn = static_cast<size_t>(std::min<uint64_t>(n_samples, reserved - capacity - begin));
+        result.erase(result.begin(), result.begin() + static_cast<std::ptrdiff_t>(n_torn));
+        return n_torn;
+    }
+    return 0;
 }
 
 void audio_async::get(int ms, std::vector<float> &result, int64_t &current_time_ms) {
@@ -194,40 +218,51 @@ void audio_async::get(int ms, std::vector<float> &result, int64_t &current_time_
 
     result.clear();
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    if (ms <= 0) {
+        ms = m_len_ms;
+    }
 
-        if (ms <= 0) {
-            ms = m_len_ms;
-        }
+    const uint64_t end = m_total_samples.load(std::memory_order_acquire);
+    const uint64_t valid_begin = std::max<uint64_t>(m_clear_pos.load(std::memory_order_acquire),
+                                                    end > m_audio.size() ? end - m_audio.size() : 0);
 
-        size_t n_samples = (static_cast<size_t>(m_sample_rate) * static_cast<size_t>(ms)) / 1000;
-        if (n_samples > m_audio_len) {
-            n_samples = m_audio_len;
-        }
+    uint64_t n_samples = (static_cast<uint64_t>(m_sample_rate) * static_cast<uint64_t>(ms)) / 1000;
+    if (n_samples > end - std::min(end, valid_begin)) {
+        n_samples = end - std::min(end, valid_begin);
+    }
 
-        result.resize(n_samples);
+    copy_range(end - n_samples, end, result);
 
-        int s0 = static_cast<int>(m_audio_pos) - static_cast<int>(n_samples);
-        if (s0 < 0) {
-            s0 += static_cast<int>(m_audio.size());
-        }
+    // Compute timeline in ms from total samples captured since resume()
+    if (m_sample_rate > 0) {
+        current_time_ms = static_cast<int64_t>((end * 1000ULL) / static_cast<uint64_t>(m_sample_rate));
+    } else {
+        current_time_ms = 0;
+    }
+}
 
-        if (static_cast<size_t>(s0) + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - static_cast<size_t>(s0);
-            memcpy(result.data(), &m_audio[static_cast<size_t>(s0)], n0 * sizeof(float));
-            memcpy(&result[n0], &m_audio[0], (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(result.data(), &m_audio[static_cast<size_t>(s0)], n_samples * sizeof(float));
-        }
+size_t audio_async::read_since(uint64_t &position, std::vector<float> &result) {
+    result.clear();
+    if (!m_dev_id_in || !m_running) {
+        return 0;
+    }
 
-        // Compute timeline in ms from total samples captured since resume()
-        if (m_sample_rate > 0) {
-            current_time_ms = static_cast<int64_t>((m_total_samples * 1000ULL) / static_cast<uint64_t>(m_sample_rate));
-        } else {
-            current_time_ms = 0;
-        }
+    const uint64_t end = m_total_samples.load(std::memory_order_acquire);
+    if (position > end) {
+        // Timeline was reset by resume(); start over from the beginning.
+        position = 0;
+    }
+
+    uint64_t begin = std::min(end, std::max(position, m_clear_pos.load(std::memory_order_acquire)));
+    size_t lost = 0;
+    if (end > m_audio.size() && begin < end - m_audio.size()) {
+        lost = static_cast<size_t>(end - m_audio.size() - begin);
+        begin = end - m_audio.size();
     }
+
+    lost += copy_range(begin, end, result);
+    position = end;
+    return lost;
 }
 
 bool sdl_poll_events() {
@@ -5,7 +5,6 @@
 
 #include <atomic>
 #include <cstdint>
-#include <mutex>
 #include <vector>
 
 //
@@ -39,22 +38,46 @@ public:
         get(ms, audio, _unused);
     }
 
+    // Copy only the samples captured after `position` (an absolute sample index on the timeline
+    // since the most recent resume()) into `audio`, and advance `position` to the newest sample.
+    // Returns how many samples were lost because the consumer fell more than len_ms behind.
+    size_t read_since(uint64_t &position, std::vector<float> &audio);
+
+    // Total samples captured since the most recent resume().
+    uint64_t total_samples() const {
+        return m_total_samples.load(std::memory_order_acquire);
+    }
+
+    size_t capacity_samples() const {
+        return m_audio.size();
+    }
+
 private:
+    // Fills `result` with ring samples [begin, end) and drops any leading samples the producer may
+    // have overwritten while they were being copied. Returns the number of samples dropped.
+    size_t copy_range(uint64_t begin, uint64_t end, std::vector<float> &result) const;
+
     SDL_AudioDeviceID m_dev_id_in = 0;
 
     int m_len_ms = 0;
     int m_sample_rate = 0;
 
     std::atomic_bool m_running;
-    std::mutex m_mutex;
 
-    std::vector<float> m_audio; // circular buffer
-    size_t m_audio_pos = 0;     // next write index
-    size_t m_audio_len = 0;     // number of valid samples in buffer (<= m_audio.size())
+    // Single-producer/single-consumer ring: the SDL callback is the only writer and never blocks.
+    // Positions are absolute sample indices; sample i lives at m_audio[i % m_audio.size()].
+    std::vector<float> m_audio;
 
-    // Total samples captured since the most recent resume().
-    // Guarded by m_mutex whenever modified or read together with buffer state.
-    uint64_t m_total_samples = 0;
+    // Total samples captured since the most recent resume(). Published by the callback after the
+    // samples are written (release), so everything below it is readable.
+    std::atomic<uint64_t> m_total_samples{0};
+
+    // Set by the callback before it starts overwriting slots; readers use it to detect samples that
+    // were overwritten while being copied (seqlock-style validation).
+    std::atomic<uint64_t> m_write_reserved{0};
+
+    // Samples before this position are hidden by clear().
+    std::atomic<uint64_t> m_clear_pos{0};
 };
 
 // Return false if need to quit
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "whisper.h"
+
+//
+// Log-mel spectrogram with a per-segment frame cache
+//
+
+// Reproduces whisper.cpp's log_mel_spectrogram() (periodic Hann, the same radix-2/DFT FFT, Slaney
+// mel filters, log10 floor at 1e-10, max - 8 clamp, (x + 4) / 4) so the result can be handed to
+// whisper_set_mel_with_state() and decoded with n_samples = 0.
+//
+// Raw log10 frames are cached by sample position relative to `origin`, the first start seen for the
+// current stream. A later call whose start lies on the same 10 ms hop grid reuses every frame whose
+// 400-sample window lies entirely inside audio it already saw; only the frames touched by new audio
+// (and, for a shifted start, the two reflection-padded head frames) are transformed again. The
+// clamp/normalize pass still runs per call because it depends on the global maximum.
+//
+// Samples at a given position must not change while the cache holds them: clear() whenever the
+// stream's timeline restarts.
+class LogMelCache {
+public:
+    static constexpr int kFftSize = WHISPER_N_FFT;
+    static constexpr int kHop = WHISPER_HOP_LENGTH;
+    static constexpr int kBins = kFftSize / 2 + 1;
+
+    void clear() {
+        raw_.clear();
+        n_valid_ = 0;
+        origin_ = -1;
+    }
+
+    // Whether a call starting at `start` would reuse cached frames.
+    bool covers(int64_t start) const {
+        return origin_ >= 0 && n_valid_ > 0 && start >= origin_ && (start - origin_) % kHop == 0;
+    }
+
+    // Computes the [n_mel][n_len] spectrogram of samples[0, n_samples), which begin at stream position
+    // `start`, and returns n_len (what whisper_pcm_to_mel gives, 30 s of padding included); data()
+    // holds it until the next call. `n_frames_audio` receives the frames covering real audio, i.e.
+    // what whisper_full seeks over. Returns 0 when the input is too short for whisper's padding.
+    int compute(const float *samples, size_t n_samples, int64_t start, int n_mel, int &n_frames_audio) {
+        constexpr int kPad = kFftSize / 2;
+        if (!samples || n_samples <= (size_t) kPad || n_mel <= 0) {
+            return 0;
+        }
+        if (n_mel != n_mel_) {
+            build_filters(n_mel);
+            clear();
+        }
+        if (origin_ < 0 || start < origin_ || (start - origin_) % kHop != 0) {
+            clear();
+            origin_ = start;
+        }
+
+        const int64_t n = (int64_t) n_samples;
+        const int n_len = (int) ((n + (int64_t) WHISPER_CHUNK_SIZE * WHISPER_SAMPLE_RATE) / kHop);
+        const int n_fft_frames = std::min((int) ((n + kPad) / kHop + 1), n_len);
+        // Frames whose window doesn't reach past the last sample; later audio can't change them.
+        const int n_stable = std::min((int) ((n - kPad) / kHop + 1), n_fft_frames);
+        const int shift = (int) ((start - origin_) / kHop);
+        n_frames_audio = (int) (1 + (n + kPad - kFftSize) / kHop);
+
+        frames_.resize((size_t) n_fft_frames * n_mel_);
+        for (int j = 0; j < n_fft_frames; ++j) {
+            float *dst = frames_.data() + (size_t) j * n_mel_;
+            const int64_t i = (int64_t) j + shift;
+            // Head frames of a shifted start reflect samples that are new to this window.
+            const bool reusable = j < n_stable && (shift == 0 || j >= 2);
+            if (reusable && i < n_valid_) {
+                std::copy_n(raw_.data() + i * n_mel_, n_mel_, dst);
+                continue;
+            }
+            frame(samples, n, j, dst);
+            if (reusable && i == n_valid_) {
+                raw_.insert(raw_.end(), dst, dst + n_mel_);
+                ++n_valid_;
+            }
+        }
+
+        double mmax = -1e20;
+        for (float v : frames_) {
+            mmax = std::max(mmax, (double) v);
+        }
+        if (n_fft_frames < n_len) {
+            mmax = std::max(mmax, (double) kLogFloor);
+        }
+        mmax -= 8.0;
+        auto norm = [mmax](float v) {
+            return (float) ((std::max((double) v, mmax) + 4.0) / 4.0);
+        };
+
+        mel_.resize((size_t) n_mel_ * n_len);
+        const float pad = norm(kLogFloor);
+        for (int m = 0; m < n_mel_; ++m) {
+            float *row = mel_.data() + (size_t) m * n_len;
+            for (int j = 0; j < n_fft_frames; ++j) {
+                row[j] = norm(frames_[(size_t) j * n_mel_ + m]);
+            }
+            std::fill(row + n_fft_frames, row + n_len, pad);
+        }
+        return n_len;
+    }
+
+    const float *data() const {
+        return mel_.data();
+    }
+
+private:
+    static constexpr float kLogFloor = -10.0f; // log10(1e-10)
+
+    // Raw log10 mel energies of frame j (window centered on sample j * kHop, whisper's padding).
+    void frame(const float *samples, int64_t n, int j, float *dst) {
+        constexpr int kPad = kFftSize / 2;
+        if (window_.empty()) {
+            window_.resize(kFftSize);
+            sin_.resize(kFftSize);
+            cos_.resize(kFftSize);
+            for (int i = 0; i < kFftSize; ++i) {
+                window_[i] = (float) (0.5 * (1.0 - cos((2.0 * M_PI * i) / kFftSize)));
+                sin_[i] = (float) sin((2.0 * M_PI * i) / kFftSize);
+                cos_[i] = (float) cos((2.0 * M_PI * i) / kFftSize);
+            }
+            fft_in_.resize(kFftSize * 2);
+            fft_out_.resize(kFftSize * 2 * 2 * 2);
+        }
+
+        const int64_t offset = (int64_t) j * kHop;
+        for (int k = 0; k < kFftSize; ++k) {
+            const int64_t p = offset + k; // index into whisper's padded buffer
+            float x = 0.0f;
+            if (p < kPad) {
+                x = samples[kPad - p];
+            } else if (p - kPad < n) {
+                x = samples[p - kPad];
+            }
+            fft_in_[k] = window_[k] * x;
+        }
+        fft(fft_in_.data(), kFftSize, fft_out_.data());
+
+        float *power = fft_out_.data();
+        for (int k = 0; k < kBins; ++k) {
+            power[k] = fft_out_[2 * k] * fft_out_[2 * k] + fft_out_[2 * k + 1] * fft_out_[2 * k + 1];
+        }
+        for (int m = 0; m < n_mel_; ++m) {
+            const float *w = filters_.data() + (size_t) m * kBins;
+            double sum = 0.0;
+            for (int k = 0; k < kBins; ++k) {
+                sum += power[k] * w[k];
+            }
+            dst[m] = (float) log10(std::max(sum, 1e-10));
+        }
+    }
+
+    void dft(const float *in, int N, float *out) const {
+        const int step = kFftSize / N;
+        for (int k = 0; k < N; ++k) {
+            float re = 0.0f;
+            float im = 0.0f;
+            for (int i = 0; i < N; ++i) {
+                const int idx = (k * i * step) % kFftSize;
+                re += in[i] * cos_[idx];
+                im -= in[i] * sin_[idx];
+            }
+            out[2 * k] = re;
+            out[2 * k + 1] = im;
+        }
+    }
+
+    // Cooley-Tukey on even sizes, plain DFT once the size is odd (400 -> ... -> 25). `in` needs N
+    // floats of scratch after it and `out` 6N after its 2N.
+    void fft(float *in, int N, float *out) const {
+        if (N == 1) {
+            out[0] = in[0];
+            out[1] = 0.0f;
+            return;
+        }
+        const int half = N / 2;
+        if (N - half * 2 == 1) {
+            dft(in, N, out);
+            return;
+        }
+
+        float *even = in + N;
+        for (int i = 0; i < half; ++i) {
+            even[i] = in[2 * i];
+        }
+        float *even_fft = out + 2 * N;
+        fft(even, half, even_fft);
+
+        float *odd = even;
+        for (int i = 0; i < half; ++i) {
+            odd[i] = in[2 * i + 1];
+        }
+        float *odd_fft = even_fft + N;
+        fft(odd, half, odd_fft);
+
+        const int step = kFftSize / N;
+        for (int k = 0; k < half; ++k) {
+            const float re = cos_[k * step];
+            const float im = -sin_[k * step];
+            const float re_odd = odd_fft[2 * k];
+            const float im_odd = odd_fft[2 * k + 1];
+            out[2 * k] = even_fft[2 * k] + re * re_odd - im * im_odd;
+            out[2 * k + 1] = even_fft[2 * k + 1] + re * im_odd + im * re_odd;
+            out[2 * (k + half)] = even_fft[2 * k] - re * re_odd + im * im_odd;
+            out[2 * (k + half) + 1] = even_fft[2 * k + 1] - re * im_odd - im * re_odd;
+        }
+    }
+
+    // librosa.filters.mel(sr=16000, n_fft=400, n_mels=n_mel): Slaney scale and area normalization,
+    // which is what whisper's model files ship.
+    void build_filters(int n_mel) {
+        auto hz_to_mel = [](double f) {
+            const double logstep = log(6.4) / 27.0;
+            return f < 1000.0 ? f * 3.0 / 200.0 : 15.0 + log(f / 1000.0) / logstep;
+        };
+        auto mel_to_hz = [](double m) {
+            const double logstep = log(6.4) / 27.0;
+            return m < 15.0 ? m * 200.0 / 3.0 : 1000.0 * exp(logstep * (m - 15.0));
+        };
+
+        const double fmax = WHISPER_SAMPLE_RATE / 2.0;
+        std::vector<double> mel_f((size_t) n_mel + 2);
+        for (int i = 0; i < n_mel + 2; ++i) {
+            mel_f[i] = mel_to_hz(hz_to_mel(fmax) * i / (n_mel + 1));
+        }
+
+        filters_.assign((size_t) n_mel * kBins, 0.0f);
+        for (int m = 0; m < n_mel; ++m) {
+            const double lo = mel_f[m];
+            const double mid = mel_f[m + 1];
+            const double hi = mel_f[m + 2];
+            const double enorm = 2.0 / (hi - lo);
+            for (int k = 0; k < kBins; ++k) {
+                const double f = (double) k * WHISPER_SAMPLE_RATE / kFftSize;
+                const double w = std::max(0.0, std::min((f - lo) / (mid - lo), (hi - f) / (hi - mid)));
+                filters_[(size_t) m * kBins + k] = (float) (w * enorm);
+            }
+        }
+        n_mel_ = n_mel;
+    }
+
+    int n_mel_ = 0;
+    std::vector<float> filters_; // [n_mel][kBins]
+    std::vector<float> window_;
+    std::vector<float> sin_;
+    std::vector<float> cos_;
+    std::vector<float> fft_in_;
+    std::vector<float> fft_out_;
+
+    int64_t origin_ = -1;
+    std::vector<float> raw_; // frame-major raw log10 frames relative to origin_
+    int64_t n_valid_ = 0;
+    std::vector<float> frames_; // this call's frames, frame-major
+    std::vector<float> mel_;    // this call's normalized spectrogram, [n_mel][n_len]
+};
@@ -0,0 +1,198 @@
+#include "openflow-core.h"
+
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <stdexcept>
+
+bool is_control_piece(const std::string &s) {
+    size_t i = 0;
+    while (i < s.size() && std::isspace(static_cast<unsigned char>(s[i]))) ++i;
+    if (i + 1 < s.size() && s[i] == '<' && s[i + 1] == '|') return true;
+    if (i + 1 < s.size() && s[i] == '[' && s[i + 1] == '_') return true;
+    return false;
+}
+
+SileroVadRunner::SileroVadRunner(const std::string &model_path,
+                                 int sample_rate,
+                                 bool use_gpu,
+                                 int n_threads)
+    : sample_rate_(sample_rate),
+      context_(nullptr, VadContextDeleter{}) {
+    if (sample_rate_ != WHISPER_SAMPLE_RATE) {
+        throw std::runtime_error("Silero VAD expects 16 kHz audio");
+    }
+
+    whisper_vad_context_params ctx_params = whisper_vad_default_context_params();
+    ctx_params.n_threads = std::max(1, n_threads);
+    ctx_params.use_gpu = use_gpu;
+
+    context_.reset(whisper_vad_init_from_file_with_params(model_path.c_str(), ctx_params));
+    if (!context_) {
+        throw std::runtime_error("Failed to initialize Silero VAD context");
+    }
+
+    std::vector<float> probe(chunk_size_, 0.0f);
+    if (!whisper_vad_detect_speech(context_.get(), probe.data(), static_cast<int>(probe.size()))) {
+        throw std::runtime_error("Failed to probe Silero VAD");
+    }
+}
+
+float SileroVadRunner::infer(const float *samples, size_t n_samples) {
+    if (!samples || n_samples == 0) {
+        throw std::runtime_error("Silero VAD received invalid audio chunk");
+    }
+    if (!whisper_vad_detect_speech(context_.get(), samples, static_cast<int>(n_samples))) {
+        throw std::runtime_error("Silero VAD failed to process audio chunk");
+    }
+
+    int n_probs = whisper_vad_n_probs(context_.get());
+    if (n_probs <= 0) {
+        throw std::runtime_error("Silero VAD returned no probabilities");
+    }
+    float *probs = whisper_vad_probs(context_.get());
+    if (!probs) {
+        throw std::runtime_error("Silero VAD probabilities pointer was null");
+    }
+    return probs[n_probs - 1];
+}
+
+void SileroVadRunner::infer_batch(const float *samples, size_t n_windows, std::vector<float> &probs) {
+    if (!samples || n_windows == 0) {
+        throw std::runtime_error("Silero VAD received invalid audio batch");
+    }
+    if (!whisper_vad_detect_speech(context_.get(), samples, static_cast<int>(n_windows * chunk_size_))) {
+        throw std::runtime_error("Silero VAD failed to process audio batch");
+    }
+
+    const int n_probs = whisper_vad_n_probs(context_.get());
+    if (n_probs != static_cast<int>(n_windows)) {
+        throw std::runtime_error("Silero VAD returned unexpected probability count for batch");
+    }
+    const float *batch_probs = whisper_vad_probs(context_.get());
+    if (!batch_probs) {
+        throw std::runtime_error("Silero VAD probabilities pointer was null");
+    }
+    probs.assign(batch_probs, batch_probs + n_probs);
+}
+
+void append_json_escaped(std::string &out, const char *s, size_t n) {
+    size_t run = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const char *esc = nullptr;
+        switch (s[i]) {
+        case '\\': esc = "\\\\"; break;
+        case '\"': esc = "\\\""; break;
+        case '\n': esc = "\\n"; break;
+        case '\r': esc = "\\r"; break;
+        case '\t': esc = "\\t"; break;
+        default: continue;
+        }
+        out.append(s + run, i - run);
+        out.append(esc, 2);
+        run = i + 1;
+    }
+    out.append(s + run, n - run);
+}
+
+std::string escape_json(const std::string &s) {
+    std::string out;
+    out.reserve(s.size() + 8);
+    append_json_escaped(out, s);
+    return out;
+}
+
+std::string string_printf(const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    va_list copy;
+    va_copy(copy, args);
+    const int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    std::string out;
+    if (n < 0) {
+        va_end(copy);
+        return out;
+    }
+    if ((size_t) n < sizeof(buf)) {
+        out.assign(buf, (size_t) n);
+    } else {
+        out.resize((size_t) n + 1);
+        vsnprintf(&out[0], out.size(), fmt, copy);
+        out.resize((size_t) n);
+    }
+    va_end(copy);
+    return out;
+}
+
+void write_stdout(const std::string &records) {
+    if (records.empty()) return;
+    fwrite(records.data(), 1, records.size(), stdout);
+    fflush(stdout);
+}
+
+void append_tokens_json(std::string &out, piece_seq pieces) {
+    char buf[128];
+    out += '[';
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (i) out += ',';
+        const auto &p = pieces[i];
+        out += "{\"text\":\"";
+        append_json_escaped(out, p.text);
+        const int n = snprintf(buf, sizeof(buf), "\",\"t0_ms\":%lld,\"t1_ms\":%lld,\"leading_space\":%s}",
+                               (long long)p.t0_ms,
+                               (long long)p.t1_ms,
+                               p.leading_space ? "true" : "false");
+        out.append(buf, (size_t)n);
+    }
+    out += ']';
+}
+
+void collect_pieces(whisper_context *ctx, whisper_state *state, int64_t start_ms, std::vector<Piece> &pieces) {
+    const int n_segments = state ? whisper_full_n_segments_from_state(state) : whisper_full_n_segments(ctx);
+    for (int s = 0; s < n_segments; ++s) {
+        const int n_tok = state ? whisper_full_n_tokens_from_state(state, s) : whisper_full_n_tokens(ctx, s);
+        for (int i = 0; i < n_tok; ++i) {
+            auto td = state ? whisper_full_get_token_data_from_state(state, s, i) : whisper_full_get_token_data(ctx, s, i);
+            const char *pc = whisper_token_to_str(ctx, td.id);
+            if (!pc) continue;
+            std::string piece = pc;
+            if (is_control_piece(piece)) continue;
+
+            bool leading = (!piece.empty() && std::isspace(static_cast<unsigned char>(piece[0])));
+            int64_t t0 = td.t0 >= 0 ? start_ms + (int64_t)td.t0 * 10 : -1;
+            int64_t t1 = td.t1 >= 0 ? start_ms + (int64_t)td.t1 * 10 : -1;
+
+            pieces.push_back({std::move(piece), td.id, t0, t1, leading});
+        }
+    }
+}
+
+// The encoder covers 50 positions per second of audio (1500 for the 30 s window); the margin keeps
+// the last words well inside the window, and rounding up to a bucket keeps the number of distinct
+// encoder graph sizes small.
+int auto_audio_ctx(size_t n_samples, int n_audio_ctx) {
+    constexpr int kPerSecond = 50;
+    constexpr int kMargin = 64;  // ~1.3 s
+    constexpr int kBucket = 128; // ~2.6 s
+    const int need = (int)((n_samples * kPerSecond + WHISPER_SAMPLE_RATE - 1) / WHISPER_SAMPLE_RATE) + kMargin;
+    const int ctx = (need + kBucket - 1) / kBucket * kBucket;
+    return ctx >= n_audio_ctx ? 0 : ctx;
+}
+
+size_t incremental_commit_count(const std::vector<Piece> &prev_tail, const std::vector<Piece> &hyp, int64_t force_before_ms) {
+    size_t limit = 0;
+    while (limit < prev_tail.size() && limit < hyp.size() && prev_tail[limit].id == hyp[limit].id) {
+        ++limit;
+    }
+    while (limit < hyp.size() && hyp[limit].t1_ms >= 0 && hyp[limit].t1_ms <= force_before_ms) {
+        ++limit;
+    }
+    for (size_t c = limit; c > 0; --c) {
+        if (c < hyp.size() && hyp[c].leading_space && hyp[c - 1].t1_ms >= 0) {
+            return c;
+        }
+    }
+    return 0;
+}
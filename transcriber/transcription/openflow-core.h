@@ -0,0 +1,274 @@
+#pragma once
+
+#include "whisper.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// openflow_core: the VAD runner, sample timeline, partial scheduling and record emitters shared by
+// openflow_transcriber and the sliding-window transcriber (stream.cpp)
+//
+// Not shared yet: DecodeQueue and the decode worker loop stay in openflow_transcriber.cpp. They are
+// built around its stream_session/decode_job types (sessions, speculations, full-pass chunks); the
+// sliding window decodes inline on its capture thread and has no queue to share them with.
+//
+
+// Decode threads when --threads isn't given. Past two, whisper's decoder mostly waits on memory, and
+// hardware_concurrency() counts efficiency cores that slow the whole pool down.
+inline int32_t default_decode_threads() {
+    return (int32_t) std::min(2u, std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// Whisper's special tokens (<|...|>) and its [_...] markers, leading whitespace allowed.
+bool is_control_piece(const std::string &s);
+
+struct VadContextDeleter {
+    void operator()(whisper_vad_context *ctx) const {
+        if (ctx) {
+            whisper_vad_free(ctx);
+        }
+    }
+};
+
+// Silero VAD through whisper.cpp, one probability per 512-sample (32 ms) window. Throws
+// std::runtime_error when the model can't be loaded or a call fails.
+class SileroVadRunner {
+public:
+    SileroVadRunner(const std::string &model_path, int sample_rate, bool use_gpu, int n_threads);
+
+    size_t chunk_size() const {
+        return chunk_size_;
+    }
+
+    float infer(const float *samples, size_t n_samples);
+
+    // One whisper_vad_detect_speech call over n_windows consecutive chunk_size() windows; fills
+    // probs with one probability per window. Silero's recurrent state carries across the windows of
+    // a batch (whisper resets it at the start of every call).
+    void infer_batch(const float *samples, size_t n_windows, std::vector<float> &probs);
+
+private:
+    int sample_rate_;
+    size_t chunk_size_ = 512;
+    std::unique_ptr<whisper_vad_context, VadContextDeleter> context_;
+};
+
+// Appends s[0, n) to `out` escaped for a JSON string. Runs without an escape are appended whole.
+void append_json_escaped(std::string &out, const char *s, size_t n);
+
+inline void append_json_escaped(std::string &out, const std::string &s) {
+    append_json_escaped(out, s.data(), s.size());
+}
+
+std::string escape_json(const std::string &s);
+
+std::string string_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Writes whole records with a single fwrite so lines/frames from different threads never interleave.
+void write_stdout(const std::string &records);
+
+struct Piece {
+    std::string text;
+    whisper_token id;
+    int64_t t0_ms;
+    int64_t t1_ms;
+    bool leading_space;
+};
+
+// A segment's tokens as up to two runs (an incremental partial's committed prefix and its tail), so
+// they can be formatted without first being copied into one vector.
+struct piece_seq {
+    const Piece *head = nullptr;
+    size_t n_head = 0;
+    const Piece *tail = nullptr;
+    size_t n_tail = 0;
+
+    piece_seq(const std::vector<Piece> &v) : head(v.data()), n_head(v.size()) {}
+    piece_seq(const std::vector<Piece> &h, const std::vector<Piece> &t)
+        : head(h.data()), n_head(h.size()), tail(t.data()), n_tail(t.size()) {}
+
+    size_t size() const { return n_head + n_tail; }
+    const Piece &operator[](size_t i) const { return i < n_head ? head[i] : tail[i - n_head]; }
+};
+
+// Appends pieces as a JSON array of {"text","t0_ms","t1_ms","leading_space"} objects.
+void append_tokens_json(std::string &out, piece_seq pieces);
+
+// Appends the text tokens of the last whisper_full on `state` (the context's own state when null),
+// with token times made absolute: start_ms is where the decoded audio begins.
+void collect_pieces(whisper_context *ctx, whisper_state *state, int64_t start_ms, std::vector<Piece> &pieces);
+
+// audio_ctx for --audio-ctx auto: encoder positions for n_samples of audio plus a margin, rounded up
+// to a bucket; 0 (the full window) once that's no smaller than n_audio_ctx.
+int auto_audio_ctx(size_t n_samples, int n_audio_ctx);
+
+// Number of leading hypothesis tokens that can be committed. A token qualifies when it matches the
+// previous hypothesis, or when it ends before force_before_ms (keeps the window bounded even if the
+// decoder keeps flip-flopping). The cut is only made where the next token starts a new word, so
+// committed text never ends mid-word.
+size_t incremental_commit_count(const std::vector<Piece> &prev_tail, const std::vector<Piece> &hyp, int64_t force_before_ms);
+
+// Audio on one contiguous buffer addressed by absolute sample index (0 = first sample of the job).
+// VAD chunks, pre-roll, segments and decode windows are all index ranges into it, so samples are
+// copied once on the way in. release_before() drops history nobody needs anymore; the storage is
+// compacted lazily, and reallocated smaller once it is mostly spare capacity (e.g. after a spill),
+// which invalidates pointers but never indices.
+class SampleTimeline {
+public:
+    void clear() {
+        buf_.clear();
+        head_ = 0;
+        begin_ = 0;
+        shrink_if_sparse();
+    }
+
+    int64_t begin() const {
+        return begin_;
+    }
+
+    int64_t end() const {
+        return begin_ + (int64_t)(buf_.size() - head_);
+    }
+
+    // Memory the timeline holds on to, released prefix and spare capacity included.
+    size_t resident_bytes() const {
+        return buf_.capacity() * sizeof(float);
+    }
+
+    // Pointer to sample `abs`; valid until the next append or release_before().
+    const float *data(int64_t abs) const {
+        return buf_.data() + head_ + (size_t)(abs - begin_);
+    }
+
+    void append(const float *samples, size_t n) {
+        float *dst = extend(n);
+        std::memcpy(dst, samples, n * sizeof(float));
+    }
+
+    void append_zeros(size_t n) {
+        float *dst = extend(n);
+        std::fill(dst, dst + n, 0.0f);
+    }
+
+    // Grows the timeline by n samples and returns where to write them (e.g. straight from fread).
+    float *extend(size_t n) {
+        const size_t old_size = buf_.size();
+        buf_.resize(old_size + n);
+        return buf_.data() + old_size;
+    }
+
+    void release_before(int64_t abs) {
+        abs = std::min(abs, end());
+        if (abs <= begin_) {
+            return;
+        }
+        head_ += (size_t)(abs - begin_);
+        begin_ = abs;
+
+        // Compact once the dead prefix dominates; amortized O(1) per sample.
+        constexpr size_t kMinCompact = WHISPER_SAMPLE_RATE;
+        if (head_ >= kMinCompact && head_ * 2 >= buf_.size()) {
+            buf_.erase(buf_.begin(), buf_.begin() + (std::ptrdiff_t)head_);
+            head_ = 0;
+            shrink_if_sparse();
+        }
+    }
+
+private:
+    // erase() and clear() keep the vector's capacity, so a timeline that once held a long stretch
+    // would keep its peak size resident. Give it back once it's under a quarter used; appends grow
+    // the buffer geometrically again, so this stays amortized O(1) per sample.
+    void shrink_if_sparse() {
+        constexpr size_t kMinCapacity = (size_t)WHISPER_SAMPLE_RATE * 4;
+        if (buf_.capacity() > kMinCapacity && buf_.size() * 4 < buf_.capacity()) {
+            std::vector<float> shrunk;
+            shrunk.reserve(std::max(kMinCapacity, buf_.size() * 2));
+            shrunk.assign(buf_.begin(), buf_.end());
+            buf_.swap(shrunk);
+        }
+    }
+
+    std::vector<float> buf_;
+    size_t head_ = 0;   // index in buf_ of sample begin_
+    int64_t begin_ = 0; // absolute index of the oldest retained sample
+};
+
+// Partial cadence between --step-min and --step-max. Decoders feed it the measured whisper_full
+// time of each partial; the capture thread asks for the interval before the next one, which is the
+// predicted decode time of that partial (EWMA of decode ms per audio second times the audio it will
+// cover) scaled up by the decode backlog. With equal bounds it is just --step.
+class PartialCadence {
+public:
+    PartialCadence(double step_ms, double min_ms, double max_ms, bool incremental)
+        : min_ms_(min_ms), max_ms_(std::max(min_ms, max_ms)), incremental_(incremental),
+          interval_ms_(std::clamp(step_ms, min_ms_, max_ms_)) {}
+
+    bool adaptive() const {
+        return max_ms_ > min_ms_;
+    }
+
+    void observe(double decode_ms, double audio_ms) {
+        if (audio_ms <= 0.0) {
+            return;
+        }
+        constexpr double kAlpha = 0.2;
+        const double per_s = decode_ms * 1000.0 / audio_ms;
+        std::lock_guard<std::mutex> lock(mu_);
+        ms_per_audio_s_ = n_observed_ == 0 ? per_s : kAlpha * per_s + (1.0 - kAlpha) * ms_per_audio_s_;
+        last_audio_ms_ = audio_ms;
+        ++n_observed_;
+    }
+
+    // segment_ms is the open segment so far; an incremental partial only decodes its uncommitted
+    // tail, estimated from the previous partial's window.
+    double next_interval_ms(double segment_ms, size_t backlog) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (adaptive() && n_observed_ > 0) {
+            const double upcoming_ms = incremental_ ? std::min(segment_ms, last_audio_ms_ + interval_ms_) : segment_ms;
+            const double predicted_ms = ms_per_audio_s_ * upcoming_ms / 1000.0;
+            interval_ms_ = std::clamp(predicted_ms * (double)(1 + backlog), min_ms_, max_ms_);
+        }
+        return interval_ms_;
+    }
+
+    void count_enqueued() {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++n_enqueued_;
+    }
+
+    void count_skipped() {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++n_skipped_;
+    }
+
+    struct stats {
+        double interval_ms;
+        double ms_per_audio_s;
+        size_t enqueued;
+        size_t skipped;
+    };
+
+    stats snapshot() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return {interval_ms_, ms_per_audio_s_, n_enqueued_, n_skipped_};
+    }
+
+private:
+    std::mutex mu_;
+    const double min_ms_;
+    const double max_ms_;
+    const bool incremental_;
+    double interval_ms_;
+    double ms_per_audio_s_ = 0.0;
+    double last_audio_ms_ = 0.0;
+    size_t n_observed_ = 0;
+    size_t n_enqueued_ = 0;
+    size_t n_skipped_ = 0; // partials not sent because the segment was about to flush
+};
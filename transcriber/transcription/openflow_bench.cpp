@@ -0,0 +1,801 @@
+// openflow_bench: replays a directory of WAV fixtures through openflow_transcriber (--stdin-pcm, the
+// same VAD -> segment -> whisper_full path the app streams through) over a matrix of settings, and
+// reports partial/final latency percentiles, RTF and peak memory per configuration as JSON.
+// Fixtures with a NAME.txt reference next to NAME.wav also get a word error rate, which is what
+// guards --audio-ctx settings against losing accuracy for speed.
+
+#include "wav-source.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr int kSampleRate = 16000;
+
+struct bench_params {
+    std::string transcriber;
+    std::string fixtures_dir;
+    std::string vad_model_path;
+    std::string dictionary_path;
+    std::string out_path;
+    std::vector<std::string> models = {"models/ggml-base.en.bin"};
+    std::vector<int> threads = {2};
+    std::vector<int> beam_sizes = {0};
+    std::vector<int> steps = {200};
+    std::vector<int> bias = {0};
+    std::vector<std::string> audio_ctx = {"0"};
+    double max_wer_delta = 0.02;
+    std::vector<std::string> extra_args;
+    bool realtime = true;
+    int frame_ms = 20;
+    int repeat = 1;
+    bool transcripts = false;
+    bool verbose = false;
+};
+
+void print_usage(char **argv, const bench_params &p) {
+    fprintf(stderr, "usage: %s --fixtures DIR --silero-vad PATH [options] [-- transcriber args...]\n\n", argv[0]);
+    fprintf(stderr, "  --fixtures DIR             directory of .wav files, replayed in name order (required)\n");
+    fprintf(stderr, "  --silero-vad PATH          Silero VAD ggml model (required)\n");
+    fprintf(stderr, "  --transcriber PATH         openflow_transcriber binary [next to this binary]\n");
+    fprintf(stderr, "  --models A,B               whisper models to compare [%s]\n", p.models.front().c_str());
+    fprintf(stderr, "  --threads A,B              decoder thread counts [2]\n");
+    fprintf(stderr, "  --beam-size A,B            beam sizes for bias decoding; 0 = transcriber default [0]\n");
+    fprintf(stderr, "  --step A,B                 partial cadences in ms; -1 disables partials [200]\n");
+    fprintf(stderr, "  --bias off,on              bias decoding settings (on needs --dictionary-file) [off]\n");
+    fprintf(stderr, "  --audio-ctx A,B            transcriber --audio-ctx values (N, auto); 0 = full window [0]\n");
+    fprintf(stderr, "  --max-wer-delta F          fail a non-0 --audio-ctx run whose WER exceeds the matching full-window\n");
+    fprintf(stderr, "                             run's by more than F (vs. that run's text when there are no references) [%.2f]\n", p.max_wer_delta);
+    fprintf(stderr, "  --dictionary-file PATH     dictionary passed to every run\n");
+    fprintf(stderr, "  --pace realtime|fast       feed audio at capture speed or as fast as the pipe takes it [realtime]\n");
+    fprintf(stderr, "  --frame-ms N               audio per PCM frame [%d]\n", p.frame_ms);
+    fprintf(stderr, "  --repeat N                 passes over the fixtures per configuration [%d]\n", p.repeat);
+    fprintf(stderr, "  --transcripts              include each fixture's final text in the report\n");
+    fprintf(stderr, "  --out PATH                 write the JSON report here instead of stdout\n");
+    fprintf(stderr, "  -v, --verbose              pass the transcriber's stderr through\n");
+}
+
+template <typename T, typename F>
+std::vector<T> split_list(const std::string &s, F parse) {
+    std::vector<T> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            out.push_back(parse(item));
+        }
+    }
+    return out;
+}
+
+bool parse_args(int argc, char **argv, bench_params &p) {
+    auto need = [&](const char *flag, int &i) -> const char * {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", flag);
+            exit(1);
+        }
+        return argv[++i];
+    };
+    auto to_int = [](const std::string &v) { return atoi(v.c_str()); };
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        if (a == "-h" || a == "--help") {
+            print_usage(argv, p);
+            exit(0);
+        } else if (a == "--") {
+            p.extra_args.assign(argv + i + 1, argv + argc);
+            break;
+        } else if (a == "--fixtures") {
+            p.fixtures_dir = need(a.c_str(), i);
+        } else if (a == "--silero-vad") {
+            p.vad_model_path = need(a.c_str(), i);
+        } else if (a == "--transcriber") {
+            p.transcriber = need(a.c_str(), i);
+        } else if (a == "--models" || a == "--model") {
+            p.models = split_list<std::string>(need(a.c_str(), i), [](const std::string &v) { return v; });
+        } else if (a == "--threads") {
+            p.threads = split_list<int>(need(a.c_str(), i), to_int);
+        } else if (a == "--beam-size") {
+            p.beam_sizes = split_list<int>(need(a.c_str(), i), to_int);
+        } else if (a == "--step") {
+            p.steps = split_list<int>(need(a.c_str(), i), to_int);
+        } else if (a == "--bias") {
+            p.bias = split_list<int>(need(a.c_str(), i), [](const std::string &v) { return v == "on" || v == "1" ? 1 : 0; });
+        } else if (a == "--audio-ctx") {
+            p.audio_ctx = split_list<std::string>(need(a.c_str(), i), [](const std::string &v) { return v; });
+        } else if (a == "--max-wer-delta") {
+            p.max_wer_delta = std::max(0.0, atof(need(a.c_str(), i)));
+        } else if (a == "--dictionary-file") {
+            p.dictionary_path = need(a.c_str(), i);
+        } else if (a == "--pace") {
+            const std::string v = need(a.c_str(), i);
+            if (v != "realtime" && v != "fast") {
+                fprintf(stderr, "unknown --pace '%s' (realtime|fast)\n", v.c_str());
+                return false;
+            }
+            p.realtime = v == "realtime";
+        } else if (a == "--frame-ms") {
+            p.frame_ms = std::clamp(atoi(need(a.c_str(), i)), 1, 1000);
+        } else if (a == "--repeat") {
+            p.repeat = std::max(1, atoi(need(a.c_str(), i)));
+        } else if (a == "--transcripts") {
+            p.transcripts = true;
+        } else if (a == "--out") {
+            p.out_path = need(a.c_str(), i);
+        } else if (a == "-v" || a == "--verbose") {
+            p.verbose = true;
+        } else {
+            fprintf(stderr, "unknown argument '%s'\n", a.c_str());
+            return false;
+        }
+    }
+    if (p.fixtures_dir.empty() || p.vad_model_path.empty()) {
+        print_usage(argv, p);
+        return false;
+    }
+    if (p.models.empty() || p.threads.empty() || p.beam_sizes.empty() || p.steps.empty() || p.bias.empty() ||
+        p.audio_ctx.empty()) {
+        fprintf(stderr, "error: every matrix axis needs at least one value\n");
+        return false;
+    }
+    return true;
+}
+
+struct fixture {
+    std::string name;
+    std::vector<float> pcm; // mono, kSampleRate
+    bool has_reference = false;
+    std::string reference; // NAME.txt next to NAME.wav
+};
+
+bool load_fixtures(const std::string &dir, std::vector<fixture> &out) {
+    std::vector<std::filesystem::path> paths;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".wav") {
+            paths.push_back(entry.path());
+        }
+    }
+    if (ec) {
+        fprintf(stderr, "error: cannot list fixtures in '%s': %s\n", dir.c_str(), ec.message().c_str());
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    for (const auto &path : paths) {
+        MappedWavSource wav;
+        if (!wav.open(path.string(), kSampleRate)) {
+            return false;
+        }
+        fixture f;
+        f.name = path.filename().string();
+        f.pcm.resize(wav.total_samples());
+        wav.read(f.pcm.data(), f.pcm.size());
+        std::filesystem::path ref_path = path;
+        ref_path.replace_extension(".txt");
+        if (FILE *ref = fopen(ref_path.string().c_str(), "rb")) {
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), ref)) > 0) {
+                f.reference.append(buf, n);
+            }
+            fclose(ref);
+            f.has_reference = true;
+        }
+        out.push_back(std::move(f));
+    }
+    if (out.empty()) {
+        fprintf(stderr, "error: no .wav fixtures in '%s'\n", dir.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Just enough JSON for the transcriber's own flat NDJSON records.
+bool json_has(const std::string &line, const char *needle) {
+    return line.find(needle) != std::string::npos;
+}
+
+double json_number(const std::string &line, const std::string &key, double fallback = 0.0) {
+    const std::string pat = "\"" + key + "\":";
+    const size_t at = line.find(pat);
+    if (at == std::string::npos) {
+        return fallback;
+    }
+    return strtod(line.c_str() + at + pat.size(), nullptr);
+}
+
+// The raw (still escaped) contents of a string field.
+std::string json_string_raw(const std::string &line, const std::string &key) {
+    const std::string pat = "\"" + key + "\":\"";
+    const size_t at = line.find(pat);
+    if (at == std::string::npos) {
+        return {};
+    }
+    size_t i = at + pat.size();
+    const size_t begin = i;
+    while (i < line.size() && line[i] != '"') {
+        i += line[i] == '\\' ? 2 : 1;
+    }
+    return line.substr(begin, std::min(i, line.size()) - begin);
+}
+
+// Undoes escape_json() (and \uXXXX for ASCII), enough to compare transcripts word by word.
+std::string json_unescape(const std::string &s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] != '\\' || i + 1 >= s.size()) {
+            out += s[i];
+            continue;
+        }
+        const char c = s[++i];
+        switch (c) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'u':
+                if (i + 4 < s.size()) {
+                    const long cp = strtol(s.substr(i + 1, 4).c_str(), nullptr, 16);
+                    out += cp < 0x80 ? (char)cp : ' ';
+                    i += 4;
+                }
+                break;
+            default: out += c; break;
+        }
+    }
+    return out;
+}
+
+// Lowercased words with punctuation dropped, so WER counts wording rather than formatting.
+std::vector<std::string> words_of(const std::string &text) {
+    std::vector<std::string> words;
+    std::string cur;
+    for (const char c : text) {
+        const unsigned char u = (unsigned char)c;
+        if (std::isalnum(u) || c == '\'' || u >= 0x80) {
+            cur += (char)std::tolower(u);
+        } else if (std::isspace(u) && !cur.empty()) {
+            words.push_back(std::move(cur));
+            cur.clear();
+        }
+    }
+    if (!cur.empty()) {
+        words.push_back(std::move(cur));
+    }
+    return words;
+}
+
+// Word-level Levenshtein distance.
+size_t word_edits(const std::vector<std::string> &ref, const std::vector<std::string> &hyp) {
+    std::vector<size_t> row(hyp.size() + 1);
+    for (size_t j = 0; j <= hyp.size(); ++j) {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= ref.size(); ++i) {
+        size_t diag = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= hyp.size(); ++j) {
+            const size_t up = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diag + (ref[i - 1] == hyp[j - 1] ? 0 : 1)});
+            diag = up;
+        }
+    }
+    return row[hyp.size()];
+}
+
+// Corpus WER: total word edits over total reference words. Negative when there's nothing to score.
+double corpus_wer(const std::vector<std::string> &refs, const std::vector<std::string> &hyps) {
+    size_t edits = 0;
+    size_t words = 0;
+    for (size_t i = 0; i < refs.size(); ++i) {
+        const auto ref = words_of(refs[i]);
+        edits += word_edits(ref, i < hyps.size() ? words_of(hyps[i]) : std::vector<std::string>());
+        words += ref.size();
+    }
+    return words ? (double)edits / (double)words : (refs.empty() ? -1.0 : 0.0);
+}
+
+struct percentiles {
+    size_t n = 0;
+    double p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+percentiles summarize(std::vector<double> v) {
+    percentiles out;
+    out.n = v.size();
+    if (v.empty()) {
+        return out;
+    }
+    std::sort(v.begin(), v.end());
+    auto rank = [&](double q) {
+        const size_t k = (size_t)std::ceil(q * (double)v.size());
+        return v[std::min(v.size() - 1, k > 0 ? k - 1 : 0)];
+    };
+    out.p50 = rank(0.50);
+    out.p95 = rank(0.95);
+    out.p99 = rank(0.99);
+    out.max = v.back();
+    return out;
+}
+
+std::string percentiles_json(const percentiles &p) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"n\":%zu,\"p50\":%.1f,\"p95\":%.1f,\"p99\":%.1f,\"max\":%.1f}",
+             p.n, p.p50, p.p95, p.p99, p.max);
+    return buf;
+}
+
+std::string escape_json(const std::string &s) {
+    std::string out;
+    out.reserve(s.size() + 8);
+    for (const char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+struct run_config {
+    std::string model;
+    int threads = 0;
+    int beam_size = 0;
+    int step_ms = 0;
+    bool bias = false;
+    std::string audio_ctx = "0";
+
+    bool same_except_audio_ctx(const run_config &o) const {
+        return model == o.model && threads == o.threads && beam_size == o.beam_size && step_ms == o.step_ms &&
+               bias == o.bias;
+    }
+};
+
+struct run_result {
+    bool ok = false;
+    int exit_status = -1;
+    double startup_ms = 0.0;
+    double audio_ms = 0.0;
+    double busy_ms = 0.0; // job_start -> job_end, summed over jobs
+    int64_t peak_rss_bytes = -1;
+    size_t emit_records = 0; // from the transcriber's --metrics stats
+    bool emit_allocs_counted = false; // the transcriber was built with OPENFLOW_ALLOC_STATS
+    double emit_allocs = 0.0;
+    double emit_allocs_max = 0.0;
+    std::vector<double> partial_latency_ms;
+    std::vector<double> final_latency_ms;
+    std::vector<std::pair<std::string, std::string>> transcripts; // fixture, escaped final text
+};
+
+// One transcriber process per configuration. The stdout reader timestamps every record; latency is
+// measured from the moment the audio up to the record's end_ms had been written to the pipe.
+class transcriber_session {
+public:
+    bool start(const bench_params &bp, const run_config &rc) {
+        std::vector<std::string> args = {
+            bp.transcriber,
+            "--stdin-pcm",
+            "--silero-vad", bp.vad_model_path,
+            "--model", rc.model,
+            "--threads", std::to_string(rc.threads),
+            "--step", std::to_string(rc.step_ms),
+            "--stats-ms", "0",
+            "--metrics",
+            "--audio-ctx", rc.audio_ctx,
+        };
+        if (rc.beam_size > 0) {
+            args.insert(args.end(), {"--beam-size", std::to_string(rc.beam_size)});
+        }
+        args.push_back(rc.bias ? "--bias-decoding" : "--no-bias-decoding");
+        if (!bp.dictionary_path.empty()) {
+            args.insert(args.end(), {"--dictionary-file", bp.dictionary_path});
+        }
+        args.insert(args.end(), bp.extra_args.begin(), bp.extra_args.end());
+
+        int in_pipe[2];
+        int out_pipe[2];
+        if (pipe(in_pipe) != 0 || pipe(out_pipe) != 0) {
+            perror("pipe");
+            return false;
+        }
+        started_at_ = bench_clock::now();
+        pid_ = fork();
+        if (pid_ < 0) {
+            perror("fork");
+            return false;
+        }
+        if (pid_ == 0) {
+            dup2(in_pipe[0], STDIN_FILENO);
+            dup2(out_pipe[1], STDOUT_FILENO);
+            if (!bp.verbose) {
+                const int devnull = open("/dev/null", O_WRONLY);
+                if (devnull >= 0) {
+                    dup2(devnull, STDERR_FILENO);
+                }
+            }
+            close(in_pipe[0]);
+            close(in_pipe[1]);
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+            std::vector<char *> cargs;
+            for (auto &a : args) {
+                cargs.push_back(const_cast<char *>(a.c_str()));
+            }
+            cargs.push_back(nullptr);
+            execv(cargs[0], cargs.data());
+            _exit(127);
+        }
+        close(in_pipe[0]);
+        close(out_pipe[1]);
+        in_ = fdopen(in_pipe[1], "wb");
+        out_fd_ = out_pipe[0];
+        reader_ = std::thread([this]() { read_loop(); });
+
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&] { return ready_ || eof_; });
+        result_.startup_ms = ms_since(started_at_, ready_at_);
+        return ready_;
+    }
+
+    // Streams one fixture as a B ... E job and waits for its job_end.
+    bool run_job(const fixture &f, const bench_params &bp) {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            feed_.clear();
+            final_text_.clear();
+            job_ended_ = false;
+        }
+        const size_t frame = (size_t)bp.frame_ms * kSampleRate / 1000;
+        const auto job_start = bench_clock::now();
+        if (!put_tag('B')) {
+            return false;
+        }
+        for (size_t off = 0; off < f.pcm.size(); off += frame) {
+            const uint32_t n = (uint32_t)std::min(frame, f.pcm.size() - off);
+            if (bp.realtime) {
+                std::this_thread::sleep_until(job_start + std::chrono::microseconds((int64_t)off * 1000000 / kSampleRate));
+            }
+            if (!put_tag('J') || fwrite(&n, sizeof(n), 1, in_) != 1 ||
+                fwrite(f.pcm.data() + off, sizeof(float), n, in_) != n || fflush(in_) != 0) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mu_);
+            feed_.push_back({(int64_t)(off + n), bench_clock::now()});
+        }
+        if (!put_tag('E')) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&] { return job_ended_ || eof_; });
+        if (!job_ended_) {
+            return false;
+        }
+        result_.audio_ms += (double)f.pcm.size() * 1000.0 / kSampleRate;
+        result_.busy_ms += ms_since(job_start, job_end_at_);
+        std::string text;
+        for (const auto &t : final_text_) {
+            if (!text.empty() && !t.empty() && t.front() != ' ') text += ' ';
+            text += t;
+        }
+        result_.transcripts.emplace_back(f.name, text);
+        return true;
+    }
+
+    run_result finish() {
+        if (in_) {
+            put_tag('Q');
+            fclose(in_);
+            in_ = nullptr;
+        }
+        if (reader_.joinable()) {
+            reader_.join();
+        }
+        if (out_fd_ >= 0) {
+            close(out_fd_);
+            out_fd_ = -1;
+        }
+        if (pid_ > 0) {
+            int status = 0;
+            struct rusage ru {};
+            if (wait4(pid_, &status, 0, &ru) == pid_) {
+                result_.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#if defined(__APPLE__)
+                result_.peak_rss_bytes = (int64_t)ru.ru_maxrss;
+#else
+                result_.peak_rss_bytes = (int64_t)ru.ru_maxrss * 1024;
+#endif
+            }
+            pid_ = -1;
+        }
+        return std::move(result_);
+    }
+
+private:
+    struct fed {
+        int64_t end_sample;
+        bench_clock::time_point at;
+    };
+
+    static double ms_since(bench_clock::time_point from, bench_clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    bool put_tag(char tag) {
+        return fputc(tag, in_) != EOF && fflush(in_) == 0;
+    }
+
+    void read_loop() {
+        std::string pending;
+        char buf[65536];
+        while (true) {
+            const ssize_t n = read(out_fd_, buf, sizeof(buf));
+            if (n <= 0) {
+                break;
+            }
+            const auto now = bench_clock::now();
+            pending.append(buf, (size_t)n);
+            size_t nl;
+            while ((nl = pending.find('\n')) != std::string::npos) {
+                on_line(pending.substr(0, nl), now);
+                pending.erase(0, nl + 1);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mu_);
+        eof_ = true;
+        cv_.notify_all();
+    }
+
+    void on_line(const std::string &line, bench_clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (json_has(line, "\"event\":\"ready\"")) {
+            ready_ = true;
+            ready_at_ = now;
+            cv_.notify_all();
+        } else if (json_has(line, "\"event\":\"segment\"")) {
+            const bool is_final = json_has(line, "\"final\":true");
+            const int64_t end_sample = (int64_t)json_number(line, "end_ms") * kSampleRate / 1000;
+            auto it = std::lower_bound(feed_.begin(), feed_.end(), end_sample,
+                                       [](const fed &f, int64_t s) { return f.end_sample < s; });
+            if (it == feed_.end() && !feed_.empty()) {
+                --it; // padding past the last frame: count from the end of the job's audio
+            }
+            if (it != feed_.end()) {
+                (is_final ? result_.final_latency_ms : result_.partial_latency_ms).push_back(ms_since(it->at, now));
+            }
+            if (is_final) {
+                final_text_.push_back(json_string_raw(line, "text"));
+            }
+        } else if (json_has(line, "\"event\":\"stats\"")) {
+            result_.emit_records += (size_t)json_number(line, "emit_records");
+            result_.emit_allocs_counted = result_.emit_allocs_counted || json_has(line, "\"emit_allocs\":");
+            result_.emit_allocs += json_number(line, "emit_allocs");
+            result_.emit_allocs_max = std::max(result_.emit_allocs_max, json_number(line, "emit_allocs_max"));
+        } else if (json_has(line, "\"event\":\"job_end\"")) {
+            job_ended_ = true;
+            job_end_at_ = now;
+            cv_.notify_all();
+        }
+    }
+
+    pid_t pid_ = -1;
+    FILE *in_ = nullptr;
+    int out_fd_ = -1;
+    std::thread reader_;
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool ready_ = false;
+    bool eof_ = false;
+    bool job_ended_ = false;
+    bench_clock::time_point started_at_;
+    bench_clock::time_point ready_at_;
+    bench_clock::time_point job_end_at_;
+    std::vector<fed> feed_;
+    std::vector<std::string> final_text_;
+    run_result result_;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench_params params;
+    if (!parse_args(argc, argv, params)) {
+        return 1;
+    }
+    if (params.transcriber.empty()) {
+        params.transcriber = (std::filesystem::path(argv[0]).parent_path() / "openflow_transcriber").string();
+    }
+    if (!std::filesystem::exists(params.transcriber)) {
+        fprintf(stderr, "error: transcriber not found at '%s'\n", params.transcriber.c_str());
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<fixture> fixtures;
+    if (!load_fixtures(params.fixtures_dir, fixtures)) {
+        return 1;
+    }
+
+    std::vector<run_config> matrix;
+    for (const auto &model : params.models)
+        for (int threads : params.threads)
+            for (int beam : params.beam_sizes)
+                for (int step : params.steps)
+                    for (int bias : params.bias)
+                        for (const auto &audio_ctx : params.audio_ctx) {
+                            if (!bias && beam != params.beam_sizes.front()) {
+                                continue; // beam size only applies to bias decoding
+                            }
+                            matrix.push_back({model, threads, beam, step, bias != 0, audio_ctx});
+                        }
+
+    int failures = 0;
+    std::vector<run_result> results;
+    for (size_t r = 0; r < matrix.size(); ++r) {
+        const run_config &rc = matrix[r];
+        fprintf(stderr, "[%zu/%zu] model=%s threads=%d beam=%d step=%d bias=%d audio_ctx=%s\n",
+                r + 1, matrix.size(), rc.model.c_str(), rc.threads, rc.beam_size, rc.step_ms, rc.bias ? 1 : 0,
+                rc.audio_ctx.c_str());
+
+        transcriber_session session;
+        bool ok = session.start(params, rc);
+        for (int pass = 0; ok && pass < params.repeat; ++pass) {
+            for (const auto &f : fixtures) {
+                if (!session.run_job(f, params)) {
+                    fprintf(stderr, "error: transcriber stopped during '%s'\n", f.name.c_str());
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        results.push_back(session.finish());
+        results.back().ok = ok && results.back().exit_status == 0;
+        failures += results.back().ok ? 0 : 1;
+    }
+
+    // Accuracy is scored on the first pass over the fixtures.
+    std::vector<std::string> references;
+    for (const auto &f : fixtures) {
+        if (f.has_reference) {
+            references.push_back(f.reference);
+        }
+    }
+    auto texts_of = [&](const run_result &res, bool referenced_only) {
+        std::vector<std::string> texts;
+        for (size_t i = 0; i < res.transcripts.size() && i < fixtures.size(); ++i) {
+            if (!referenced_only || fixtures[i].has_reference) {
+                texts.push_back(json_unescape(res.transcripts[i].second));
+            }
+        }
+        return texts;
+    };
+    auto wer_of = [&](const run_result &res) {
+        return corpus_wer(references, texts_of(res, true));
+    };
+
+    std::string report = "{\"pace\":\"";
+    report += params.realtime ? "realtime" : "fast";
+    report += "\",\"fixtures\":" + std::to_string(fixtures.size());
+    report += ",\"references\":" + std::to_string(references.size());
+    report += ",\"repeat\":" + std::to_string(params.repeat);
+    report += ",\"runs\":[";
+
+    for (size_t r = 0; r < matrix.size(); ++r) {
+        const run_config &rc = matrix[r];
+        const run_result &res = results[r];
+
+        char buf[1024];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"model\":\"%s\",\"threads\":%d,\"beam_size\":%d,\"step_ms\":%d,\"bias\":%s,\"audio_ctx\":\"%s\",\"ok\":%s,\"exit_status\":%d,\"startup_ms\":%.1f,\"audio_ms\":%.1f,\"busy_ms\":%.1f,\"rtf\":%.4f,\"peak_rss_bytes\":%lld,",
+                 r ? "," : "",
+                 escape_json(rc.model).c_str(),
+                 rc.threads,
+                 rc.beam_size,
+                 rc.step_ms,
+                 rc.bias ? "true" : "false",
+                 escape_json(rc.audio_ctx).c_str(),
+                 res.ok ? "true" : "false",
+                 res.exit_status,
+                 res.startup_ms,
+                 res.audio_ms,
+                 res.busy_ms,
+                 res.audio_ms > 0.0 ? res.busy_ms / res.audio_ms : 0.0,
+                 (long long)res.peak_rss_bytes);
+        report += buf;
+        report += "\"partial_latency_ms\":" + percentiles_json(summarize(res.partial_latency_ms));
+        report += ",\"final_latency_ms\":" + percentiles_json(summarize(res.final_latency_ms));
+        if (res.emit_allocs_counted) {
+            snprintf(buf, sizeof(buf), ",\"emit_allocs_per_record\":%.2f,\"emit_allocs_max\":%.0f",
+                     res.emit_records ? res.emit_allocs / (double)res.emit_records : 0.0,
+                     res.emit_allocs_max);
+            report += buf;
+        } else {
+            report += ",\"emit_allocs_per_record\":null,\"emit_allocs_max\":null";
+        }
+
+        const double wer = wer_of(res);
+        if (wer >= 0.0) {
+            snprintf(buf, sizeof(buf), ",\"wer\":%.4f", wer);
+            report += buf;
+        }
+        // Quality guard: a trimmed encoder window is held to the full window's accuracy on the same
+        // settings, scored against the references when there are any and against its text otherwise.
+        if (rc.audio_ctx != "0") {
+            for (size_t b = 0; b < matrix.size(); ++b) {
+                if (matrix[b].audio_ctx != "0" || !matrix[b].same_except_audio_ctx(rc) || !results[b].ok) {
+                    continue;
+                }
+                const double vs_full = corpus_wer(texts_of(results[b], false), texts_of(res, false));
+                const double delta = wer >= 0.0 ? wer - wer_of(results[b]) : vs_full;
+                const bool quality_ok = delta <= params.max_wer_delta;
+                snprintf(buf, sizeof(buf), ",\"wer_vs_full_ctx\":%.4f,\"quality_ok\":%s",
+                         std::max(0.0, vs_full), quality_ok ? "true" : "false");
+                report += buf;
+                if (!quality_ok) {
+                    fprintf(stderr, "warning: audio_ctx=%s loses %.1f%% WER against the full window (model=%s step=%d)\n",
+                            rc.audio_ctx.c_str(), delta * 100.0, rc.model.c_str(), rc.step_ms);
+                    ++failures;
+                }
+                break;
+            }
+        }
+        if (params.transcripts) {
+            report += ",\"transcripts\":{";
+            for (size_t i = 0; i < res.transcripts.size() && i < fixtures.size(); ++i) {
+                if (i) report += ',';
+                report += "\"" + escape_json(res.transcripts[i].first) + "\":\"" + res.transcripts[i].second + "\"";
+            }
+            report += "}";
+        }
+        report += "}";
+    }
+    report += "]}\n";
+
+    if (params.out_path.empty()) {
+        fwrite(report.data(), 1, report.size(), stdout);
+    } else {
+        FILE *out = fopen(params.out_path.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "error: cannot write '%s'\n", params.out_path.c_str());
+            return 1;
+        }
+        fwrite(report.data(), 1, report.size(), out);
+        fclose(out);
+    }
+    return failures ? 2 : 0;
+}
@@ -1,21 +1,31 @@
 #include "common-sdl.h"
+#include "log-mel.h"
+#include "openflow-core.h"
+#include "pcm-ring.h"
+#include "pcm-spill.h"
+#include "wav-source.h"
 #include "whisper.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
+#include <functional>
 #include <filesystem>
 #include <iomanip>
-#include <iterator>
 #include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <sstream>
 #include <iostream>
 #include <stdexcept>
@@ -25,22 +35,44 @@
 #include <unordered_map>
 #include <vector>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#include <sys/event.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace {
 
+enum class output_format { json, binary, binary_delta };
+
 struct vad_params {
-    int32_t n_threads = std::min(2u, std::max(1u, std::thread::hardware_concurrency()));
+    int32_t n_threads = default_decode_threads();
     int32_t capture_id = -1;
     std::string language = "en";
     std::string model = "models/ggml-base.en.bin";
+    std::string partial_model; // optional smaller model for partials; finals stay on `model`
     std::string vad_model_path;
     std::string audio_file;
     std::string dictionary_path;
     int32_t dictionary_poll_ms = 1000;
     bool send_prompt = true;
+    bool prompt_priority_head = false; // when the prompt budget is short, keep entries from the top of the file
     bool bias_decoding = false;
     float bias_first_logit = 0.35f;
     float bias_continuation_logit = 0.85f;
     int32_t beam_size = 0; // 0 = whisper default (beam search default is 5)
+    int32_t audio_ctx = 0; // encoder positions per decode; 0 = full 30 s window, -1 = sized to the audio
     int logits_top_k = 50;
     float logits_prob_threshold = 20.0f; // compute softmax denom only for logits > (max - threshold); <= 0 computes full denom
     bool logits_prefix_text = false;
@@ -50,12 +82,28 @@ struct vad_params {
     bool log = false; // emit verbose dictionary/logits packets (stdout + file)
     bool emit_vad_events = true;
     bool use_gpu_whisper = true;
+    bool coreml = false;         // expect the Core ML encoder (OPENFLOW_COREML builds)
+    bool vad_gpu = false;        // Silero on the GPU backend instead of the CPU
+    bool vad_background = false; // VAD/endpointing thread at low QoS, one CPU thread, decode workers raised
+    bool warmup = true; // dummy decode on silence before "ready"
+    bool mel_cache = true; // partials reuse log-mel frames of audio they already saw
+    bool speculative_final = false; // start the final decode once its post-padding arrived (live input)
     bool debug = false;
+    bool metrics = false; // latency/throughput fields in stats events
     bool stdin_audio = false;
     bool stdin_pcm = false;
+    std::string pcm_ring;     // shared-memory ring the 'R' doorbell frames point into
+    bool server = false;      // many --stdin-pcm style streams multiplexed over stdin
+    int32_t server_states = 2; // whisper_states shared by all --server sessions
     bool stream_final_full_pass = false;
+    int32_t memory_budget_mb = 64; // held audio per stream before closed full-pass chunks spill; 0 = no limit
+    bool incremental_partials = false;
+    int32_t partial_window_ms = 4000;
 
     int32_t step_ms = 200;
+    int32_t step_min_ms = -1; // adaptive partial cadence bounds; -1 = --step
+    int32_t step_max_ms = -1;
+    int32_t stats_ms = 1000;
     float start_threshold = 0.60f;
     float stop_threshold = 0.35f;
     int32_t min_segment_ms = 250;
@@ -64,17 +112,26 @@ struct vad_params {
     int32_t pre_padding_ms = 200;
     int32_t post_padding_ms = 350;
     int32_t ring_buffer_ms = 20000;
+    int32_t vad_batch_windows = 256;
+    int32_t offline_parallel = 1;
+    output_format stdout_format = output_format::json;
 };
 
 void print_usage(char **argv, const vad_params &p) {
     fprintf(stderr, "\nusage: %s [options]\n", argv[0]);
     fprintf(stderr, "  -h, --help                 show this help\n");
     fprintf(stderr, "  --model F                  whisper model path [%s]\n", p.model.c_str());
+    fprintf(stderr, "  --partial-model F          decode partials with this (smaller) model on its own worker [%s]\n", p.partial_model.empty() ? "off" : p.partial_model.c_str());
     fprintf(stderr, "  --lang XX                  language code [%s]\n", p.language.c_str());
     fprintf(stderr, "  --threads N                decoder threads [%d]\n", p.n_threads);
     fprintf(stderr, "  --capture-id N             SDL capture device id [%d]\n", p.capture_id);
     fprintf(stderr, "  --audio-file PATH          run offline on WAV (mono/pcm16) instead of mic capture\n");
     fprintf(stderr, "  --step N                   partial decode cadence in ms while active; -1 disables [%d]\n", p.step_ms);
+    fprintf(stderr, "  --step-min N / --step-max N  bounds for the adaptive partial cadence; equal bounds keep --step fixed [--step]\n");
+    fprintf(stderr, "  --stats-ms N               interval between stats events; 0 disables [%d]\n", p.stats_ms);
+    fprintf(stderr, "  --incremental-partials     decode partials over a trailing window, reusing committed tokens as prompt\n");
+    fprintf(stderr, "  --no-incremental-partials  re-decode the whole growing segment for every partial (default)\n");
+    fprintf(stderr, "  --partial-window-ms N      max uncommitted audio decoded per incremental partial [%d]\n", p.partial_window_ms);
     fprintf(stderr, "  --start-threshold F        VAD speech start threshold [%0.2f]\n", p.start_threshold);
     fprintf(stderr, "  --stop-threshold F         VAD speech stop threshold [%0.2f]\n", p.stop_threshold);
     fprintf(stderr, "  --min-segment-ms N         minimum segment length before emit [%d]\n", p.min_segment_ms);
@@ -82,16 +139,21 @@ void print_usage(char **argv, const vad_params &p) {
     fprintf(stderr, "  --min-silence-ms N         silence required before considering segment end [%d]\n", p.min_silence_ms);
     fprintf(stderr, "  --pre-padding-ms N         audio padding before speech start [%d]\n", p.pre_padding_ms);
     fprintf(stderr, "  --post-padding-ms N        audio padding after speech end [%d]\n", p.post_padding_ms);
+    fprintf(stderr, "  --speculative-final        live input: decode the final once its post-padding arrived, kept if the silence holds\n");
     fprintf(stderr, "  --ring-buffer-ms N         captured ring buffer size [%d]\n", p.ring_buffer_ms);
     fprintf(stderr, "  --silero-vad PATH          Silero VAD ggml model (required)\n");
+    fprintf(stderr, "  --vad-batch N              VAD windows per inference call for --audio-file/--stdin-audio; 1 disables [%d]\n", p.vad_batch_windows);
+    fprintf(stderr, "  --offline-parallel N       decode up to N segments at once for --audio-file/--stdin-audio (disables partials) [%d]\n", p.offline_parallel);
     fprintf(stderr, "  --dictionary-file PATH     dictionary file (words/phrases) used for prompt + biasing\n");
-    fprintf(stderr, "  --dictionary-poll-ms N     minimum ms between dictionary file reloads [%d]\n", p.dictionary_poll_ms);
+    fprintf(stderr, "  --dictionary-poll-ms N     dictionary mtime poll interval without file events; status line cadence [%d]\n", p.dictionary_poll_ms);
     fprintf(stderr, "  --send-prompt              pass dictionary file contents as whisper initial prompt (default)\n");
     fprintf(stderr, "  --no-send-prompt           do not pass a whisper initial prompt (dictionary still loaded)\n");
+    fprintf(stderr, "  --prompt-priority P        entries kept when the prompt exceeds n_text_ctx/2 tokens: head|tail of the file [%s]\n", p.prompt_priority_head ? "head" : "tail");
     fprintf(stderr, "  --bias-decoding            bias decoding towards dictionary tokens via logits filter callback\n");
     fprintf(stderr, "  --no-bias-decoding         disable decoding bias (default)\n");
     fprintf(stderr, "  --bias-first-logit F       add to logits for dictionary first tokens [%0.2f]\n", p.bias_first_logit);
     fprintf(stderr, "  --bias-continuation-logit F add to logits for dictionary continuation tokens [%0.2f]\n", p.bias_continuation_logit);
+    fprintf(stderr, "  --audio-ctx N|auto         encoder positions per decode (1500 = 30 s); auto sizes it to each decode's audio [0 = full]\n");
     fprintf(stderr, "  --beam-size N              beam size for beam search (>=2; capped at 8; 0 uses whisper default) [%d]\n", p.beam_size);
     fprintf(stderr, "  --logits-top-k N           number of tokens to emit per logits packet [%d]\n", p.logits_top_k);
     fprintf(stderr, "  --logits-prob-threshold F  softmax denom over logits > (max-F); <=0 for full denom [%0.1f]\n", p.logits_prob_threshold);
@@ -103,9 +165,24 @@ void print_usage(char **argv, const vad_params &p) {
     fprintf(stderr, "  --no-log                   disable verbose logging (default)\n");
     fprintf(stderr, "  --no-vad-events            do not emit per-chunk VAD probability packets\n");
     fprintf(stderr, "  --cpu-only                 disable GPU backends for whisper + VAD\n");
+    fprintf(stderr, "  --coreml                   run the encoder through Core ML (<model>-encoder.mlmodelc, ANE); decoder stays on Metal\n");
+    fprintf(stderr, "  --vad-gpu                  run Silero VAD on the GPU backend (default: CPU)\n");
+    fprintf(stderr, "  --vad-background           run VAD on one CPU thread at background QoS, below the decode workers\n");
+    fprintf(stderr, "  --no-mel-cache             let whisper recompute every partial's log-mel spectrogram from scratch\n");
+    fprintf(stderr, "  --no-warmup                skip the startup decode on silence (first decode pays kernel/buffer setup)\n");
     fprintf(stderr, "  --stdin-audio              read WAV file paths from stdin (one per line) and keep model warm\n");
     fprintf(stderr, "  --stdin-pcm                read float32 PCM from stdin (framed) and keep model warm\n");
-    fprintf(stderr, "  --stream-final-full-pass   keep full stdin-pcm job audio in RAM and emit one final full-pass segment on E\n");
+    fprintf(stderr, "                             both load another model in the background on 'M u32 len | path' (--stdin-pcm) or a\n");
+    fprintf(stderr, "                             '__model__ PATH' line (--stdin-audio) and switch to it between jobs\n");
+    fprintf(stderr, "  --pcm-ring F               with --stdin-pcm, also accept audio through the shared-memory ring in file F\n");
+    fprintf(stderr, "  --server                   like --stdin-pcm, but every frame starts with a u32 session id; sessions share the model\n");
+    fprintf(stderr, "  --server-states N          decoder states shared by all --server sessions [%d]\n", p.server_states);
+    fprintf(stderr, "  --stream-final-full-pass   keep full stdin-pcm job audio in RAM and emit full-pass finals on E, one per <=30 s chunk\n");
+    fprintf(stderr, "  --memory-budget-mb N       held audio per stream; past it, closed full-pass chunks move to a temp\n");
+    fprintf(stderr, "                             file as int16 and larger PCM frames are rejected; 0 = no limit [%d]\n", p.memory_budget_mb);
+    fprintf(stderr, "  --output-format F          stdout records: json (NDJSON), binary (length-prefixed frames),\n");
+    fprintf(stderr, "                             binary-delta (binary, segments sent as changes since the last record) [json]\n");
+    fprintf(stderr, "  --metrics                  add decode timings, RTF, latencies, buffer fill and peak RSS to stats events\n");
     fprintf(stderr, "  -d, --debug                enable debug logging\n");
 }
 
@@ -125,6 +202,8 @@ bool parse_args(int argc, char **argv, vad_params &p) {
             exit(0);
         } else if (a == "--model") {
             p.model = need(a.c_str(), i);
+        } else if (a == "--partial-model") {
+            p.partial_model = need(a.c_str(), i);
         } else if (a == "--lang") {
             p.language = need(a.c_str(), i);
         } else if (a == "--threads") {
@@ -136,8 +215,24 @@ bool parse_args(int argc, char **argv, vad_params &p) {
         } else if (a == "--step") {
             const int v = atoi(need(a.c_str(), i));
             p.step_ms = (v < 0) ? -1 : std::max(10, v);
+        } else if (a == "--step-min") {
+            p.step_min_ms = std::max(10, atoi(need(a.c_str(), i)));
+        } else if (a == "--step-max") {
+            p.step_max_ms = std::max(10, atoi(need(a.c_str(), i)));
+        } else if (a == "--stats-ms") {
+            p.stats_ms = std::max(0, atoi(need(a.c_str(), i)));
+        } else if (a == "--incremental-partials") {
+            p.incremental_partials = true;
+        } else if (a == "--no-incremental-partials") {
+            p.incremental_partials = false;
+        } else if (a == "--partial-window-ms") {
+            p.partial_window_ms = std::max(1000, atoi(need(a.c_str(), i)));
         } else if (a == "--silero-vad") {
             p.vad_model_path = need(a.c_str(), i);
+        } else if (a == "--vad-batch") {
+            p.vad_batch_windows = std::max(1, atoi(need(a.c_str(), i)));
+        } else if (a == "--offline-parallel") {
+            p.offline_parallel = std::clamp(atoi(need(a.c_str(), i)), 1, 16);
         } else if (a == "--dictionary-file" || a == "--dictionary_file" || a == "--prompt-file") {
             if (a == "--prompt-file") {
                 fprintf(stderr, "warning: --prompt-file is deprecated; use --dictionary-file\n");
@@ -152,6 +247,13 @@ bool parse_args(int argc, char **argv, vad_params &p) {
             p.send_prompt = true;
         } else if (a == "--no-send-prompt" || a == "--no_send_prompt") {
             p.send_prompt = false;
+        } else if (a == "--prompt-priority") {
+            const std::string v = need(a.c_str(), i);
+            if (v != "head" && v != "tail") {
+                fprintf(stderr, "unknown --prompt-priority '%s' (head|tail)\n", v.c_str());
+                return false;
+            }
+            p.prompt_priority_head = v == "head";
         } else if (a == "--bias-decoding" || a == "--bias_decoding") {
             p.bias_decoding = true;
         } else if (a == "--no-bias-decoding" || a == "--no_bias_decoding") {
@@ -160,6 +262,9 @@ bool parse_args(int argc, char **argv, vad_params &p) {
             p.bias_first_logit = static_cast<float>(atof(need(a.c_str(), i)));
         } else if (a == "--bias-continuation-logit" || a == "--bias_continuation_logit") {
             p.bias_continuation_logit = static_cast<float>(atof(need(a.c_str(), i)));
+        } else if (a == "--audio-ctx" || a == "--audio_ctx") {
+            const std::string v = need(a.c_str(), i);
+            p.audio_ctx = v == "auto" ? -1 : std::max<int32_t>(0, atoi(v.c_str()));
         } else if (a == "--beam-size" || a == "--beam_size") {
             p.beam_size = std::max<int32_t>(0, atoi(need(a.c_str(), i)));
         } else if (a == "--logits-top-k" || a == "--logits_top_k") {
@@ -184,8 +289,28 @@ bool parse_args(int argc, char **argv, vad_params &p) {
             p.stdin_audio = true;
         } else if (a == "--stdin-pcm") {
             p.stdin_pcm = true;
+        } else if (a == "--pcm-ring") {
+            p.pcm_ring = need(a.c_str(), i);
+        } else if (a == "--memory-budget-mb") {
+            p.memory_budget_mb = std::max(0, atoi(need(a.c_str(), i)));
+        } else if (a == "--server") {
+            p.server = true;
+        } else if (a == "--server-states") {
+            p.server_states = std::clamp(atoi(need(a.c_str(), i)), 1, 16);
         } else if (a == "--stream-final-full-pass") {
             p.stream_final_full_pass = true;
+        } else if (a == "--output-format") {
+            const std::string v = need(a.c_str(), i);
+            if (v == "json") {
+                p.stdout_format = output_format::json;
+            } else if (v == "binary") {
+                p.stdout_format = output_format::binary;
+            } else if (v == "binary-delta") {
+                p.stdout_format = output_format::binary_delta;
+            } else {
+                fprintf(stderr, "unknown --output-format '%s' (json|binary|binary-delta)\n", v.c_str());
+                return false;
+            }
         } else if (a == "--start-threshold") {
             p.start_threshold = std::clamp(static_cast<float>(atof(need(a.c_str(), i))), 0.0f, 1.0f);
         } else if (a == "--stop-threshold") {
@@ -202,8 +327,22 @@ bool parse_args(int argc, char **argv, vad_params &p) {
             p.post_padding_ms = std::max(0, atoi(need(a.c_str(), i)));
         } else if (a == "--ring-buffer-ms") {
             p.ring_buffer_ms = std::max(2000, atoi(need(a.c_str(), i)));
+        } else if (a == "--speculative-final") {
+            p.speculative_final = true;
+        } else if (a == "--no-mel-cache") {
+            p.mel_cache = false;
+        } else if (a == "--no-warmup") {
+            p.warmup = false;
         } else if (a == "--cpu-only") {
             p.use_gpu_whisper = false;
+        } else if (a == "--coreml") {
+            p.coreml = true;
+        } else if (a == "--vad-gpu") {
+            p.vad_gpu = true;
+        } else if (a == "--vad-background") {
+            p.vad_background = true;
+        } else if (a == "--metrics") {
+            p.metrics = true;
         } else if (a == "-d" || a == "--debug") {
             p.debug = true;
         } else {
@@ -214,14 +353,6 @@ bool parse_args(int argc, char **argv, vad_params &p) {
     return true;
 }
 
-inline bool is_control_piece(const std::string &s) {
-    size_t i = 0;
-    while (i < s.size() && std::isspace(static_cast<unsigned char>(s[i]))) ++i;
-    if (i + 1 < s.size() && s[i] == '<' && s[i + 1] == '|') return true;
-    if (i + 1 < s.size() && s[i] == '[' && s[i + 1] == '_') return true;
-    return false;
-}
-
 std::vector<std::string> split_dictionary_entries(const std::string &raw) {
     std::vector<std::string> out;
     out.reserve(256);
@@ -262,411 +393,1246 @@ std::vector<std::string> split_dictionary_entries(const std::string &raw) {
     return uniq;
 }
 
-static uint16_t read_u16_le(const uint8_t *p) {
-    return (uint16_t) p[0] | ((uint16_t) p[1] << 8);
+// Binary stdout framing (--output-format binary / binary-delta): every record is
+// u32 length | u8 type | payload, where length counts the type byte and payload. 'J' carries one
+// JSON event without its newline; 'S' and 'D' carry segments (see format_segment in main).
+// Integers are written in host order, which is little-endian on every target we build for.
+template <typename T>
+void append_le(std::string &out, T v) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &v, sizeof(T));
+    out.append(bytes, sizeof(T));
 }
 
-static uint32_t read_u32_le(const uint8_t *p) {
-    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+// Starts a frame of `type` in `out`; returns the offset end_frame() needs.
+size_t begin_frame(std::string &out, char type) {
+    const size_t at = out.size();
+    append_le<uint32_t>(out, 0);
+    out.push_back(type);
+    return at;
 }
 
-static bool read_wav_mono_f32(const std::string &path, std::vector<float> &out, int &sample_rate_out) {
-    std::ifstream f(path, std::ios::binary);
-    if (!f.good()) {
-        fprintf(stderr, "error: failed to open audio file '%s'\n", path.c_str());
-        return false;
+void end_frame(std::string &out, size_t at) {
+    const uint32_t len = (uint32_t) (out.size() - at - sizeof(uint32_t));
+    std::memcpy(&out[at], &len, sizeof(len));
+}
+
+// Appends the stdout record for one newline-terminated JSON event line.
+void append_event_record(std::string &out, output_format fmt, const std::string &json_line) {
+    if (fmt == output_format::json) {
+        out += json_line;
+        return;
     }
+    size_t n = json_line.size();
+    if (n > 0 && json_line[n - 1] == '\n') --n;
+    const size_t at = begin_frame(out, 'J');
+    out.append(json_line, 0, n);
+    end_frame(out, at);
+}
 
-    f.seekg(0, std::ios::end);
-    const std::streamoff size = f.tellg();
-    if (size <= 0) {
-        fprintf(stderr, "error: audio file '%s' is empty\n", path.c_str());
-        return false;
+// Committed-prefix bookkeeping for --incremental-partials. Tokens that two consecutive partials
+// agree on are committed; later partials only decode audio after the committed prefix and get the
+// committed tokens back as prompt, so each partial costs at most ~--partial-window-ms of audio.
+struct incremental_partial_state {
+    int segment_index = -1;
+    int64_t segment_start_sample = 0;
+    int64_t committed_end_sample = 0;
+    std::vector<Piece> committed;
+    std::vector<Piece> tail; // uncommitted hypothesis from the previous partial
+
+    void reset(int idx, int64_t start_sample) {
+        segment_index = idx;
+        segment_start_sample = start_sample;
+        committed_end_sample = start_sample;
+        committed.clear();
+        tail.clear();
     }
-    f.seekg(0, std::ios::beg);
+};
 
-    std::vector<uint8_t> buf((size_t) size);
-    f.read(reinterpret_cast<char *>(buf.data()), size);
-    if (!f.good()) {
-        fprintf(stderr, "error: failed to read audio file '%s'\n", path.c_str());
-        return false;
+// --speculative-final: a segment's final decoded once its post-padding has arrived, before
+// endpointing confirms the silence (--min-silence-ms). Speculations are numbered per stream (0 = none). The capture thread cancels one when
+// speech resumes; otherwise the final job for the segment names it and takes its pieces instead of
+// decoding again. A final that finds its speculation neither running nor done claims the number,
+// so a worker that pops the speculation later skips it.
+struct speculative_final {
+    std::mutex mu;
+    std::condition_variable cv;
+    uint64_t running = 0; // being decoded
+    uint64_t done = 0;    // pieces holds its result
+    uint64_t claimed = 0; // highest number a final stopped waiting for
+    std::vector<Piece> pieces;
+    std::atomic<uint64_t> cancelled{0}; // highest number speech has invalidated; aborts its decode
+
+    bool stale(uint64_t id) const {
+        return id <= claimed || id <= cancelled.load(std::memory_order_relaxed);
     }
+};
 
-    if (buf.size() < 44 || std::memcmp(buf.data(), "RIFF", 4) != 0 || std::memcmp(buf.data() + 8, "WAVE", 4) != 0) {
-        fprintf(stderr, "error: '%s' is not a RIFF/WAVE file\n", path.c_str());
-        return false;
+// whisper abort_callback for a speculative decode.
+struct speculation_ticket {
+    const speculative_final *slot;
+    uint64_t id;
+};
+
+bool speculation_cancelled(void *user_data) {
+    const auto *t = static_cast<const speculation_ticket *>(user_data);
+    return t->slot->cancelled.load(std::memory_order_relaxed) >= t->id;
+}
+
+// A model hot-swap ('M' on --stdin-pcm, "__model__ PATH" on --stdin-audio). The loader thread
+// builds the new context, its extra decode states and its warm-up while the old model keeps
+// decoding; the capture thread installs the result between jobs, when no decode is in flight.
+struct model_swap {
+    std::mutex mu;
+    std::thread loader;
+    bool loading = false;
+    std::string path;
+    whisper_context *ctx = nullptr;      // loaded and waiting to be installed
+    std::vector<whisper_state *> states; // one per decode worker after the first
+};
+
+struct dictionary_snapshot;
+
+// A --stream-final-full-pass chunk as last decoded, with the dictionary and the previous chunk's
+// context tokens that decode used.
+struct full_pass_result {
+    int64_t start_sample = -1;
+    int64_t end_sample = -1;
+    std::shared_ptr<const dictionary_snapshot> dict;
+    uint64_t context_hash = 0;
+    std::vector<Piece> pieces;
+};
+
+// FNV-1a over token ids.
+uint64_t hash_tokens(const std::vector<whisper_token> &tokens) {
+    uint64_t h = 1469598103934665603ull;
+    for (whisper_token t : tokens) {
+        h = (h ^ (uint32_t)t) * 1099511628211ull;
     }
+    return h;
+}
 
-    uint16_t audio_format = 0;
-    uint16_t num_channels = 0;
-    uint32_t sample_rate = 0;
-    uint16_t bits_per_sample = 0;
-    size_t data_off = 0;
-    size_t data_size = 0;
+struct decode_job;
 
-    size_t off = 12;
-    while (off + 8 <= buf.size()) {
-        const char *tag = reinterpret_cast<const char *>(buf.data() + off);
-        const uint32_t chunk_sz = read_u32_le(buf.data() + off + 4);
-        const size_t chunk_data_off = off + 8;
-        if (chunk_data_off + chunk_sz > buf.size()) break;
+// --metrics: one session's decode and latency figures accumulated between two of its stats events.
+// Latencies run from the capture thread's decision (partial enqueued, last voiced VAD chunk for a
+// final) to the record reaching stdout.
+class DecodeMetrics {
+public:
+    struct latency {
+        size_t n = 0;
+        double sum_ms = 0.0;
+        double max_ms = 0.0;
+
+        void add(double ms) {
+            ++n;
+            sum_ms += ms;
+            max_ms = std::max(max_ms, ms);
+        }
 
-        if (std::memcmp(tag, "fmt ", 4) == 0 && chunk_sz >= 16) {
-            audio_format = read_u16_le(buf.data() + chunk_data_off + 0);
-            num_channels = read_u16_le(buf.data() + chunk_data_off + 2);
-            sample_rate = read_u32_le(buf.data() + chunk_data_off + 4);
-            bits_per_sample = read_u16_le(buf.data() + chunk_data_off + 14);
-        } else if (std::memcmp(tag, "data", 4) == 0) {
-            data_off = chunk_data_off;
-            data_size = chunk_sz;
+        double avg_ms() const {
+            return n ? sum_ms / (double)n : 0.0;
         }
+    };
+
+    struct window {
+        size_t n_decodes = 0;
+        size_t n_timed = 0;     // decodes with an encode/decode split
+        double encode_ms = 0.0; // over n_timed
+        double decode_ms = 0.0; // over n_timed: the rest of whisper_full (decoder, sampling, prompt)
+        double wall_ms = 0.0;
+        double audio_ms = 0.0;
+        latency partial;
+        latency final_from_enqueue;
+        latency final_from_speech_end;
+        size_t emit_records = 0;
+        uint64_t emit_allocs = 0; // from the end of a record's decode to its hand-off
+        uint64_t emit_allocs_max = 0;
+        size_t speculations = 0; // --speculative-final, counted since the session opened
+        size_t speculative_hits = 0;
+    };
 
-        off = chunk_data_off + chunk_sz;
-        if (off & 1) off++; // align to word boundary
+    // encode_ms < 0 when the decode ran on a whisper_state whisper_get_timings can't see.
+    void add_decode(double wall_ms, double audio_ms, double encode_ms) {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++w_.n_decodes;
+        w_.wall_ms += wall_ms;
+        w_.audio_ms += audio_ms;
+        if (encode_ms >= 0.0) {
+            ++w_.n_timed;
+            w_.encode_ms += encode_ms;
+            w_.decode_ms += std::max(0.0, wall_ms - encode_ms);
+        }
     }
 
-    if (!data_off || !data_size) {
-        fprintf(stderr, "error: '%s' has no data chunk\n", path.c_str());
-        return false;
+    void add_emitted(const decode_job &job, std::chrono::steady_clock::time_point now, uint64_t emit_allocs);
+
+    void count_speculation() {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++speculations_;
     }
-    if (!sample_rate || !num_channels) {
-        fprintf(stderr, "error: '%s' missing fmt chunk\n", path.c_str());
-        return false;
+
+    void count_speculative_hit() {
+        std::lock_guard<std::mutex> lock(mu_);
+        ++speculative_hits_;
     }
-    if (audio_format != 1 && audio_format != 3) {
-        fprintf(stderr, "error: '%s' unsupported WAV format %u (only PCM=1 or float=3)\n", path.c_str(), (unsigned) audio_format);
-        return false;
+
+    window take() {
+        std::lock_guard<std::mutex> lock(mu_);
+        window out = w_;
+        out.speculations = speculations_;
+        out.speculative_hits = speculative_hits_;
+        w_ = window{};
+        return out;
     }
 
-    const size_t frame_bytes = (size_t) num_channels * (size_t) (bits_per_sample / 8);
-    if (frame_bytes == 0) {
-        fprintf(stderr, "error: '%s' invalid bits_per_sample=%u\n", path.c_str(), (unsigned) bits_per_sample);
-        return false;
+private:
+    std::mutex mu_;
+    window w_;
+    size_t speculations_ = 0;
+    size_t speculative_hits_ = 0;
+};
+
+// One audio stream's endpointing and decode bookkeeping. The capture side (VAD, timeline, segment
+// counters) belongs to the thread feeding the stream; incremental_state and the delta base belong to
+// the decode side, which only touches them from one job of the stream at a time. Jobs hold a
+// reference, so --server can replace or close a session while its last decodes are still running.
+//
+// processed_samples_total is the VAD cursor: samples in [processed_samples_total, timeline.end())
+// are still pending. The current segment is [segment_start_sample, processed_samples_total) and
+// pre-roll is whatever precedes the cursor back to pre_roll_floor (end of the last kept segment).
+struct stream_session : std::enable_shared_from_this<stream_session> {
+    int id = 0;
+    std::unique_ptr<SileroVadRunner> vad;
+    std::vector<float> vad_probs;
+
+    SampleTimeline timeline;
+    int64_t pre_roll_floor = 0;
+    double segment_prob_sum = 0.0;
+    int segment_prob_count = 0;
+    bool in_segment = false;
+    int64_t segment_start_sample = 0;
+    int64_t last_voice_sample = 0;
+    std::chrono::steady_clock::time_point last_voice_wall{}; // when last_voice_sample was seen
+    int64_t processed_samples_total = 0;
+    int segment_index = 0;
+    int active_segment_index = -1;
+    int partial_sequence = 0;
+    int64_t last_partial_emit_sample = 0;
+
+    incremental_partial_state incremental_state;
+    // Log-mel frames of the segment whose partials are being decoded (see mel_cache_for in main).
+    LogMelCache mel;
+    int mel_segment = -1;
+    // --speculative-final: the open segment's speculation (capture side) and its result slot.
+    uint64_t speculation_id = 0;
+    uint64_t speculation_seq = 0;
+    int64_t speculation_end_sample = 0; // end of the audio the open speculation decodes
+    speculative_final speculation;
+    // --stream-final-full-pass (see enqueue_full_pass_chunk in main). Capture side: the closed
+    // chunks of the held job, where the open one starts and where its last kept segment ends. Decode
+    // side: each chunk's last decode.
+    std::vector<std::pair<int64_t, int64_t>> full_pass_chunks;
+    int64_t full_pass_chunk_start = 0;
+    int64_t full_pass_speech_end = 0;
+    std::vector<full_pass_result> full_pass_results;
+    // --memory-budget-mb: closed chunks moved out of the timeline, and the timeline's high-water mark
+    // since the last stats event.
+    std::shared_ptr<PcmSpill> spill;
+    size_t held_audio_peak_bytes = 0;
+    // --output-format binary-delta: last tokens sent per open segment (see format_segment).
+    std::mutex delta_mu;
+    std::unordered_map<int, std::vector<Piece>> delta_base;
+    // --stats-ms / --metrics: this stream's figures and when it last reported them. --server carries
+    // both over to the next job of the same client, like the VAD.
+    std::shared_ptr<DecodeMetrics> metrics = std::make_shared<DecodeMetrics>();
+    std::chrono::steady_clock::time_point last_stats = std::chrono::steady_clock::now();
+};
+
+// Work item for the decode thread. Normally the job owns a copy of its audio so the capture/VAD
+// thread can keep ingesting while whisper runs. A job may instead borrow `borrowed` when the
+// caller keeps that memory alive and unchanged until DecodeQueue::wait_idle() returns.
+struct decode_job {
+    std::shared_ptr<stream_session> session;
+    int segment_index = 0;
+    int64_t start_sample = 0;
+    bool is_final = false;
+    bool incremental = false;
+    double avg_prob = 0.0;
+    int partial_seq = 0;
+    int64_t output_ticket = -1; // OrderedOutput slot; -1 writes the result as soon as it's decoded
+    std::chrono::steady_clock::time_point queued_at{};
+    std::chrono::steady_clock::time_point speech_end_at{}; // finals: when VAD last saw voice
+    std::vector<float> audio;
+    const float *borrowed = nullptr;
+    size_t n_borrowed = 0;
+    std::string marker; // when set, written in the stream's order instead of decoding anything
+    // A speculative job (is_final, so the queue never drops it) decodes into the session's
+    // speculative_final slot and writes nothing; a final naming a speculation reuses its result.
+    bool speculative = false;
+    uint64_t speculation_id = 0;
+    int full_pass_chunk = -1; // --stream-final-full-pass chunk; only finals write it
+    // A spilled chunk's audio stays in the spill store and is read back only if it's decoded again.
+    std::shared_ptr<const PcmSpill> spill;
+    size_t n_spilled = 0;
+
+    int session_id() const {
+        return session ? session->id : 0;
     }
-    const size_t n_frames = data_size / frame_bytes;
-    out.clear();
-    out.reserve(n_frames);
-
-    const uint8_t *data = buf.data() + data_off;
-    for (size_t i = 0; i < n_frames; ++i) {
-        double sum = 0.0;
-        const uint8_t *frame = data + i * frame_bytes;
-        for (uint16_t ch = 0; ch < num_channels; ++ch) {
-            const uint8_t *p = frame + ch * (bits_per_sample / 8);
-            if (audio_format == 1 && bits_per_sample == 16) {
-                int16_t s;
-                std::memcpy(&s, p, sizeof(s));
-                sum += (double) s / 32768.0;
-            } else if (audio_format == 1 && bits_per_sample == 32) {
-                int32_t s;
-                std::memcpy(&s, p, sizeof(s));
-                sum += (double) s / 2147483648.0;
-            } else if (audio_format == 3 && bits_per_sample == 32) {
-                float s;
-                std::memcpy(&s, p, sizeof(s));
-                sum += (double) s;
-            } else {
-                fprintf(stderr,
-                        "error: '%s' unsupported WAV encoding format=%u bits=%u\n",
-                        path.c_str(),
-                        (unsigned) audio_format,
-                        (unsigned) bits_per_sample);
-                return false;
+
+    const float *samples() const {
+        return borrowed ? borrowed : audio.data();
+    }
+
+    size_t n_samples() const {
+        return spill ? n_spilled : borrowed ? n_borrowed : audio.size();
+    }
+};
+
+void DecodeMetrics::add_emitted(const decode_job &job, std::chrono::steady_clock::time_point now, uint64_t emit_allocs) {
+    using ms = std::chrono::duration<double, std::milli>;
+    std::lock_guard<std::mutex> lock(mu_);
+    ++w_.emit_records;
+    w_.emit_allocs += emit_allocs;
+    w_.emit_allocs_max = std::max(w_.emit_allocs_max, emit_allocs);
+    if (!job.is_final) {
+        w_.partial.add(ms(now - job.queued_at).count());
+        return;
+    }
+    w_.final_from_enqueue.add(ms(now - job.queued_at).count());
+    if (job.speech_end_at != std::chrono::steady_clock::time_point{}) {
+        w_.final_from_speech_end.add(ms(now - job.speech_end_at).count());
+    }
+}
+
+// Bounded FIFO between the capture/VAD thread and the decode workers. Partials are disposable: a
+// queued partial is replaced by a newer one for the same segment, dropped when that segment's final
+// arrives, and evicted first when the queue is full. A --stream-final-full-pass chunk's early decode
+// is keyed by its chunk as well, so it is only replaced by that chunk's final, and it is evicted only
+// when no plain partial is left to evict. Finals are never dropped; push() blocks instead.
+// With session_affinity, pop() skips jobs of a session that already has one in flight, so each
+// stream is decoded in order while different streams share the workers.
+class DecodeQueue {
+public:
+    explicit DecodeQueue(size_t capacity, bool session_affinity = false)
+        : capacity_(std::max<size_t>(1, capacity)), session_affinity_(session_affinity) {}
+
+    void push(decode_job job) {
+        std::unique_lock<std::mutex> lock(mu_);
+        const int session = job.session_id();
+        auto same_segment = [&](const decode_job &queued) {
+            return queued.session_id() == session && queued.segment_index == job.segment_index &&
+                   queued.full_pass_chunk == job.full_pass_chunk;
+        };
+        if (!job.is_final) {
+            for (auto &queued : jobs_) {
+                if (!queued.is_final && same_segment(queued)) {
+                    queued = std::move(job);
+                    ++superseded_partials_;
+                    return;
+                }
+            }
+        } else {
+            const auto n_before = jobs_.size();
+            jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), [&](const decode_job &queued) {
+                            return !queued.is_final && same_segment(queued);
+                        }),
+                        jobs_.end());
+            superseded_partials_ += n_before - jobs_.size();
+        }
+
+        while (jobs_.size() >= capacity_) {
+            auto it = std::find_if(jobs_.begin(), jobs_.end(), [](const decode_job &queued) {
+                return !queued.is_final && queued.full_pass_chunk < 0;
+            });
+            if (it == jobs_.end()) {
+                it = std::find_if(jobs_.begin(), jobs_.end(), [](const decode_job &queued) { return !queued.is_final; });
+            }
+            if (it != jobs_.end()) {
+                jobs_.erase(it);
+                ++superseded_partials_;
+                continue;
+            }
+            if (!job.is_final) {
+                ++superseded_partials_;
+                return;
             }
+            space_cv_.wait(lock);
         }
-        out.push_back((float) (sum / std::max<int>(1, (int) num_channels)));
+        jobs_.push_back(std::move(job));
+        work_cv_.notify_one();
     }
 
-    sample_rate_out = (int) sample_rate;
-    return true;
+    // Blocks until a job is available. Returns false once the queue is closed and drained.
+    bool pop(decode_job &job) {
+        std::unique_lock<std::mutex> lock(mu_);
+        auto next = jobs_.end();
+        work_cv_.wait(lock, [&] {
+            next = next_runnable();
+            return next != jobs_.end() || (closed_ && jobs_.empty());
+        });
+        if (next == jobs_.end()) {
+            return false;
+        }
+        job = std::move(*next);
+        jobs_.erase(next);
+        in_flight_.push_back({job.session_id(), job.segment_index});
+        space_cv_.notify_all();
+        return true;
+    }
+
+    // Called by a decode worker once the job returned by pop() has been emitted.
+    void done(const decode_job &job) {
+        std::lock_guard<std::mutex> lock(mu_);
+        in_flight_.erase(std::find(in_flight_.begin(), in_flight_.end(), std::make_pair(job.session_id(), job.segment_index)));
+        idle_cv_.notify_all();
+        if (session_affinity_) {
+            work_cv_.notify_all();
+        }
+    }
+
+    // For a partials-only queue whose segment was finalized elsewhere: drops its queued partials and
+    // blocks until none of them is still being decoded, so nothing for it can be written afterwards.
+    void retire_segment(int session, int segment_index) {
+        std::unique_lock<std::mutex> lock(mu_);
+        const auto key = std::make_pair(session, segment_index);
+        const auto n_before = jobs_.size();
+        jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), [&](const decode_job &queued) {
+                        return !queued.is_final && std::make_pair(queued.session_id(), queued.segment_index) == key;
+                    }),
+                    jobs_.end());
+        superseded_partials_ += n_before - jobs_.size();
+        space_cv_.notify_all();
+        idle_cv_.wait(lock, [&] {
+            return std::find(in_flight_.begin(), in_flight_.end(), key) == in_flight_.end();
+        });
+    }
+
+    // Blocks until every queued job has been decoded and emitted.
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mu_);
+        idle_cv_.wait(lock, [&] { return jobs_.empty() && in_flight_.empty(); });
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mu_);
+        closed_ = true;
+        work_cv_.notify_all();
+    }
+
+    size_t superseded_partials() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return superseded_partials_;
+    }
+
+    // Jobs queued or being decoded.
+    size_t backlog() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return jobs_.size() + in_flight_.size();
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<decode_job> jobs_;
+    size_t capacity_;
+    size_t superseded_partials_ = 0;
+    std::vector<std::pair<int, int>> in_flight_; // (session, segment_index) of each popped job not yet done()
+    bool session_affinity_ = false;
+    bool closed_ = false;
+
+    std::deque<decode_job>::iterator next_runnable() {
+        if (!session_affinity_) {
+            return jobs_.begin();
+        }
+        return std::find_if(jobs_.begin(), jobs_.end(), [&](const decode_job &queued) {
+            const int session = queued.session_id();
+            return std::none_of(in_flight_.begin(), in_flight_.end(),
+                                [&](const std::pair<int, int> &busy) { return busy.first == session; });
+        });
+    }
+};
+
+// ru_maxrss is in bytes on macOS and kilobytes elsewhere.
+static int64_t peak_rss_bytes() {
+    struct rusage ru {};
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+#if defined(__APPLE__)
+    return (int64_t)ru.ru_maxrss;
+#else
+    return (int64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+// --vad-background: scheduling for the calling thread. On macOS the QoS class sets both priority and
+// whether the thread may run on efficiency cores; elsewhere only the thread's nice value changes.
+enum class thread_role { decode, vad };
+
+static void set_thread_role(thread_role role) {
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(role == thread_role::vad ? QOS_CLASS_UTILITY : QOS_CLASS_USER_INITIATED, 0);
+#elif defined(__linux__)
+    if (role == thread_role::vad) {
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+    }
+#else
+    (void)role;
+#endif
 }
 
-static std::vector<float> resample_linear(const std::vector<float> &in, int sr_in, int sr_out) {
-    if (sr_in <= 0 || sr_out <= 0 || in.empty() || sr_in == sr_out) return in;
-    const double ratio = (double) sr_out / (double) sr_in;
-    const size_t n_out = (size_t) std::max<int64_t>(1, (int64_t) std::llround((double) in.size() * ratio));
-    std::vector<float> out;
-    out.resize(n_out);
-    for (size_t i = 0; i < n_out; ++i) {
-        const double pos = (double) i / ratio;
-        const size_t i0 = (size_t) std::floor(pos);
-        const size_t i1 = std::min(i0 + 1, in.size() - 1);
-        const double t = pos - (double) i0;
-        out[i] = (float) ((1.0 - t) * (double) in[i0] + t * (double) in[i1]);
-    }
-    return out;
+// Where whisper.cpp looks for the Core ML encoder of a ggml model: the path without its extension
+// and a "-qX_Y" quantization suffix, plus "-encoder.mlmodelc" (whisper_get_coreml_path_encoder).
+static std::string coreml_encoder_path(std::string model) {
+    const size_t dot = model.rfind('.');
+    if (dot != std::string::npos) {
+        model.resize(dot);
+    }
+    const size_t dash = model.rfind('-');
+    if (dash != std::string::npos && model.size() - dash == 5 && model[dash + 1] == 'q' && model[dash + 3] == '_') {
+        model.resize(dash);
+    }
+    return model + "-encoder.mlmodelc";
 }
 
-struct VadContextDeleter {
-    void operator()(whisper_vad_context *ctx) const {
-        if (ctx) {
-            whisper_vad_free(ctx);
+// Writes decoded records to stdout in ticket order when several decode workers finish out of order.
+// Every ticket taken must be completed exactly once; an empty line just releases the slot.
+class OrderedOutput {
+public:
+    int64_t take_ticket() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return issued_++;
+    }
+
+    void complete(int64_t ticket, std::string line) {
+        std::lock_guard<std::mutex> lock(mu_);
+        pending_.emplace(ticket, std::move(line));
+        while (!pending_.empty() && pending_.begin()->first == next_) {
+            const std::string &ready = pending_.begin()->second;
+            write_stdout(ready);
+            pending_.erase(pending_.begin());
+            ++next_;
         }
     }
+
+private:
+    std::mutex mu_;
+    std::map<int64_t, std::string> pending_;
+    int64_t issued_ = 0;
+    int64_t next_ = 0;
 };
 
-class SileroVadRunner {
+// Background sink for logits/dictionary log records. Producers hand over preformatted lines through
+// a bounded lock-free MPSC ring (one sequence number per cell, after Vyukov) and never block or touch
+// the disk; a writer thread drains the ring in batches, writes the log file and stdout copies, and
+// flushes the file at most every flush_ms. Records that don't fit are dropped and counted.
+class logits_log_writer {
 public:
-    SileroVadRunner(const std::string &model_path,
-                    int sample_rate,
-                    bool use_gpu,
-                    int n_threads)
-        : sample_rate_(sample_rate),
-          context_(nullptr, VadContextDeleter{}) {
-        if (sample_rate_ != WHISPER_SAMPLE_RATE) {
-            throw std::runtime_error("Silero VAD expects 16 kHz audio");
+    explicit logits_log_writer(size_t capacity = 4096) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        cells_ = std::make_unique<cell[]>(n);
+        mask_ = n - 1;
+        for (size_t i = 0; i < n; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
         }
+    }
 
-        whisper_vad_context_params ctx_params = whisper_vad_default_context_params();
-        ctx_params.n_threads = std::max(1, n_threads);
-        ctx_params.use_gpu = use_gpu;
+    ~logits_log_writer() {
+        stop();
+    }
 
-        context_.reset(whisper_vad_init_from_file_with_params(model_path.c_str(), ctx_params));
-        if (!context_) {
-            throw std::runtime_error("Failed to initialize Silero VAD context");
-        }
+    // Opens the log file for append. Must be called before start().
+    bool open(const std::string &path) {
+        file_.open(path, std::ios::out | std::ios::app);
+        enabled_ = file_.good();
+        return enabled_;
+    }
 
-        chunk_size_ = expected_chunk_size();
-        std::vector<float> probe(chunk_size_, 0.0f);
-        if (!whisper_vad_detect_speech(context_.get(), probe.data(), static_cast<int>(probe.size()))) {
-            throw std::runtime_error("Failed to probe Silero VAD");
-        }
+    // Whether the log file is open.
+    bool enabled() const {
+        return enabled_;
     }
 
-    size_t chunk_size() const {
-        return chunk_size_;
+    void start(int flush_ms, output_format stdout_format) {
+        if (thread_.joinable()) return;
+        flush_ms_ = flush_ms;
+        stdout_format_ = stdout_format;
+        thread_ = std::thread([this]() { run(); });
     }
 
-    float infer(const float *samples, size_t n_samples) {
-        if (!samples || n_samples == 0) {
-            throw std::runtime_error("Silero VAD received invalid audio chunk");
-        }
-        if (!whisper_vad_detect_speech(context_.get(), samples, static_cast<int>(n_samples))) {
-            throw std::runtime_error("Silero VAD failed to process audio chunk");
+    // Queues one complete line. Safe from any thread; drops the record if the ring is full.
+    void push(std::string line, bool to_file, bool to_stdout) {
+        to_file = to_file && enabled_;
+        if ((!to_file && !to_stdout) || !thread_.joinable()) return;
+
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        cell *c = nullptr;
+        while (true) {
+            c = &cells_[pos & mask_];
+            const size_t seq = c->seq.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
         }
+        c->rec.line = std::move(line);
+        c->rec.to_file = to_file;
+        c->rec.to_stdout = to_stdout;
+        c->seq.store(pos + 1, std::memory_order_release);
 
-        int n_probs = whisper_vad_n_probs(context_.get());
-        if (n_probs <= 0) {
-            throw std::runtime_error("Silero VAD returned no probabilities");
+        if (writer_idle_.load(std::memory_order_seq_cst)) {
+            wake_cv_.notify_one();
         }
-        float *probs = whisper_vad_probs(context_.get());
-        if (!probs) {
-            throw std::runtime_error("Silero VAD probabilities pointer was null");
+    }
+
+    // Drains everything queued so far, flushes the file and joins the writer.
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(wake_mu_);
+            stop_.store(true, std::memory_order_release);
         }
-        return probs[n_probs - 1];
+        wake_cv_.notify_one();
+        thread_.join();
     }
 
-private:
-    size_t expected_chunk_size() const {
-        return 512;
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
     }
 
-    int sample_rate_;
-    size_t chunk_size_ = 0;
-    std::unique_ptr<whisper_vad_context, VadContextDeleter> context_;
-};
+private:
+    struct record {
+        std::string line;
+        bool to_file = false;
+        bool to_stdout = false;
+    };
 
-std::string escape_json(const std::string &s) {
-    std::string out;
-    out.reserve(s.size() + 8);
-    for (char c : s) {
-        switch (c) {
-        case '\\':
-            out += "\\\\";
-            break;
-        case '\"':
-            out += "\\\"";
-            break;
-        case '\n':
-            out += "\\n";
-            break;
-        case '\r':
-            out += "\\r";
-            break;
-        case '\t':
-            out += "\\t";
-            break;
-        default:
-            out.push_back(c);
-            break;
-        }
-    }
-    return out;
-}
+    struct cell {
+        std::atomic<size_t> seq{0};
+        record rec;
+    };
 
-struct logits_log_writer {
-    std::mutex mu;
-    std::ofstream file;
-    bool enabled = false;
-    int flush_ms = 250;
-    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
-};
+    bool has_pending() const {
+        const cell &c = cells_[dequeue_pos_ & mask_];
+        return c.seq.load(std::memory_order_acquire) == dequeue_pos_ + 1;
+    }
 
-struct bias_decode_context {
-    int segment_index = -1;
-    int partial_seq = -1;
-    bool is_final = false;
+    bool try_pop(record &out) {
+        cell &c = cells_[dequeue_pos_ & mask_];
+        if (c.seq.load(std::memory_order_acquire) != dequeue_pos_ + 1) return false;
+        out = std::move(c.rec);
+        c.seq.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
 
-    const std::vector<std::vector<whisper_token>> * dict_token_seqs = nullptr;
-    const std::vector<whisper_token> * dict_first_tokens = nullptr;
-    const std::unordered_set<int> * dict_first_token_ids = nullptr;
-    int dict_entries = 0;
-    int dict_first_tokens_total = 0;
-    bool enabled = false;
-    float bias_first_logit = 0.35f;
-    float bias_continuation_logit = 0.85f;
-    int logits_top_k = 50;
-    float logits_prob_threshold = 20.0f;
-    bool logits_prefix_text = false;
-    int logits_boosted_k = 24;
+    void run() {
+        constexpr size_t kMaxBatch = 256;
+        // A producer's notify can race the writer going to sleep; the timeout bounds that latency.
+        constexpr auto kIdleWait = std::chrono::milliseconds(50);
 
-    logits_log_writer * writer = nullptr;
-    bool emit_stdout_packets = true;
-};
+        std::string file_batch;
+        std::string stdout_batch;
+        record rec;
+        uint64_t reported_dropped = 0;
+        bool file_dirty = false;
+        auto last_flush = std::chrono::steady_clock::now();
 
-static void whisper_logits_filter_cb(
-        whisper_context * ctx,
-        whisper_state * /* state */,
-        const whisper_token_data * tokens,
-        int n_tokens,
-        float * logits,
-        void * user_data) {
-    if (!ctx || !logits || !user_data) return;
-    auto * bctx = reinterpret_cast<bias_decode_context *>(user_data);
-    if (!bctx->enabled) return;
+        while (true) {
+            const bool stopping = stop_.load(std::memory_order_acquire);
+            size_t n = 0;
+            while (n < kMaxBatch && try_pop(rec)) {
+                if (rec.to_file) file_batch += rec.line;
+                if (rec.to_stdout) append_event_record(stdout_batch, stdout_format_, rec.line);
+                ++n;
+            }
 
-    const int n_vocab = whisper_n_vocab(ctx);
-    if (n_vocab <= 0) return;
-    const int token_beg = (int) whisper_token_beg(ctx);
+            const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+            if (dropped != reported_dropped) {
+                fprintf(stderr, "warning: log writer queue full, dropped %llu records (%llu total)\n",
+                        (unsigned long long) (dropped - reported_dropped), (unsigned long long) dropped);
+                if (enabled_) {
+                    char buf[128];
+                    snprintf(buf, sizeof(buf), "{\"event\":\"log_dropped\",\"dropped\":%llu,\"total_dropped\":%llu}\n",
+                             (unsigned long long) (dropped - reported_dropped), (unsigned long long) dropped);
+                    file_batch += buf;
+                }
+                reported_dropped = dropped;
+            }
 
-    const float kFirstTokenBias = bctx->bias_first_logit;
-    const float kContinuationBias = bctx->bias_continuation_logit;
+            write_stdout(stdout_batch);
+            stdout_batch.clear();
+            if (!file_batch.empty()) {
+                file_.write(file_batch.data(), (std::streamsize) file_batch.size());
+                file_batch.clear();
+                file_dirty = true;
+            }
 
-    std::unordered_map<int, float> boosted_cont;
-    boosted_cont.reserve(16);
-    int boosted_first_total = 0;
+            auto now = std::chrono::steady_clock::now();
+            if (file_dirty && flush_ms_ >= 0 && now - last_flush >= std::chrono::milliseconds(flush_ms_)) {
+                file_.flush();
+                file_dirty = false;
+                last_flush = now;
+            }
 
-    auto add_bias = [&](int token_id, float bias) {
-        if (token_id < 0 || token_id >= n_vocab) return;
-        if (token_beg > 0 && token_id >= token_beg) return; // don't bias timestamp/control range
-        if (!std::isfinite(logits[token_id])) return;
-        logits[token_id] += bias;
-    };
+            if (n == kMaxBatch) continue;
+            if (stopping) break;
 
-    // Boost next tokens when the current beam ends with a dictionary prefix.
-    if (bctx->dict_token_seqs) {
-        for (const auto &seq : *bctx->dict_token_seqs) {
-            if (seq.size() < 2) continue;
-            const int max_l = std::min(n_tokens, (int)seq.size() - 1);
-            for (int l = max_l; l >= 1; --l) {
-                bool match = true;
-                for (int j = 0; j < l; ++j) {
-                    if (tokens[n_tokens - l + j].id != seq[j]) {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match) {
-                    const int next_id = (int) seq[l];
-                    add_bias(next_id, kContinuationBias);
-                    boosted_cont[next_id] += kContinuationBias;
-                    break;
-                }
+            auto wait = kIdleWait;
+            if (file_dirty && flush_ms_ >= 0) {
+                const auto until_flush = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        last_flush + std::chrono::milliseconds(flush_ms_) - now);
+                wait = std::clamp(until_flush, std::chrono::milliseconds(1), kIdleWait);
             }
+            std::unique_lock<std::mutex> lock(wake_mu_);
+            writer_idle_.store(true, std::memory_order_seq_cst);
+            wake_cv_.wait_for(lock, wait, [&] { return stop_.load(std::memory_order_acquire) || has_pending(); });
+            writer_idle_.store(false, std::memory_order_relaxed);
         }
-    }
 
-    // If we're currently matching any dictionary prefix, don't also boost dictionary starts for
-    // other entries. This prevents unrelated dictionary words from being kept "hot" once a beam is
-    // already on a dictionary path.
-    if (boosted_cont.empty() && bctx->dict_first_tokens) {
-        for (whisper_token tid : *bctx->dict_first_tokens) {
-            add_bias((int)tid, kFirstTokenBias);
-            boosted_first_total++;
+        if (enabled_) {
+            file_.flush();
         }
     }
 
-    const bool want_log_packets = bctx->emit_stdout_packets || (bctx->writer && bctx->writer->enabled);
-    if (!want_log_packets) {
-        return;
-    }
+    std::unique_ptr<cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) size_t dequeue_pos_ = 0;
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> writer_idle_{false};
+    std::mutex wake_mu_;
+    std::condition_variable wake_cv_;
+    std::ofstream file_;
+    bool enabled_ = false;
+    int flush_ms_ = 250;
+    output_format stdout_format_ = output_format::json;
+    std::thread thread_;
+};
 
-    const int top_k = std::max(1, bctx->logits_top_k);
+// Token-level Aho-Corasick automaton over the dictionary token sequences, rebuilt on every
+// dictionary reload. Node 0 is the root; a node's children are a token-sorted slice of `edges`.
+struct dictionary_trie {
+    struct edge {
+        whisper_token token;
+        int32_t child;
+    };
+
+    struct node {
+        int32_t first_edge = 0;
+        int32_t n_edges = 0;
+        int32_t fail = 0;
+        int32_t depth = 0;
+        int32_t pass = 0;  // sequences that have this node's path as a prefix
+        int32_t cont = 0;  // of those, the ones that continue past this node
+        int32_t tin = 0;   // preorder interval [tin, tout) covering the subtree
+        int32_t tout = 0;
+    };
+
+    std::vector<node> nodes = std::vector<node>(1);
+    std::vector<edge> edges;
+    int32_t max_depth = 0;
 
-    // Compute top-k probabilities (softmax denom optionally thresholded for speed).
-    float max_logit = -INFINITY;
-    for (int i = 0; i < n_vocab; ++i) {
-        const float v = logits[i];
-        if (std::isfinite(v) && v > max_logit) max_logit = v;
+    void clear() {
+        nodes.assign(1, node{});
+        edges.clear();
+        max_depth = 0;
     }
-    if (!std::isfinite(max_logit)) return;
 
-    double sum_exp = 0.0;
-    const float prob_thr = bctx->logits_prob_threshold;
-    if (prob_thr <= 0.0f) {
-        for (int i = 0; i < n_vocab; ++i) {
-            const float v = logits[i];
-            if (!std::isfinite(v)) continue;
-            sum_exp += std::exp((double)v - (double)max_logit);
+    void build(const std::vector<std::vector<whisper_token>> &seqs) {
+        // Insert into a map-based trie first, then lay it out breadth-first so fail links can be
+        // computed in a single pass over parents-before-children.
+        std::vector<std::map<whisper_token, int32_t>> kids(1);
+        std::vector<int32_t> pass(1, 0);
+        for (const auto &seq : seqs) {
+            int32_t v = 0;
+            for (whisper_token t : seq) {
+                auto it = kids[v].find(t);
+                if (it == kids[v].end()) {
+                    it = kids[v].emplace(t, (int32_t) kids.size()).first;
+                    kids.emplace_back();
+                    pass.push_back(0);
+                }
+                v = it->second;
+                ++pass[v];
+            }
         }
-    } else {
-        const float min_v = max_logit - prob_thr;
-        for (int i = 0; i < n_vocab; ++i) {
-            const float v = logits[i];
-            if (!std::isfinite(v)) continue;
-            if (v < min_v) continue;
-            sum_exp += std::exp((double)v - (double)max_logit);
+
+        clear();
+        nodes.resize(kids.size());
+        edges.reserve(kids.size() - 1);
+        std::vector<int32_t> order(1, 0);  // BFS order of old ids
+        std::vector<int32_t> new_id(kids.size(), 0);
+        for (size_t head = 0; head < order.size(); ++head) {
+            const int32_t old_v = order[head];
+            node &n = nodes[head];
+            n.first_edge = (int32_t) edges.size();
+            n.n_edges = (int32_t) kids[old_v].size();
+            n.pass = pass[old_v];
+            for (const auto &kv : kids[old_v]) {
+                const int32_t child = (int32_t) order.size();
+                new_id[kv.second] = child;
+                order.push_back(kv.second);
+                nodes[child].depth = n.depth + 1;
+                edges.push_back({kv.first, child});
+                n.cont += pass[kv.second];
+            }
+            max_depth = std::max(max_depth, n.depth);
         }
-    }
-    if (!(sum_exp > 0.0)) return;
 
-    struct top_item { int id; float logit; };
-    std::vector<top_item> top;
-    top.reserve((size_t) top_k);
-    for (int i = 0; i < n_vocab; ++i) {
-        const float v = logits[i];
-        if (!std::isfinite(v)) continue;
-        if ((int)top.size() < top_k) {
-            top.push_back({i, v});
-            if ((int)top.size() == top_k) {
-                std::make_heap(top.begin(), top.end(), [](const top_item &a, const top_item &b) { return a.logit > b.logit; }); // min-heap by logit
+        for (size_t v = 0; v < nodes.size(); ++v) {
+            for (int32_t e = nodes[v].first_edge; e < nodes[v].first_edge + nodes[v].n_edges; ++e) {
+                const int32_t c = edges[e].child;
+                nodes[c].fail = v == 0 ? 0 : step(nodes[v].fail, edges[e].token);
+            }
+        }
+
+        int32_t clock = 0;
+        std::vector<std::pair<int32_t, int32_t>> stack{{0, 0}};  // (node, next edge offset)
+        nodes[0].tin = clock++;
+        while (!stack.empty()) {
+            auto &[v, k] = stack.back();
+            if (k < nodes[v].n_edges) {
+                const int32_t c = edges[nodes[v].first_edge + k++].child;
+                nodes[c].tin = clock++;
+                stack.push_back({c, 0});
+            } else {
+                nodes[v].tout = clock;
+                stack.pop_back();
             }
-            continue;
         }
-        if (v <= top.front().logit) continue;
-        std::pop_heap(top.begin(), top.end(), [](const top_item &a, const top_item &b) { return a.logit > b.logit; });
-        top.back() = {i, v};
-        std::push_heap(top.begin(), top.end(), [](const top_item &a, const top_item &b) { return a.logit > b.logit; });
     }
-    std::sort(top.begin(), top.end(), [](const top_item &a, const top_item &b) { return a.logit > b.logit; });
 
-    auto fnv1a_step = [](uint64_t h, uint32_t v) -> uint64_t {
-        h ^= (uint64_t)v;
-        h *= 1099511628211ULL;
-        return h;
-    };
+    // Child of v along token t, or -1.
+    int32_t child(int32_t v, whisper_token t) const {
+        const auto first = edges.begin() + nodes[v].first_edge;
+        const auto last = first + nodes[v].n_edges;
+        const auto it = std::lower_bound(first, last, t, [](const edge &e, whisper_token tok) { return e.token < tok; });
+        return (it != last && it->token == t) ? it->child : -1;
+    }
 
-    const uint64_t fnv_offset = 14695981039346656037ULL;
-    uint64_t prefix_hash = fnv_offset;
-    uint64_t prefix_prev_hash = fnv_offset;
-    for (int i = 0; i < n_tokens; ++i) {
-        if (i == n_tokens - 1) {
-            prefix_prev_hash = prefix_hash;
+    // Automaton transition: the deepest node whose path is a suffix of (path(v) + t).
+    int32_t step(int32_t v, whisper_token t) const {
+        while (true) {
+            const int32_t c = child(v, t);
+            if (c >= 0) return c;
+            if (v == 0) return 0;
+            v = nodes[v].fail;
         }
-        const uint32_t tid = (uint32_t) tokens[i].id;
-        prefix_hash = fnv1a_step(prefix_hash, tid);
     }
-    if (n_tokens == 0) {
-        prefix_prev_hash = prefix_hash;
+
+    bool is_ancestor_or_self(int32_t a, int32_t v) const {
+        return nodes[a].tin <= nodes[v].tin && nodes[v].tin < nodes[a].tout;
     }
+};
 
-    std::ostringstream prefix_hash_hex;
-    prefix_hash_hex << std::hex << std::setw(16) << std::setfill('0') << prefix_hash;
+// One loaded dictionary. Snapshots are immutable once published, so a decode can keep using the one
+// it started with while a reload builds and publishes the next.
+struct dictionary_snapshot {
+    struct prompt_entry {
+        size_t file_index;
+        std::vector<whisper_token> tokens;
+    };
+
+    std::string raw;  // file contents
+    std::string error;
+    std::vector<std::vector<whisper_token>> token_seqs;
+    std::vector<std::string> entry_texts;  // parallel to token_seqs
+    std::vector<whisper_token> first_tokens;
+    std::unordered_set<int> first_token_ids;
+    dictionary_trie trie;
+    int entries_raw = 0;
+    int total_tokens = 0;
+
+    // Decoder prompt, tokenized once per snapshot: the entries that fit the prompt budget, in
+    // priority order, and their concatenation in file order.
+    std::vector<prompt_entry> prompt_entries;
+    std::vector<whisper_token> prompt_tokens;
+
+    // The highest-priority prompt entries that fit in `budget` tokens, concatenated in file order.
+    std::vector<whisper_token> prompt_within(size_t budget) const {
+        std::vector<const prompt_entry *> picked;
+        size_t used = 0;
+        for (const auto &e : prompt_entries) {
+            if (used + e.tokens.size() > budget) break;
+            used += e.tokens.size();
+            picked.push_back(&e);
+        }
+        std::sort(picked.begin(), picked.end(), [](const prompt_entry *a, const prompt_entry *b) {
+            return a->file_index < b->file_index;
+        });
+        std::vector<whisper_token> out;
+        out.reserve(used);
+        for (const auto *e : picked) {
+            out.insert(out.end(), e->tokens.begin(), e->tokens.end());
+        }
+        return out;
+    }
+};
+
+// Calls on_change() from its own thread whenever the file at `path` may have changed. On macOS this
+// is event-driven (kqueue EVFILT_VNODE on the file, reopened when an editor replaces it by rename);
+// elsewhere, and while the file doesn't exist, the mtime is polled every poll_ms.
+class DictionaryFileWatcher {
+public:
+    DictionaryFileWatcher(std::string path, int poll_ms, std::function<void()> on_change)
+        : path_(std::move(path)), poll_ms_(std::max(10, poll_ms)), on_change_(std::move(on_change)) {}
+
+    ~DictionaryFileWatcher() {
+        stop();
+    }
+
+    void start() {
+#if defined(__APPLE__)
+        kq_ = kqueue();
+        if (kq_ >= 0) {
+            struct kevent ev;
+            EV_SET(&ev, kWakeIdent, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+            kevent(kq_, &ev, 1, nullptr, 0, nullptr);
+        }
+#endif
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+#if defined(__APPLE__)
+        if (kq_ >= 0) {
+            struct kevent ev;
+            EV_SET(&ev, kWakeIdent, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+            kevent(kq_, &ev, 1, nullptr, 0, nullptr);
+        }
+#endif
+        thread_.join();
+#if defined(__APPLE__)
+        if (kq_ >= 0) {
+            ::close(kq_);
+            kq_ = -1;
+        }
+#endif
+    }
+
+private:
+    bool stopping() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return stop_;
+    }
+
+    // Sleeps up to poll_ms; returns false once stop() was called.
+    bool wait_poll() {
+        std::unique_lock<std::mutex> lock(mu_);
+        return !cv_.wait_for(lock, std::chrono::milliseconds(poll_ms_), [&] { return stop_; });
+    }
+
+    // True when the mtime differs from the last call (a missing file counts as its own state).
+    bool mtime_changed() {
+        std::error_code ec;
+        const auto mtime = std::filesystem::last_write_time(path_, ec);
+        const auto seen = ec ? std::filesystem::file_time_type::min() : mtime;
+        const bool changed = seen != last_mtime_;
+        last_mtime_ = seen;
+        return changed;
+    }
+
+    void run() {
+        mtime_changed();
+#if defined(__APPLE__)
+        if (kq_ >= 0) {
+            run_kqueue();
+            return;
+        }
+#endif
+        while (wait_poll()) {
+            if (mtime_changed()) on_change_();
+        }
+    }
+
+#if defined(__APPLE__)
+    void run_kqueue() {
+        int fd = -1;
+        while (!stopping()) {
+            if (fd < 0) {
+                fd = ::open(path_.c_str(), O_EVTONLY);
+                if (fd >= 0) {
+                    struct kevent ev;
+                    EV_SET(&ev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+                           NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, nullptr);
+                    kevent(kq_, &ev, 1, nullptr, 0, nullptr);
+                    // The file may have been replaced between the event and the reopen.
+                    if (mtime_changed()) on_change_();
+                }
+            }
+
+            // Without a file there is nothing to watch; poll for it to (re)appear.
+            struct timespec timeout = {poll_ms_ / 1000, (long) (poll_ms_ % 1000) * 1000000L};
+            struct kevent out;
+            const int n = kevent(kq_, nullptr, 0, &out, 1, fd < 0 ? &timeout : nullptr);
+            if (n <= 0 || out.filter != EVFILT_VNODE) continue;
+
+            if (out.fflags & (NOTE_DELETE | NOTE_RENAME)) {
+                ::close(fd);  // closing the fd also removes its kevent
+                fd = -1;
+                continue;
+            }
+            if (mtime_changed()) on_change_();
+        }
+        if (fd >= 0) ::close(fd);
+    }
+
+    static constexpr uintptr_t kWakeIdent = 1;
+    int kq_ = -1;
+#endif
+
+    std::string path_;
+    int poll_ms_;
+    std::function<void()> on_change_;
+    std::filesystem::file_time_type last_mtime_ = std::filesystem::file_time_type::min();
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+// Bias and logits-log settings, fixed at startup and shared by every decode.
+struct bias_decode_config {
+    float bias_first_logit = 0.35f;
+    float bias_continuation_logit = 0.85f;
+    int logits_top_k = 50;
+    float logits_prob_threshold = 20.0f;
+    bool logits_prefix_text = false;
+    int logits_boosted_k = 24;
+
+    logits_log_writer * writer = nullptr;
+    bool emit_stdout_packets = true;
+};
+
+// What one decode's logits filter needs: the shared config plus that decode's dictionary snapshot.
+struct bias_decode_context {
+    const bias_decode_config * config = nullptr;
+    int segment_index = -1;
+    int partial_seq = -1;
+    bool is_final = false;
+
+    const dictionary_trie * dict_trie = nullptr;
+    const std::vector<whisper_token> * dict_first_tokens = nullptr;
+    const std::unordered_set<int> * dict_first_token_ids = nullptr;
+    int dict_entries = 0;
+    int dict_first_tokens_total = 0;
+};
+
+// Helpers for the logits packets. "Finite" excludes the -INFINITY whisper uses for suppressed
+// tokens as well as any inf/NaN.
+
+struct logit_item {
+    int id;
+    float logit;
+};
+
+#if defined(__ARM_NEON)
+// exp(x) for x <= 0 (Cephes single-precision polynomial); inputs below -87 flush towards 0.
+static inline float32x4_t neon_expf_nonpos(float32x4_t x) {
+    x = vmaxq_f32(x, vdupq_n_f32(-87.0f));
+    const float32x4_t fx = vrndnq_f32(vmulq_f32(x, vdupq_n_f32(1.44269504088896341f)));
+    float32x4_t r = vfmsq_f32(x, fx, vdupq_n_f32(0.693359375f));
+    r = vfmsq_f32(r, fx, vdupq_n_f32(-2.12194440e-4f));
+
+    float32x4_t p = vdupq_n_f32(1.9875691500e-4f);
+    p = vfmaq_f32(vdupq_n_f32(1.3981999507e-3f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(8.3334519073e-3f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(4.1665795894e-2f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(1.6666665459e-1f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(5.0000001201e-1f), p, r);
+    p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
+
+    const int32x4_t scale = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+    return vmulq_f32(p, vreinterpretq_f32_s32(scale));
+}
+#endif
+
+// Largest finite logit, or -INFINITY when there is none.
+static float finite_logits_max(const float *x, int n) {
+    float max_v = -INFINITY;
+    int i = 0;
+#if defined(__ARM_NEON)
+    const float32x4_t v_inf = vdupq_n_f32(INFINITY);
+    const float32x4_t v_ninf = vdupq_n_f32(-INFINITY);
+    float32x4_t m0 = v_ninf;
+    float32x4_t m1 = v_ninf;
+    for (; i + 8 <= n; i += 8) {
+        const float32x4_t a = vld1q_f32(x + i);
+        const float32x4_t b = vld1q_f32(x + i + 4);
+        m0 = vmaxq_f32(m0, vbslq_f32(vcltq_f32(vabsq_f32(a), v_inf), a, v_ninf));
+        m1 = vmaxq_f32(m1, vbslq_f32(vcltq_f32(vabsq_f32(b), v_inf), b, v_ninf));
+    }
+    max_v = vmaxvq_f32(vmaxq_f32(m0, m1));
+#endif
+    for (; i < n; ++i) {
+        if (std::isfinite(x[i]) && x[i] > max_v) max_v = x[i];
+    }
+    return max_v;
+}
+
+// One pass over the vocab: returns sum(exp(v - max_v)) over finite v >= min_v, and appends every
+// finite logit >= cand_min to `cands` as a top-k candidate.
+static double finite_logits_exp_sum(const float *x,
+                                    int n,
+                                    float max_v,
+                                    float min_v,
+                                    float cand_min,
+                                    std::vector<logit_item> &cands) {
+    double sum = 0.0;
+    int i = 0;
+#if defined(__ARM_NEON)
+    const float32x4_t v_inf = vdupq_n_f32(INFINITY);
+    const float32x4_t v_max = vdupq_n_f32(max_v);
+    const float32x4_t v_min = vdupq_n_f32(min_v);
+    const float32x4_t v_cand = vdupq_n_f32(cand_min);
+    float64x2_t acc0 = vdupq_n_f64(0.0);
+    float64x2_t acc1 = vdupq_n_f64(0.0);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t v = vld1q_f32(x + i);
+        const uint32x4_t finite = vcltq_f32(vabsq_f32(v), v_inf);
+        const uint32x4_t in_sum = vandq_u32(finite, vcgeq_f32(v, v_min));
+        // With a threshold most of the vocab sits below min_v, so whole blocks skip the exp.
+        if (vmaxvq_u32(in_sum) != 0) {
+            const float32x4_t e = neon_expf_nonpos(vsubq_f32(v, v_max));
+            const float32x4_t masked = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(e), in_sum));
+            acc0 = vaddq_f64(acc0, vcvt_f64_f32(vget_low_f32(masked)));
+            acc1 = vaddq_f64(acc1, vcvt_high_f64_f32(masked));
+        }
+        const uint32x4_t is_cand = vandq_u32(finite, vcgeq_f32(v, v_cand));
+        if (vmaxvq_u32(is_cand) != 0) {
+            for (int l = 0; l < 4; ++l) {
+                if (std::isfinite(x[i + l]) && x[i + l] >= cand_min) cands.push_back({i + l, x[i + l]});
+            }
+        }
+    }
+    sum = vaddvq_f64(acc0) + vaddvq_f64(acc1);
+#endif
+    for (; i < n; ++i) {
+        const float v = x[i];
+        if (!std::isfinite(v)) continue;
+        if (v >= min_v) sum += std::exp((double) v - (double) max_v);
+        if (v >= cand_min) cands.push_back({i, v});
+    }
+    return sum;
+}
+
+// Keeps the k largest candidates, sorted by logit (descending, ties by id).
+static void select_top_logits(std::vector<logit_item> &cands, int k) {
+    auto higher = [](const logit_item &a, const logit_item &b) {
+        return a.logit > b.logit || (a.logit == b.logit && a.id < b.id);
+    };
+    if ((int) cands.size() > k) {
+        std::nth_element(cands.begin(), cands.begin() + (k - 1), cands.end(), higher);
+        cands.resize((size_t) k);
+    }
+    std::sort(cands.begin(), cands.end(), higher);
+}
+
+struct boosted_token {
+    int id;
+    float bias;
+};
+
+// One "logits" packet for the step whisper_logits_filter_cb just biased: top-k probabilities plus
+// the boosts that were applied (boosted_cont is sorted and merged here).
+static void log_logits_packet(whisper_context * ctx,
+                              const bias_decode_context &bctx,
+                              const whisper_token_data * tokens,
+                              int n_tokens,
+                              const float * logits,
+                              int boosted_first_total,
+                              std::vector<boosted_token> &boosted_cont) {
+    const bias_decode_config &cfg = *bctx.config;
+    const int n_vocab = whisper_n_vocab(ctx);
+    const float kFirstTokenBias = cfg.bias_first_logit;
+    const float kContinuationBias = cfg.bias_continuation_logit;
+
+    // A token can be boosted from several chain nodes; merge those into one entry per id.
+    std::sort(boosted_cont.begin(), boosted_cont.end(),
+              [](const boosted_token &a, const boosted_token &b) { return a.id < b.id; });
+    size_t n_boosted = 0;
+    for (const auto &b : boosted_cont) {
+        if (n_boosted > 0 && boosted_cont[n_boosted - 1].id == b.id) {
+            boosted_cont[n_boosted - 1].bias += b.bias;
+        } else {
+            boosted_cont[n_boosted++] = b;
+        }
+    }
+    boosted_cont.resize(n_boosted);
+    auto find_boosted = [&boosted_cont](int tid) -> const boosted_token * {
+        const auto it = std::lower_bound(boosted_cont.begin(), boosted_cont.end(), tid,
+                                         [](const boosted_token &b, int id) { return b.id < id; });
+        return it != boosted_cont.end() && it->id == tid ? &*it : nullptr;
+    };
+
+    const int top_k = std::max(1, cfg.logits_top_k);
+
+    // Compute top-k probabilities (softmax denom optionally thresholded for speed). Top-k candidates
+    // are gathered within kTopKWindow of the max in the same pass as the denominator; if that turns
+    // up fewer than top_k finite logits, a second pass gathers all of them.
+    constexpr float kTopKWindow = 16.0f;
+    const float max_logit = finite_logits_max(logits, n_vocab);
+    if (!std::isfinite(max_logit)) return;
+
+    thread_local std::vector<logit_item> top;
+    top.clear();
+    const float prob_thr = cfg.logits_prob_threshold;
+    const float min_v = prob_thr <= 0.0f ? -INFINITY : max_logit - prob_thr;
+    const double sum_exp = finite_logits_exp_sum(logits, n_vocab, max_logit, min_v, max_logit - kTopKWindow, top);
+    if (!(sum_exp > 0.0)) return;
+
+    if ((int) top.size() < top_k) {
+        top.clear();
+        for (int i = 0; i < n_vocab; ++i) {
+            if (std::isfinite(logits[i])) top.push_back({i, logits[i]});
+        }
+    }
+    select_top_logits(top, top_k);
+
+    auto fnv1a_step = [](uint64_t h, uint32_t v) -> uint64_t {
+        h ^= (uint64_t)v;
+        h *= 1099511628211ULL;
+        return h;
+    };
+
+    const uint64_t fnv_offset = 14695981039346656037ULL;
+    uint64_t prefix_hash = fnv_offset;
+    uint64_t prefix_prev_hash = fnv_offset;
+    for (int i = 0; i < n_tokens; ++i) {
+        if (i == n_tokens - 1) {
+            prefix_prev_hash = prefix_hash;
+        }
+        const uint32_t tid = (uint32_t) tokens[i].id;
+        prefix_hash = fnv1a_step(prefix_hash, tid);
+    }
+    if (n_tokens == 0) {
+        prefix_prev_hash = prefix_hash;
+    }
+
+    std::ostringstream prefix_hash_hex;
+    prefix_hash_hex << std::hex << std::setw(16) << std::setfill('0') << prefix_hash;
     std::ostringstream prefix_prev_hash_hex;
     prefix_prev_hash_hex << std::hex << std::setw(16) << std::setfill('0') << prefix_prev_hash;
 
     std::string prefix_text;
-    if (bctx->logits_prefix_text) {
+    if (cfg.logits_prefix_text) {
         prefix_text.reserve(128);
         const int max_prefix_tokens = std::min(n_tokens, 48);
         for (int i = std::max(0, n_tokens - max_prefix_tokens); i < n_tokens; ++i) {
@@ -684,9 +1650,9 @@ static void whisper_logits_filter_cb(
     std::ostringstream packet;
     packet.setf(std::ios::fixed);
     packet << "{\"event\":\"logits\""
-           << ",\"segment_index\":" << bctx->segment_index
-           << ",\"partial_seq\":" << bctx->partial_seq
-           << ",\"final\":" << (bctx->is_final ? "true" : "false")
+           << ",\"segment_index\":" << bctx.segment_index
+           << ",\"partial_seq\":" << bctx.partial_seq
+           << ",\"final\":" << (bctx.is_final ? "true" : "false")
            << ",\"decode_step\":" << n_tokens
            << ",\"prefix_len\":" << n_tokens
            << ",\"prefix_hash\":\"" << prefix_hash_hex.str() << "\""
@@ -696,8 +1662,8 @@ static void whisper_logits_filter_cb(
            << ",\"prob_threshold\":" << prob_thr
            << ",\"bias_first_logit\":" << kFirstTokenBias
            << ",\"bias_continuation_logit\":" << kContinuationBias
-           << ",\"dict_entries\":" << bctx->dict_entries
-           << ",\"dict_first_tokens\":" << bctx->dict_first_tokens_total
+           << ",\"dict_entries\":" << bctx.dict_entries
+           << ",\"dict_first_tokens\":" << bctx.dict_first_tokens_total
            << ",\"boosted_first_total\":" << boosted_first_total
            << ",\"boosted_cont_count\":" << (int) boosted_cont.size();
 
@@ -712,7 +1678,7 @@ static void whisper_logits_filter_cb(
     // - first: dictionary first-token boosts that appear in the current top-k list
     // - continuation: tokens boosted due to current prefix match (may or may not be in top-k)
     {
-        const int boosted_k = std::max(0, bctx->logits_boosted_k);
+        const int boosted_k = std::max(0, cfg.logits_boosted_k);
         std::unordered_set<int> emitted_ids;
         emitted_ids.reserve((size_t)boosted_k * 2 + 8);
         int emitted = 0;
@@ -738,10 +1704,10 @@ static void whisper_logits_filter_cb(
 
         if (boosted_k > 0) {
             // first boosts that are currently in top-k
-            if (bctx->dict_first_token_ids && kFirstTokenBias != 0.0f) {
+            if (bctx.dict_first_token_ids && kFirstTokenBias != 0.0f) {
                 for (size_t i = 0; i < top.size() && emitted < boosted_k; ++i) {
                     const int tid = top[i].id;
-                    if (bctx->dict_first_token_ids->find(tid) == bctx->dict_first_token_ids->end()) continue;
+                    if (bctx.dict_first_token_ids->find(tid) == bctx.dict_first_token_ids->end()) continue;
                     emit_item(tid, "first", kFirstTokenBias, true);
                 }
             }
@@ -749,15 +1715,15 @@ static void whisper_logits_filter_cb(
             // continuation boosts, prefer ones in top-k
             for (size_t i = 0; i < top.size() && emitted < boosted_k; ++i) {
                 const int tid = top[i].id;
-                const auto it = boosted_cont.find(tid);
-                if (it == boosted_cont.end()) continue;
-                emit_item(tid, "continuation", it->second, true);
+                const boosted_token *b = find_boosted(tid);
+                if (!b) continue;
+                emit_item(tid, "continuation", b->bias, true);
             }
 
             // continuation boosts not in top-k
-            for (const auto &kv : boosted_cont) {
+            for (const auto &b : boosted_cont) {
                 if (emitted >= boosted_k) break;
-                emit_item(kv.first, "continuation", kv.second, false);
+                emit_item(b.id, "continuation", b.bias, false);
             }
         }
 
@@ -781,29 +1747,156 @@ static void whisper_logits_filter_cb(
     }
     packet << "]}\n";
 
-    const std::string line = packet.str();
+    if (cfg.writer) {
+        cfg.writer->push(packet.str(), true, cfg.emit_stdout_packets);
+    }
+}
+
+// The per-step logits filter, installed only with --bias-decoding. kLogPackets is fixed at startup
+// (logits log file or --log/--debug), so the decode loop without logging carries none of the
+// packet bookkeeping: it only needs to know whether any continuation was boosted. With logging,
+// continuation boosts are collected into a per-thread buffer that keeps its capacity across steps.
+template <bool kLogPackets>
+static void whisper_logits_filter_cb(
+        whisper_context * ctx,
+        whisper_state * /* state */,
+        const whisper_token_data * tokens,
+        int n_tokens,
+        float * logits,
+        void * user_data) {
+    if (!ctx || !logits || !user_data) return;
+    auto * bctx = reinterpret_cast<bias_decode_context *>(user_data);
+    const bias_decode_config &cfg = *bctx->config;
+
+    const int n_vocab = whisper_n_vocab(ctx);
+    if (n_vocab <= 0) return;
+    const int token_beg = (int) whisper_token_beg(ctx);
+
+    const float kFirstTokenBias = cfg.bias_first_logit;
+    const float kContinuationBias = cfg.bias_continuation_logit;
 
-    if (bctx->emit_stdout_packets) {
-        fputs(line.c_str(), stdout);
+    bool boosted_any_cont = false;
+    thread_local std::vector<boosted_token> boosted_cont;
+    if constexpr (kLogPackets) {
+        boosted_cont.clear();
     }
+    int boosted_first_total = 0;
+
+    auto add_bias = [&](int token_id, float bias) {
+        if (token_id < 0 || token_id >= n_vocab) return;
+        if (token_beg > 0 && token_id >= token_beg) return; // don't bias timestamp/control range
+        if (!std::isfinite(logits[token_id])) return;
+        logits[token_id] += bias;
+    };
+
+    // Boost next tokens when the current beam ends with a dictionary prefix. Each sequence is
+    // boosted once, at its longest prefix that the beam ends with: the automaton state and its fail
+    // chain are exactly the dictionary prefixes the beam ends with, deepest first, and a node's
+    // edge weights count the sequences continuing through it. Sequences already boosted at a
+    // deeper chain node (always inside this node's subtree) are subtracted out.
+    if (bctx->dict_trie && bctx->dict_trie->max_depth >= 2) {
+        const dictionary_trie &trie = *bctx->dict_trie;
+        int32_t state = 0;
+        for (int i = std::max(0, n_tokens - trie.max_depth); i < n_tokens; ++i) {
+            state = trie.step(state, tokens[i].id);
+        }
+
+        int32_t claimed[64];  // topmost chain nodes boosted so far
+        int n_claimed = 0;
+        for (int32_t v = state; v != 0; v = trie.nodes[v].fail) {
+            const auto &n = trie.nodes[v];
+            if (n.cont == 0) continue;
+            for (int32_t e = n.first_edge; e < n.first_edge + n.n_edges; ++e) {
+                const int32_t c = trie.edges[e].child;
+                int32_t weight = trie.nodes[c].pass;
+                for (int k = 0; k < n_claimed; ++k) {
+                    if (trie.is_ancestor_or_self(c, claimed[k])) weight -= trie.nodes[claimed[k]].cont;
+                }
+                if (weight <= 0) continue;
+                const int next_id = (int) trie.edges[e].token;
+                add_bias(next_id, kContinuationBias * (float) weight);
+                boosted_any_cont = true;
+                if constexpr (kLogPackets) {
+                    boosted_cont.push_back({next_id, kContinuationBias * (float) weight});
+                }
+            }
 
-    if (bctx->writer && bctx->writer->enabled) {
-        std::lock_guard<std::mutex> lock(bctx->writer->mu);
-        bctx->writer->file << line;
-        if (bctx->writer->flush_ms >= 0) {
-            const auto now = std::chrono::steady_clock::now();
-            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - bctx->writer->last_flush).count();
-            if (elapsed >= bctx->writer->flush_ms) {
-                bctx->writer->file.flush();
-                bctx->writer->last_flush = now;
+            int kept = 0;
+            for (int k = 0; k < n_claimed; ++k) {
+                if (!trie.is_ancestor_or_self(v, claimed[k])) claimed[kept++] = claimed[k];
             }
+            n_claimed = kept;
+            if (n_claimed < (int) (sizeof(claimed) / sizeof(claimed[0]))) claimed[n_claimed++] = v;
+        }
+    }
+
+    // If we're currently matching any dictionary prefix, don't also boost dictionary starts for
+    // other entries. This prevents unrelated dictionary words from being kept "hot" once a beam is
+    // already on a dictionary path.
+    if (!boosted_any_cont && bctx->dict_first_tokens) {
+        for (whisper_token tid : *bctx->dict_first_tokens) {
+            add_bias((int)tid, kFirstTokenBias);
+            boosted_first_total++;
         }
     }
+
+    if constexpr (kLogPackets) {
+        log_logits_packet(ctx, *bctx, tokens, n_tokens, logits, boosted_first_total, boosted_cont);
+    }
 }
 
 } // namespace
 
+// OPENFLOW_ALLOC_STATS (the CMake option of the same name, for openflow_bench builds): heap
+// allocations per thread, so --metrics can report what formatting and writing a record allocates on
+// a decode worker. Replacing the global operator new costs one thread-local increment per
+// allocation; new[] and the nothrow forms forward here. Off, allocations aren't counted and the
+// stats leave emit_allocs out.
+#if defined(OPENFLOW_ALLOC_STATS)
+static thread_local uint64_t t_allocations = 0;
+
+void *operator new(size_t n) {
+    ++t_allocations;
+    if (n == 0) {
+        n = 1;
+    }
+    while (true) {
+        if (void *p = std::malloc(n)) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+static uint64_t thread_allocations() {
+    return t_allocations;
+}
+#else
+static uint64_t thread_allocations() {
+    return 0;
+}
+#endif
+// thread_allocations() when the worker's current job last finished a whisper decode (or was popped).
+static thread_local uint64_t t_emit_alloc_mark = 0;
+
 int main(int argc, char **argv) {
+    const auto t_process_start = std::chrono::steady_clock::now();
+    auto ms_since = [](std::chrono::steady_clock::time_point t0) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    };
+
     // Make stdout line-buffered even when piped (helps avoid per-line fflush overhead).
     setvbuf(stdout, nullptr, _IOLBF, 0);
 
@@ -819,6 +1912,24 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (params.server) {
+        if (params.stdin_audio || params.stdin_pcm || !params.audio_file.empty()) {
+            fprintf(stderr, "error: --server reads its own framing from stdin; drop --stdin-audio/--stdin-pcm/--audio-file\n");
+            return 1;
+        }
+        if (params.stdout_format != output_format::json) {
+            fprintf(stderr, "error: --server only supports --output-format json (records carry a \"session\" field)\n");
+            return 1;
+        }
+        if (!params.partial_model.empty()) {
+            fprintf(stderr, "error: --server does not support --partial-model\n");
+            return 1;
+        }
+    }
+    if (!params.pcm_ring.empty() && !params.stdin_pcm) {
+        fprintf(stderr, "error: --pcm-ring requires --stdin-pcm\n");
+        return 1;
+    }
     if (params.stop_threshold > params.start_threshold) {
         fprintf(stderr, "warning: stop threshold higher than start threshold, clamping\n");
         params.stop_threshold = params.start_threshold;
@@ -828,6 +1939,10 @@ int main(int argc, char **argv) {
         fprintf(stderr, "error: whisper model not found at '%s'\n", params.model.c_str());
         return 1;
     }
+    if (!params.partial_model.empty() && !std::filesystem::exists(params.partial_model)) {
+        fprintf(stderr, "error: partial whisper model not found at '%s'\n", params.partial_model.c_str());
+        return 1;
+    }
     if (!std::filesystem::exists(params.vad_model_path)) {
         fprintf(stderr, "error: silero VAD model not found at '%s'\n", params.vad_model_path.c_str());
         return 1;
@@ -838,10 +1953,17 @@ int main(int argc, char **argv) {
     }
 
     const int sample_rate = WHISPER_SAMPLE_RATE;
-    const bool enable_partials = params.step_ms >= 0;
-    const int64_t step_samples = enable_partials
-        ? std::max<int64_t>(1, (int64_t)params.step_ms * sample_rate / 1000)
-        : 0;
+    const bool file_job_input = !params.stdin_pcm && (params.stdin_audio || !params.audio_file.empty());
+    const bool use_server = params.server;
+    // Each extra worker decodes on its own whisper_state. For file jobs only finals are decoded in
+    // that mode: partials would be superseded before anyone could read them. --server sessions keep
+    // their partials; the queue runs one job per session at a time instead.
+    const int n_decode_workers = use_server ? params.server_states : (file_job_input ? params.offline_parallel : 1);
+    const bool enable_partials = params.step_ms >= 0 && (n_decode_workers == 1 || use_server);
+    PartialCadence partial_cadence(params.step_ms,
+                                   params.step_min_ms >= 0 ? params.step_min_ms : params.step_ms,
+                                   params.step_max_ms >= 0 ? params.step_max_ms : params.step_ms,
+                                   params.incremental_partials);
     const size_t pre_padding_samples = static_cast<size_t>(std::max<int64_t>(0, (int64_t)params.pre_padding_ms * sample_rate / 1000));
     const size_t post_padding_samples = static_cast<size_t>(std::max<int64_t>(0, (int64_t)params.post_padding_ms * sample_rate / 1000));
     const size_t min_silence_samples = static_cast<size_t>(std::max<int64_t>(0, (int64_t)params.min_silence_ms * sample_rate / 1000));
@@ -850,8 +1972,10 @@ int main(int argc, char **argv) {
 
     const bool use_stdin_audio = params.stdin_audio;
     const bool use_stdin_pcm = params.stdin_pcm;
-    const bool stream_full_pass_mode = use_stdin_pcm && params.stream_final_full_pass;
-    const bool use_mic_capture = params.audio_file.empty() && !use_stdin_audio && !use_stdin_pcm;
+    const bool stream_full_pass_mode = (use_stdin_pcm || use_server) && params.stream_final_full_pass;
+    const bool use_mic_capture = params.audio_file.empty() && !use_stdin_audio && !use_stdin_pcm && !use_server;
+    // File jobs endpoint faster than they decode, so a speculation there is just a second decode.
+    const bool speculative_finals = params.speculative_final && !file_job_input && !stream_full_pass_mode;
     audio_async audio(std::max(params.ring_buffer_ms, params.max_segment_ms + params.post_padding_ms + 2000));
     if (use_mic_capture) {
         if (!audio.init(params.capture_id, sample_rate)) {
@@ -861,30 +1985,116 @@ int main(int argc, char **argv) {
         audio.resume();
     }
 
+    // Core ML builds hand the encoder to <model>-encoder.mlmodelc when it exists and fall back to
+    // ggml otherwise. The Core ML encoder has a fixed input shape, so audio_ctx trimming is off.
+    // A model swap re-applies the requested value for the new model.
+    const int requested_audio_ctx = params.audio_ctx;
+#if defined(OPENFLOW_COREML)
+    const bool coreml_encoder = std::filesystem::exists(coreml_encoder_path(params.model));
+    if (params.coreml && !coreml_encoder) {
+        fprintf(stderr, "warning: --coreml: no '%s'; the encoder stays on ggml\n", coreml_encoder_path(params.model).c_str());
+    }
+#else
+    const bool coreml_encoder = false;
+    if (params.coreml) {
+        fprintf(stderr, "warning: --coreml: built without OPENFLOW_COREML; the encoder stays on ggml\n");
+    }
+#endif
+    if (coreml_encoder && params.audio_ctx != 0) {
+        fprintf(stderr, "warning: --audio-ctx is ignored with the Core ML encoder\n");
+        params.audio_ctx = 0;
+    }
+    // --vad-background keeps Silero to one CPU thread so it can't crowd the decode workers.
+    const bool vad_use_gpu = params.use_gpu_whisper && params.vad_gpu && !params.vad_background;
+    const int vad_threads = params.vad_background ? 1 : params.n_threads;
+
     whisper_context_params cparams = whisper_context_default_params();
     cparams.use_gpu = params.use_gpu_whisper;
     cparams.dtw_token_timestamps = true;
     cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE_EN;
 
+	auto t_phase = std::chrono::steady_clock::now();
 	whisper_context *ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+	const double model_load_ms = ms_since(t_phase);
 	if (!ctx) {
 		fprintf(stderr, "failed to initialize whisper context\n");
         return 2;
     }
 
+    // --partial-model: a second resident context, decoded by its own worker so partials never queue
+    // behind a final. Dictionary tokens and the committed context are shared between the two, which
+    // only works when both models use the same vocabulary.
+    whisper_context *partial_ctx = nullptr;
+    double partial_model_load_ms = 0.0;
+    if (!params.partial_model.empty()) {
+        t_phase = std::chrono::steady_clock::now();
+        partial_ctx = whisper_init_from_file_with_params(params.partial_model.c_str(), cparams);
+        partial_model_load_ms = ms_since(t_phase);
+        if (!partial_ctx) {
+            fprintf(stderr, "failed to initialize partial whisper context\n");
+            whisper_free(ctx);
+            return 2;
+        }
+        if (whisper_n_vocab(partial_ctx) != whisper_n_vocab(ctx) ||
+            whisper_is_multilingual(partial_ctx) != whisper_is_multilingual(ctx)) {
+            fprintf(stderr, "error: --partial-model '%s' does not share the vocabulary of --model '%s'\n",
+                    params.partial_model.c_str(), params.model.c_str());
+            whisper_free(partial_ctx);
+            whisper_free(ctx);
+            return 1;
+        }
+    }
+
     std::unique_ptr<SileroVadRunner> vad;
     size_t vad_chunk_samples = 0;
+    t_phase = std::chrono::steady_clock::now();
+    double vad_init_ms = 0.0;
     try {
         vad = std::make_unique<SileroVadRunner>(params.vad_model_path,
                                                 sample_rate,
-                                                false,
-                                                params.n_threads);
+                                                vad_use_gpu,
+                                                vad_threads);
         vad_chunk_samples = vad->chunk_size();
     } catch (const std::exception &ex) {
         fprintf(stderr, "error: failed to initialize Silero VAD: %s\n", ex.what());
+        if (partial_ctx) {
+            whisper_free(partial_ctx);
+        }
         whisper_free(ctx);
 		return 1;
 	}
+    vad_init_ms = ms_since(t_phase);
+
+    // One decode over silence per context, with the same sampling strategy real decodes use, so
+    // pipeline compilation and compute buffer allocation happen before "ready" instead of during
+    // the first utterance.
+    // audio_ctx is passed in because a swapped-in model warms up before its value is installed.
+    auto warm_up = [&](whisper_context *wctx, int audio_ctx) {
+        const std::vector<float> silence(static_cast<size_t>(WHISPER_SAMPLE_RATE), 0.0f);
+        whisper_full_params wparams = whisper_full_default_params(
+                params.bias_decoding ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+        wparams.print_progress = false;
+        wparams.print_special = false;
+        wparams.print_realtime = false;
+        wparams.print_timestamps = false;
+        wparams.no_context = true;
+        wparams.language = params.language.c_str();
+        wparams.n_threads = params.n_threads;
+        wparams.token_timestamps = true;
+        wparams.audio_ctx = audio_ctx < 0 ? auto_audio_ctx(silence.size(), whisper_n_audio_ctx(wctx)) : audio_ctx;
+        if (whisper_full(wctx, wparams, silence.data(), (int)silence.size()) != 0) {
+            fprintf(stderr, "warning: whisper warm-up decode failed\n");
+        }
+        whisper_reset_timings(wctx);
+    };
+    double warmup_ms = 0.0;
+    if (params.warmup) {
+        t_phase = std::chrono::steady_clock::now();
+        for (whisper_context *wctx : {ctx, partial_ctx}) {
+            if (wctx) warm_up(wctx, params.audio_ctx);
+        }
+        warmup_ms = ms_since(t_phase);
+    }
 
 	const bool log_stdout_packets = params.log || params.debug;
 	const bool enable_dictionary_file = params.log;
@@ -893,7 +2103,6 @@ int main(int argc, char **argv) {
 
 	logits_log_writer logits_writer;
 	std::string logits_log_path;
-	logits_writer.flush_ms = params.logits_flush_ms;
 	if (enable_logits_file) {
 		try {
 			if (!params.logits_log_path.empty()) {
@@ -905,15 +2114,31 @@ int main(int argc, char **argv) {
 			if (!parent.empty()) {
 				std::filesystem::create_directories(parent);
 			}
-			logits_writer.file.open(logits_log_path, std::ios::out | std::ios::app);
-			logits_writer.enabled = logits_writer.file.good();
-			if (!logits_writer.enabled) {
+			if (!logits_writer.open(logits_log_path)) {
 				fprintf(stderr, "warning: failed to open '%s' for append\n", logits_log_path.c_str());
 			}
 		} catch (const std::exception &ex) {
 			fprintf(stderr, "warning: failed to initialize logits log writer: %s\n", ex.what());
 		}
 	}
+	const bool log_logits_packets = logits_writer.enabled() || log_stdout_packets;
+	if (log_logits_packets) {
+		logits_writer.start(params.logits_flush_ms, params.stdout_format);
+	}
+
+	// Everything the bias filter reads besides the dictionary is settled by now, so the config is
+	// built once and the filter's logging is compiled in or out by picking the instantiation here.
+	bias_decode_config bias_config;
+	bias_config.bias_first_logit = params.bias_first_logit;
+	bias_config.bias_continuation_logit = params.bias_continuation_logit;
+	bias_config.logits_top_k = params.logits_top_k;
+	bias_config.logits_prob_threshold = params.logits_prob_threshold;
+	bias_config.logits_prefix_text = params.logits_prefix_text;
+	bias_config.logits_boosted_k = params.logits_boosted_k;
+	bias_config.writer = log_logits_packets ? &logits_writer : nullptr;
+	bias_config.emit_stdout_packets = log_stdout_packets;
+	const whisper_logits_filter_callback logits_filter_cb =
+			log_logits_packets ? whisper_logits_filter_cb<true> : whisper_logits_filter_cb<false>;
 
 	const std::string cwd = std::filesystem::current_path().string();
 	fprintf(stderr,
@@ -924,9 +2149,16 @@ int main(int argc, char **argv) {
 		params.bias_decoding ? 1 : 0,
 		params.bias_first_logit,
 		params.bias_continuation_logit,
-		logits_writer.enabled ? logits_log_path.c_str() : "");
+		logits_writer.enabled() ? logits_log_path.c_str() : "");
 
-    printf("{\"event\":\"ready\",\"cwd\":\"%s\",\"dictionary_file\":\"%s\",\"send_prompt\":%s,\"bias_decoding\":%s,\"bias_first_logit\":%.6f,\"bias_continuation_logit\":%.6f,\"logits_log_path\":\"%s\",\"logits_log_enabled\":%s}\n",
+    // Every stdout event goes through here so the binary output formats can frame it.
+    auto emit_event = [&](const std::string &json_line) {
+        std::string record;
+        append_event_record(record, params.stdout_format, json_line);
+        write_stdout(record);
+    };
+
+    emit_event(string_printf("{\"event\":\"ready\",\"cwd\":\"%s\",\"dictionary_file\":\"%s\",\"send_prompt\":%s,\"bias_decoding\":%s,\"bias_first_logit\":%.6f,\"bias_continuation_logit\":%.6f,\"logits_log_path\":\"%s\",\"logits_log_enabled\":%s,\"partial_model\":\"%s\",\"model_load_ms\":%.1f,\"partial_model_load_ms\":%.1f,\"vad_init_ms\":%.1f,\"warmup_ms\":%.1f,\"startup_ms\":%.1f,\"encoder\":\"%s\",\"vad_gpu\":%s,\"vad_background\":%s}\n",
            escape_json(cwd).c_str(),
            escape_json(params.dictionary_path).c_str(),
            params.send_prompt ? "true" : "false",
@@ -934,59 +2166,85 @@ int main(int argc, char **argv) {
            params.bias_first_logit,
            params.bias_continuation_logit,
            escape_json(logits_log_path).c_str(),
-           logits_writer.enabled ? "true" : "false");
-    fflush(stdout);
-
-    std::deque<float> pending_samples;
-    std::deque<float> pre_roll;
-    std::vector<float> chunk_buffer;
-    std::vector<float> current_segment;
-    std::vector<float> full_job_audio;
-    double segment_prob_sum = 0.0;
-    int segment_prob_count = 0;
-    bool in_segment = false;
-    int64_t segment_start_sample = 0;
-    int64_t last_voice_sample = 0;
-    int64_t processed_samples_total = 0;
-    int64_t last_fetch_time_ms = 0;
-    int segment_index = 0;
-    int active_segment_index = -1;
-    int partial_sequence = 0;
-    int64_t last_partial_emit_sample = 0;
+           logits_writer.enabled() ? "true" : "false",
+           escape_json(partial_ctx ? params.partial_model : std::string()).c_str(),
+           model_load_ms,
+           partial_model_load_ms,
+           vad_init_ms,
+           warmup_ms,
+           ms_since(t_process_start),
+           coreml_encoder ? "coreml" : "ggml",
+           vad_use_gpu ? "true" : "false",
+           params.vad_background ? "true" : "false"));
+
+    // Everything but --server runs a single stream; the session it decodes on takes the VAD loaded above.
+    auto default_session = std::make_shared<stream_session>();
+    default_session->vad = std::move(vad);
+    const int64_t partial_window_samples = (int64_t)params.partial_window_ms * sample_rate / 1000;
+
+    // whisper_full runs on decode workers so VAD and endpointing never wait on a decode.
+    constexpr size_t kDecodeQueueCapacity = 8;
+    DecodeQueue decode_queue(kDecodeQueueCapacity * (use_server ? (size_t)n_decode_workers : 1), use_server);
+    // With --partial-model, partials go here instead and are decoded on partial_ctx.
+    DecodeQueue partial_queue(kDecodeQueueCapacity);
+    OrderedOutput ordered_output;
+
+    // Waits for the stream's decodes, so the whole session can be reset in place.
+    auto reset_segment_state = [&](stream_session &ss) {
+        decode_queue.wait_idle();
+        partial_queue.wait_idle();
+        ss.timeline.clear();
+        ss.held_audio_peak_bytes = ss.timeline.resident_bytes();
+        ss.pre_roll_floor = 0;
+        ss.segment_prob_sum = 0.0;
+        ss.segment_prob_count = 0;
+        ss.in_segment = false;
+        ss.segment_start_sample = 0;
+        ss.last_voice_sample = 0;
+        ss.processed_samples_total = 0;
+        ss.segment_index = 0;
+        ss.active_segment_index = -1;
+        ss.partial_sequence = 0;
+        ss.last_partial_emit_sample = 0;
+        ss.incremental_state.reset(-1, 0);
+        ss.mel.clear();
+        ss.mel_segment = -1;
+        ss.speculation_id = 0;
+        ss.speculation_end_sample = 0;
+        ss.full_pass_chunks.clear();
+        ss.full_pass_chunk_start = 0;
+        ss.full_pass_speech_end = 0;
+        ss.full_pass_results.clear();
+        ss.spill.reset();
+        std::lock_guard<std::mutex> lock(ss.delta_mu);
+        ss.delta_base.clear();
+    };
 
-    const int fetch_window_ms = std::min<int>(params.ring_buffer_ms, params.max_segment_ms + params.post_padding_ms + 2000);
-
-    auto reset_segment_state = [&]() {
-        pending_samples.clear();
-        pre_roll.clear();
-        chunk_buffer.clear();
-        current_segment.clear();
-        full_job_audio.clear();
-        segment_prob_sum = 0.0;
-        segment_prob_count = 0;
-        in_segment = false;
-        segment_start_sample = 0;
-        last_voice_sample = 0;
-        processed_samples_total = 0;
-        last_fetch_time_ms = 0;
-        segment_index = 0;
-        active_segment_index = -1;
-        partial_sequence = 0;
-        last_partial_emit_sample = 0;
+    // --server records carry the session they belong to.
+    auto session_json = [&](const stream_session &ss, const std::string &json_line) {
+        if (!use_server || json_line.size() < 2 || json_line[0] != '{') {
+            return json_line;
+        }
+        return "{\"session\":" + std::to_string(ss.id) + "," + json_line.substr(1);
+    };
+    auto emit_session_event = [&](const stream_session &ss, const std::string &json_line) {
+        emit_event(session_json(ss, json_line));
     };
 
-    std::string dictionary_cache;
-    std::vector<std::vector<whisper_token>> dictionary_token_seqs;
-    std::vector<std::string> dictionary_entry_texts;
-    std::vector<whisper_token> dictionary_first_tokens;
-    std::unordered_set<int> dictionary_first_token_ids;
-    auto last_dictionary_reload = std::chrono::steady_clock::time_point::min();
-    auto last_dictionary_write_time = std::filesystem::file_time_type::min();
-    int last_dictionary_entries_raw = 0;
-    int last_dictionary_total_tokens = 0;
-	std::string last_dictionary_error;
-
-	auto emit_dictionary_event = [&](int segment_idx, int partial_seq, bool is_final, bool attempted, bool reloaded) {
+    // The dictionary is an immutable snapshot that reloads replace whole. A decode pins the snapshot it
+    // starts with, so a reload never waits for a decode and a decode never waits for tokenization.
+    std::shared_ptr<const dictionary_snapshot> dictionary = std::make_shared<dictionary_snapshot>();
+    // Tokenized variants keyed by entry text, carried across reloads so an edit only tokenizes the
+    // entries that are new. Guarded by dictionary_reload_mu, like the reload itself.
+    std::unordered_map<std::string, std::vector<std::vector<whisper_token>>> dictionary_token_cache;
+    std::mutex dictionary_reload_mu;
+    std::atomic<int64_t> last_dictionary_status_ms{std::numeric_limits<int64_t>::min() / 2};
+    // whisper keeps at most the last n_text_ctx/2 prompt tokens (one of which it spends itself), so
+    // anything beyond that would just be tokenized and thrown away.
+    // Recomputed when a model swap installs a new context.
+    size_t prompt_token_budget = (size_t) std::max(0, whisper_n_text_ctx(ctx) / 2 - 1);
+
+	auto emit_dictionary_event = [&](const dictionary_snapshot &dict, int segment_idx, int partial_seq, bool is_final, bool attempted, bool reloaded) {
 		std::ostringstream packet;
 		packet << "{\"event\":\"dictionary\""
                << ",\"dictionary_file\":\"" << escape_json(params.dictionary_path) << "\""
@@ -995,13 +2253,15 @@ int main(int argc, char **argv) {
                << ",\"final\":" << (is_final ? "true" : "false")
                << ",\"attempted\":" << (attempted ? "true" : "false")
                << ",\"reloaded\":" << (reloaded ? "true" : "false")
-               << ",\"ok\":" << (last_dictionary_error.empty() ? "true" : "false")
-               << ",\"error\":\"" << escape_json(last_dictionary_error) << "\""
-               << ",\"dict_entries_raw\":" << last_dictionary_entries_raw
-               << ",\"dict_entries\":" << (int) dictionary_token_seqs.size()
-               << ",\"dict_first_tokens\":" << (int) dictionary_first_tokens.size()
-			   << ",\"dict_total_tokens\":" << last_dictionary_total_tokens
-			   << ",\"dict_cache_bytes\":" << (int) dictionary_cache.size();
+               << ",\"ok\":" << (dict.error.empty() ? "true" : "false")
+               << ",\"error\":\"" << escape_json(dict.error) << "\""
+               << ",\"dict_entries_raw\":" << dict.entries_raw
+               << ",\"dict_entries\":" << (int) dict.token_seqs.size()
+               << ",\"dict_first_tokens\":" << (int) dict.first_tokens.size()
+			   << ",\"dict_total_tokens\":" << dict.total_tokens
+			   << ",\"prompt_entries\":" << (int) dict.prompt_entries.size()
+			   << ",\"prompt_tokens\":" << (int) dict.prompt_tokens.size()
+			   << ",\"dict_cache_bytes\":" << (int) dict.raw.size();
 
 		if (verbose_dictionary_packets) {
 			// Sample a few parsed & tokenized entries (proves the C++ actually has them).
@@ -1009,12 +2269,12 @@ int main(int argc, char **argv) {
 			packet << ",\"words\":[";
 			const int n_sample = std::min<int>(
 					kMaxWords,
-					std::min<int>((int) dictionary_entry_texts.size(), (int) dictionary_token_seqs.size()));
+					std::min<int>((int) dict.entry_texts.size(), (int) dict.token_seqs.size()));
 			for (int i = 0; i < n_sample; ++i) {
 				if (i) packet << ",";
-				packet << "{\"text\":\"" << escape_json(dictionary_entry_texts[i]) << "\"";
+				packet << "{\"text\":\"" << escape_json(dict.entry_texts[i]) << "\"";
 				packet << ",\"tokens\":[";
-				const auto &seq = dictionary_token_seqs[i];
+				const auto &seq = dict.token_seqs[i];
 				for (size_t j = 0; j < seq.size(); ++j) {
 					if (j) packet << ",";
 					const int tid = (int) seq[j];
@@ -1031,163 +2291,166 @@ int main(int argc, char **argv) {
 		const std::string line = packet.str() + "\n";
 
 		// stdout
-		fputs(line.c_str(), stdout);
-
-		// file
-		if (enable_dictionary_file && logits_writer.enabled) {
-			std::lock_guard<std::mutex> lock(logits_writer.mu);
-			logits_writer.file << line;
-			if (logits_writer.flush_ms >= 0) {
-				const auto now = std::chrono::steady_clock::now();
-                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - logits_writer.last_flush).count();
-                if (elapsed >= logits_writer.flush_ms) {
-                    logits_writer.file.flush();
-                    logits_writer.last_flush = now;
-                }
-            }
-        }
+		emit_event(line);
+
+		// file (queued; the writer thread does the I/O)
+		if (enable_dictionary_file) {
+			logits_writer.push(line, true, false);
+		}
     };
 
-	auto reload_dictionary_if_needed = [&](int segment_idx, int partial_seq, bool is_final, bool force) {
+	// Re-reads the dictionary file and publishes a new snapshot if its contents changed (always when
+	// forced). Runs at startup and on the watcher thread, never on the decode path.
+	auto reload_dictionary = [&](bool force) {
+        std::lock_guard<std::mutex> lock(dictionary_reload_mu);
+        const auto current = std::atomic_load(&dictionary);
+        auto next = std::make_shared<dictionary_snapshot>();
+
         if (params.dictionary_path.empty()) {
-            last_dictionary_error = "dictionary_file not set";
-            last_dictionary_entries_raw = 0;
-            last_dictionary_total_tokens = 0;
-            dictionary_cache.clear();
-            dictionary_token_seqs.clear();
-            dictionary_entry_texts.clear();
-            dictionary_first_tokens.clear();
-            dictionary_first_token_ids.clear();
-            emit_dictionary_event(segment_idx, partial_seq, is_final, true, true);
-            return;
+            next->error = "dictionary_file not set";
+        } else {
+            std::ifstream dict_file(params.dictionary_path);
+            if (!dict_file.good()) {
+                next->error = "failed to open dictionary_file";
+            } else {
+                std::ostringstream ss;
+                ss << dict_file.rdbuf();
+                next->raw = ss.str();
+            }
         }
-
-        const auto now = std::chrono::steady_clock::now();
-        const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_dictionary_reload).count();
-        const bool should_reload = force || elapsed_ms >= params.dictionary_poll_ms;
-        if (!should_reload) return;
-        last_dictionary_reload = now;
-
-        std::error_code ec;
-        auto mtime = std::filesystem::last_write_time(params.dictionary_path, ec);
-        if (ec) {
-            last_dictionary_error = ec.message();
-            last_dictionary_entries_raw = 0;
-            last_dictionary_total_tokens = 0;
-            dictionary_cache.clear();
-            dictionary_token_seqs.clear();
-            dictionary_entry_texts.clear();
-            dictionary_first_tokens.clear();
-            dictionary_first_token_ids.clear();
-            emit_dictionary_event(segment_idx, partial_seq, is_final, true, true);
+        if (!force && next->error == current->error && next->raw == current->raw) {
             return;
         }
 
-        const bool changed = (mtime != last_dictionary_write_time);
-        if (!force && !changed) {
-            // Still emit a status line occasionally, so the UI can show what the transcriber thinks it has.
-            emit_dictionary_event(segment_idx, partial_seq, is_final, true, false);
-            return;
-        }
+        std::unordered_map<std::string, std::vector<std::vector<whisper_token>>> next_cache;
+        size_t n_tokenized = 0;
+        const auto entries = split_dictionary_entries(next->raw);
+        next->entries_raw = (int) entries.size();
+        next->token_seqs.reserve(entries.size() * 2);
+        next->entry_texts.reserve(entries.size() * 2);
+        next_cache.reserve(entries.size() * 2 + 8);
 
-        std::ifstream dict_file(params.dictionary_path);
-        if (!dict_file.good()) {
-            last_dictionary_error = "failed to open dictionary_file";
-            last_dictionary_entries_raw = 0;
-            last_dictionary_total_tokens = 0;
-            dictionary_cache.clear();
-            dictionary_token_seqs.clear();
-            dictionary_entry_texts.clear();
-            dictionary_first_tokens.clear();
-            dictionary_first_token_ids.clear();
-            emit_dictionary_event(segment_idx, partial_seq, is_final, true, true);
-            return;
-        }
+        std::unordered_set<int> first_seen;
+        first_seen.reserve(entries.size() * 2 + 8);
+        std::vector<dictionary_snapshot::prompt_entry> prompt_candidates;
+        prompt_candidates.reserve(entries.size());
 
-        std::ostringstream ss;
-        ss << dict_file.rdbuf();
-        dictionary_cache = ss.str();
-        last_dictionary_write_time = mtime;
-
-        dictionary_token_seqs.clear();
-        dictionary_entry_texts.clear();
-        dictionary_first_tokens.clear();
-        dictionary_first_token_ids.clear();
-
-        const auto entries = split_dictionary_entries(dictionary_cache);
-        last_dictionary_entries_raw = (int) entries.size();
-        dictionary_token_seqs.reserve(entries.size());
-        dictionary_entry_texts.reserve(entries.size());
+        for (const auto &entry : entries) {
+            if (entry.empty()) continue;
 
-        std::unordered_set<int> first_seen;
-        first_seen.reserve(entries.size() * 2 + 8);
+            auto cached = dictionary_token_cache.find(entry);
+            std::vector<std::vector<whisper_token>> seqs;
+            if (cached != dictionary_token_cache.end()) {
+                seqs = std::move(cached->second);
+            } else {
+                // Tokenize both variants (with and without a leading space). Whisper sometimes
+                // produces either representation depending on context; supporting both makes
+                // continuation-bias much more reliable.
+                std::vector<std::string> variants;
+                variants.reserve(2);
+                variants.push_back(entry);
+                if (entry.front() != ' ') {
+                    variants.push_back(" " + entry);
+                }
 
-        int total_tokens = 0;
-        last_dictionary_error.clear();
+                for (const auto &text : variants) {
+                    const int n_needed = whisper_token_count(ctx, text.c_str());
+                    if (n_needed <= 0) continue;
 
-        for (const auto &entry : entries) {
-            if (entry.empty()) continue;
+                    std::vector<whisper_token> seq((size_t)n_needed);
+                    const int n_got = whisper_tokenize(ctx, text.c_str(), seq.data(), (int)seq.size());
+                    if (n_got <= 0) continue;
+                    seq.resize((size_t)n_got);
+                    seqs.push_back(std::move(seq));
+                }
+                ++n_tokenized;
+            }
 
-            // Tokenize both variants (with and without a leading space). Whisper sometimes produces
-            // either representation depending on context; supporting both makes continuation-bias
-            // much more reliable.
-            std::vector<std::string> variants;
-            variants.reserve(2);
-            variants.push_back(entry);
-            if (entry.front() != ' ') {
-                variants.push_back(" " + entry);
-            }
-
-            for (const auto &text : variants) {
-                const int n_needed = whisper_token_count(ctx, text.c_str());
-                if (n_needed <= 0) continue;
-
-                std::vector<whisper_token> seq((size_t)n_needed);
-                const int n_got = whisper_tokenize(ctx, text.c_str(), seq.data(), (int)seq.size());
-                if (n_got <= 0) continue;
-                seq.resize((size_t)n_got);
-                total_tokens += n_got;
-
-                if (!seq.empty()) {
-                    const int first = (int)seq.front();
-                    if (first_seen.insert(first).second) {
-                        dictionary_first_tokens.push_back(seq.front());
-                        dictionary_first_token_ids.insert(first);
-                    }
+            if (!seqs.empty()) {
+                // The prompt uses the leading-space variant (tokenized last) so entries join like words.
+                prompt_candidates.push_back({prompt_candidates.size(), seqs.back()});
+            }
+            for (const auto &seq : seqs) {
+                next->total_tokens += (int) seq.size();
+                const int first = (int)seq.front();
+                if (first_seen.insert(first).second) {
+                    next->first_tokens.push_back(seq.front());
+                    next->first_token_ids.insert(first);
                 }
-                dictionary_entry_texts.push_back(entry);
-                dictionary_token_seqs.push_back(std::move(seq));
+                next->entry_texts.push_back(entry);
+                next->token_seqs.push_back(seq);
             }
+            next_cache.emplace(entry, std::move(seqs));
+        }
+        next->trie.build(next->token_seqs);
+
+        if (!params.prompt_priority_head) {
+            std::reverse(prompt_candidates.begin(), prompt_candidates.end());
+        }
+        size_t prompt_used = 0;
+        for (auto &candidate : prompt_candidates) {
+            if (prompt_used + candidate.tokens.size() > prompt_token_budget) break;
+            prompt_used += candidate.tokens.size();
+            next->prompt_entries.push_back(std::move(candidate));
         }
+        next->prompt_tokens = next->prompt_within(prompt_token_budget);
 
-        last_dictionary_total_tokens = total_tokens;
+        // Entries that were removed from the file drop out of the cache here.
+        dictionary_token_cache = std::move(next_cache);
 
         if (params.debug) {
             fprintf(stderr,
-                    "dictionary reload: %zu raw entries, %zu tokenized entries, %zu unique first tokens, %d total tokens (send_prompt=%d bias_decoding=%d)\n",
+                    "dictionary reload: %zu raw entries (%zu tokenized, %zu cached), %zu tokenized entries, %zu unique first tokens, %d total tokens, %zu trie nodes, %zu/%zu prompt entries in %zu tokens (send_prompt=%d bias_decoding=%d)\n",
                     entries.size(),
-                    dictionary_token_seqs.size(),
-                    dictionary_first_tokens.size(),
-                    total_tokens,
+                    n_tokenized,
+                    entries.size() - n_tokenized,
+                    next->token_seqs.size(),
+                    next->first_tokens.size(),
+                    next->total_tokens,
+                    next->trie.nodes.size(),
+                    next->prompt_entries.size(),
+                    prompt_candidates.size(),
+                    next->prompt_tokens.size(),
                     params.send_prompt ? 1 : 0,
                     params.bias_decoding ? 1 : 0);
         }
 
-        emit_dictionary_event(segment_idx, partial_seq, is_final, true, true);
+        std::atomic_store(&dictionary, std::shared_ptr<const dictionary_snapshot>(next));
+        emit_dictionary_event(*next, -1, -1, false, true, true);
 	};
 
-	bool warned_beam_size_clamp = false;
-	auto emit_transcription = [&](const std::vector<float> &audio_segment,
-	                                  int segment_idx,
-	                                  int64_t segment_start_sample,
-	                                  bool is_final,
-	                                  double avg_prob_now,
-	                                  int partial_seq) {
-        if (audio_segment.empty()) {
-            return;
+	std::atomic<bool> warned_beam_size_clamp{false};
+#if defined(OPENFLOW_WHISPER_SET_SIGNAL)
+    const bool mel_cache_enabled = params.mel_cache && enable_partials;
+#else
+    const bool mel_cache_enabled = false; // whisper.cpp built without whispercpp-set-signal.patch
+#endif
+	// Runs whisper over samples[0, n_samples) and collects the non-control tokens with timestamps on
+	// the job timeline (start_sample is where samples[0] sits). context_tokens, when non-empty, are
+	// appended to the prompt so the decoder continues from text that was already committed. `wctx` is
+	// the context the calling worker decodes with and `state` its whisper_state, or nullptr for the
+	// context's own. mel_cache, when given, supplies the spectrogram (see mel_cache_for). A
+	// speculation ticket lets the capture thread abort the decode once speech resumes. The decode's
+	// timings go to ss's --metrics.
+	auto decode_pieces = [&](stream_session &ss,
+	                         whisper_context *wctx,
+	                         whisper_state *state,
+	                         const float *samples,
+	                         size_t n_samples,
+	                         int64_t start_sample,
+	                         int segment_idx,
+	                         bool is_final,
+	                         int partial_seq,
+	                         const std::vector<whisper_token> *context_tokens,
+	                         std::vector<Piece> &pieces,
+	                         LogMelCache *mel_cache = nullptr,
+	                         const speculation_ticket *speculation = nullptr) -> bool {
+        pieces.clear();
+        if (!samples || n_samples == 0) {
+            return false;
         }
 
-        std::string prompt_trimmed;
+        std::vector<whisper_token> prompt_tokens;
         whisper_full_params wparams = whisper_full_default_params(
                 params.bias_decoding ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
         wparams.print_progress = false;
@@ -1204,17 +2467,45 @@ int main(int argc, char **argv) {
         wparams.entropy_thold = 2.40f;
         wparams.logprob_thold = -1.0f;
         wparams.no_speech_thold = 0.0f;
+        if (params.audio_ctx > 0) {
+            wparams.audio_ctx = params.audio_ctx;
+        } else if (params.audio_ctx < 0) {
+            wparams.audio_ctx = auto_audio_ctx(n_samples, whisper_n_audio_ctx(wctx));
+        }
+        if (speculation) {
+            wparams.abort_callback = speculation_cancelled;
+            wparams.abort_callback_user_data = const_cast<speculation_ticket *>(speculation);
+        }
 
-        reload_dictionary_if_needed(segment_idx, partial_seq, is_final, false);
+        const auto dict = std::atomic_load(&dictionary);
+        {
+            // Still emit a status line occasionally, so the UI can show what the transcriber thinks it has.
+            const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t last_ms = last_dictionary_status_ms.load(std::memory_order_relaxed);
+            if (now_ms - last_ms >= params.dictionary_poll_ms &&
+                last_dictionary_status_ms.compare_exchange_strong(last_ms, now_ms, std::memory_order_relaxed)) {
+                emit_dictionary_event(*dict, segment_idx, partial_seq, is_final, false, false);
+            }
+        }
 
-        if (params.send_prompt && !dictionary_cache.empty()) {
-            prompt_trimmed = dictionary_cache;
-            if (prompt_trimmed.size() > 4096) {
-                prompt_trimmed.resize(4096);
+        // Dictionary prompt tokens come pre-tokenized and budgeted with the snapshot; `dict` stays
+        // pinned for the whole decode, so pointing wparams straight at them is safe.
+        wparams.initial_prompt = nullptr;
+        if (context_tokens && !context_tokens->empty()) {
+            // The committed context goes last because whisper keeps the tail of the prompt; the
+            // dictionary gets whatever budget the context leaves.
+            if (params.send_prompt) {
+                const size_t left = prompt_token_budget > context_tokens->size()
+                        ? prompt_token_budget - context_tokens->size() : 0;
+                prompt_tokens = dict->prompt_within(left);
             }
-            wparams.initial_prompt = prompt_trimmed.c_str();
-        } else {
-            wparams.initial_prompt = nullptr;
+            prompt_tokens.insert(prompt_tokens.end(), context_tokens->begin(), context_tokens->end());
+            wparams.prompt_tokens = prompt_tokens.data();
+            wparams.prompt_n_tokens = (int)prompt_tokens.size();
+        } else if (params.send_prompt && !dict->prompt_tokens.empty()) {
+            wparams.prompt_tokens = dict->prompt_tokens.data();
+            wparams.prompt_n_tokens = (int)dict->prompt_tokens.size();
         }
 
 		bias_decode_context bctx;
@@ -1224,125 +2515,620 @@ int main(int argc, char **argv) {
 			//   "too many decoders requested (...), max = 8"
 			constexpr int kWhisperMaxDecoders = 8;
 
+			bctx.config = &bias_config;
 			bctx.segment_index = segment_idx;
 			bctx.partial_seq = partial_seq;
 			bctx.is_final = is_final;
-			if (!dictionary_token_seqs.empty()) {
-                bctx.dict_token_seqs = &dictionary_token_seqs;
-            }
-            if (!dictionary_first_tokens.empty()) {
-                bctx.dict_first_tokens = &dictionary_first_tokens;
-            }
-            if (!dictionary_first_token_ids.empty()) {
-                bctx.dict_first_token_ids = &dictionary_first_token_ids;
-            }
-            bctx.dict_entries = last_dictionary_entries_raw;
-            bctx.dict_first_tokens_total = (int) dictionary_first_tokens.size();
-            bctx.enabled = true;
-            bctx.bias_first_logit = params.bias_first_logit;
-            bctx.bias_continuation_logit = params.bias_continuation_logit;
-			bctx.logits_top_k = params.logits_top_k;
-			bctx.logits_prob_threshold = params.logits_prob_threshold;
-			bctx.logits_prefix_text = params.logits_prefix_text;
-			bctx.logits_boosted_k = params.logits_boosted_k;
-			bctx.writer = logits_writer.enabled ? &logits_writer : nullptr;
-			bctx.emit_stdout_packets = log_stdout_packets;
-
-			wparams.logits_filter_callback = whisper_logits_filter_cb;
+			if (!dict->token_seqs.empty()) {
+                bctx.dict_trie = &dict->trie;
+            }
+            if (!dict->first_tokens.empty()) {
+                bctx.dict_first_tokens = &dict->first_tokens;
+            }
+            if (!dict->first_token_ids.empty()) {
+                bctx.dict_first_token_ids = &dict->first_token_ids;
+            }
+            bctx.dict_entries = dict->entries_raw;
+            bctx.dict_first_tokens_total = (int) dict->first_tokens.size();
+
+			wparams.logits_filter_callback = logits_filter_cb;
 			wparams.logits_filter_callback_user_data = &bctx;
 			const int requested_beam = params.beam_size > 0 ? params.beam_size : wparams.beam_search.beam_size;
 			const int clamped_beam = std::clamp(requested_beam, 2, kWhisperMaxDecoders);
-			if (requested_beam != clamped_beam && !warned_beam_size_clamp) {
+			if (requested_beam != clamped_beam && !warned_beam_size_clamp.exchange(true)) {
 				fprintf(stderr, "warning: clamping --beam-size %d to %d (whisper max decoders)\n",
 				        requested_beam, clamped_beam);
-				warned_beam_size_clamp = true;
 			}
 			wparams.beam_search.beam_size = clamped_beam;
 		}
 
-        if (whisper_full(ctx, wparams, audio_segment.data(), audio_segment.size()) != 0) {
-            fprintf(stderr, "whisper_full failed on segment %d (final=%d)\n", segment_idx, is_final ? 1 : 0);
+        if (params.metrics && !state) {
+            whisper_reset_timings(wctx);
+        }
+        const auto t_decode = std::chrono::steady_clock::now();
+        // With a cached spectrogram whisper decodes the mel that was set (n_samples = 0); duration_ms
+        // keeps it from seeking into the 30 s of padding, and the signal feeds token timestamps.
+        const float *pcm = samples;
+        int n_pcm = (int)n_samples;
+#if defined(OPENFLOW_WHISPER_SET_SIGNAL)
+        if (mel_cache) {
+            const int n_mel = whisper_model_n_mels(wctx);
+            int n_frames_audio = 0;
+            const int n_len = mel_cache->compute(samples, n_samples, start_sample, n_mel, n_frames_audio);
+            const bool set = n_len > 0 &&
+                (state ? whisper_set_mel_with_state(wctx, state, mel_cache->data(), n_len, n_mel)
+                       : whisper_set_mel(wctx, mel_cache->data(), n_len, n_mel)) == 0 &&
+                (state ? whisper_set_signal_with_state(wctx, state, samples, (int)n_samples)
+                       : whisper_set_signal(wctx, samples, (int)n_samples)) == 0;
+            if (set) {
+                pcm = nullptr;
+                n_pcm = 0;
+                wparams.duration_ms = n_frames_audio * 10;
+            }
+        }
+#else
+        (void) mel_cache;
+#endif
+        const int rc = state
+            ? whisper_full_with_state(wctx, state, wparams, pcm, n_pcm)
+            : whisper_full(wctx, wparams, pcm, n_pcm);
+        if (rc != 0) {
+            if (!speculation || !speculation_cancelled(const_cast<speculation_ticket *>(speculation))) {
+                fprintf(stderr, "whisper_full failed on segment %d (final=%d)\n", segment_idx, is_final ? 1 : 0);
+            }
+            return false;
+        }
+        const double decode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_decode).count();
+        const double audio_ms = (double)n_samples * 1000.0 / sample_rate;
+        if (!is_final) {
+            partial_cadence.observe(decode_ms, audio_ms);
+        }
+        if (params.metrics) {
+            // Encoder timings live on the context's own state only, and whisper_get_timings reports
+            // per-run averages; one whisper_full of <= 30 s runs the encoder once.
+            double encode_ms = -1.0;
+            if (!state) {
+                if (whisper_timings *timings = whisper_get_timings(wctx)) {
+                    encode_ms = timings->encode_ms;
+                    delete timings;
+                }
+            }
+            ss.metrics->add_decode(decode_ms, audio_ms, encode_ms);
+        }
+
+        // What whisper allocated is the decode's; --metrics' emit_allocs counts from here on.
+        t_emit_alloc_mark = thread_allocations();
+        collect_pieces(wctx, state, (start_sample * 1000LL) / sample_rate, pieces);
+        return true;
+    };
+
+    // stable_tokens counts the leading tokens that later partials of this segment will not revise.
+    // The record is appended to `out` whole so a single fwrite can't interleave with vad events from
+    // the capture thread or with another worker's output. `out` is the worker's reusable record
+    // buffer; with enough capacity, formatting allocates nothing.
+    //
+    // Binary segment frames ('S' full, 'D' delta) carry, little-endian:
+    //   i32 segment_index, i64 start_ms, i64 end_ms, f32 avg_vad, u8 final, i32 partial_seq,
+    //   u32 stable_tokens, ['D' only: u32 keep], u32 n_tokens,
+    //   n_tokens x { i32 t0_ms, i32 t1_ms, u8 leading_space, u16 text_len, text bytes }
+    // A 'D' frame's tokens are the first `keep` tokens of the previous record for the same
+    // segment_index followed by the ones listed. That base is forgotten after the segment's final
+    // and at every job_start. The segment text is the concatenation of the token texts.
+    auto format_segment = [&](stream_session &ss,
+                              int segment_idx,
+                              int64_t segment_start_sample,
+                              size_t n_samples,
+                              bool is_final,
+                              double avg_prob_now,
+                              int partial_seq,
+                              piece_seq pieces,
+                              size_t stable_tokens,
+                              std::string &out) {
+        const int64_t segment_start_ms = (segment_start_sample * 1000LL) / sample_rate;
+        const int64_t segment_end_ms = segment_start_ms + ((int64_t)n_samples * 1000LL) / sample_rate;
+        const int64_t duration_ms = std::max<int64_t>(0, segment_end_ms - segment_start_ms);
+
+        if (params.stdout_format != output_format::json) {
+            const bool delta = params.stdout_format == output_format::binary_delta;
+            size_t keep = 0;
+            if (delta) {
+                std::lock_guard<std::mutex> lock(ss.delta_mu);
+                auto &prev = ss.delta_base[segment_idx];
+                while (keep < prev.size() && keep < pieces.size() &&
+                       prev[keep].text == pieces[keep].text &&
+                       prev[keep].t0_ms == pieces[keep].t0_ms &&
+                       prev[keep].t1_ms == pieces[keep].t1_ms &&
+                       prev[keep].leading_space == pieces[keep].leading_space) {
+                    ++keep;
+                }
+                if (is_final) {
+                    ss.delta_base.erase(segment_idx);
+                } else {
+                    // Element-wise so the base keeps its vector and string capacity.
+                    prev.resize(pieces.size());
+                    for (size_t i = keep; i < pieces.size(); ++i) {
+                        prev[i] = pieces[i];
+                    }
+                }
+            }
+
+            const size_t at = begin_frame(out, delta ? 'D' : 'S');
+            append_le<int32_t>(out, segment_idx);
+            append_le<int64_t>(out, segment_start_ms);
+            append_le<int64_t>(out, segment_end_ms);
+            append_le<float>(out, (float)avg_prob_now);
+            out.push_back(is_final ? 1 : 0);
+            append_le<int32_t>(out, partial_seq);
+            append_le<uint32_t>(out, (uint32_t)stable_tokens);
+            if (delta) {
+                append_le<uint32_t>(out, (uint32_t)keep);
+            }
+            append_le<uint32_t>(out, (uint32_t)(pieces.size() - keep));
+            for (size_t i = keep; i < pieces.size(); ++i) {
+                const auto &p = pieces[i];
+                const uint16_t len = (uint16_t)std::min<size_t>(p.text.size(), UINT16_MAX);
+                append_le<int32_t>(out, (int32_t)p.t0_ms);
+                append_le<int32_t>(out, (int32_t)p.t1_ms);
+                out.push_back(p.leading_space ? 1 : 0);
+                append_le<uint16_t>(out, len);
+                out.append(p.text, 0, len);
+            }
+            end_frame(out, at);
             return;
         }
 
-        struct Piece {
-            std::string text;
-            int64_t t0_ms;
-            int64_t t1_ms;
-            bool leading_space;
-        };
+        char buf[512];
+        int n = 0;
+        if (use_server) {
+            // Same shape session_json() gives every other --server record.
+            n = snprintf(buf, sizeof(buf), "{\"session\":%d,", ss.id);
+        } else {
+            buf[n++] = '{';
+        }
+        n += snprintf(buf + n, sizeof(buf) - (size_t)n,
+                      "\"event\":\"segment\",\"segment_index\":%d,\"start_ms\":%lld,\"end_ms\":%lld,\"duration_ms\":%lld,\"avg_vad\":%.6f,\"final\":%s,\"partial_seq\":%d,\"stable_tokens\":%zu,\"text\":\"",
+                      segment_idx,
+                      (long long)segment_start_ms,
+                      (long long)segment_end_ms,
+                      (long long)duration_ms,
+                      avg_prob_now,
+                      is_final ? "true" : "false",
+                      partial_seq,
+                      stable_tokens);
+        out.append(buf, (size_t)n);
+        // The segment text is the token texts back to back, so it is escaped straight from them.
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            append_json_escaped(out, pieces[i].text);
+        }
+        out += "\",\"tokens\":";
+        append_tokens_json(out, pieces);
+        out += "}\n";
+    };
 
+    // A session's log-mel cache belongs to whichever worker decodes its partials, one job at a time
+    // (see emit_incremental_partial). Each segment starts a fresh cache. A final borrows it only when
+    // partials of the same segment already cover its start, and never while a --partial-model worker
+    // owns the partials.
+    auto mel_cache_for = [&](stream_session &ss, int segment_idx, int64_t start_sample, bool is_final) -> LogMelCache * {
+        if (!mel_cache_enabled || (is_final && partial_ctx)) {
+            return nullptr;
+        }
+        if (is_final) {
+            return ss.mel_segment == segment_idx && ss.mel.covers(start_sample) ? &ss.mel : nullptr;
+        }
+        if (ss.mel_segment != segment_idx) {
+            ss.mel.clear();
+            ss.mel_segment = segment_idx;
+        }
+        return &ss.mel;
+    };
+
+    // A final that names a speculation (see speculative_final) waits for it if it's being decoded and
+    // takes its pieces when it finished; otherwise the final decodes its own audio.
+    auto take_speculation = [&](stream_session &ss, uint64_t id, std::vector<Piece> &pieces) -> bool {
+        auto &sf = ss.speculation;
+        std::unique_lock<std::mutex> lock(sf.mu);
+        sf.cv.wait(lock, [&] { return sf.running != id; });
+        if (sf.done == id) {
+            pieces = std::move(sf.pieces);
+            sf.done = 0;
+            ss.metrics->count_speculative_hit();
+            return true;
+        }
+        sf.claimed = std::max(sf.claimed, id);
+        return false;
+    };
+
+    // Speculative job: decodes the segment as a final into the session's slot, unless speech resumed
+    // or the final gave up on it first.
+    auto run_speculation = [&](stream_session &ss, whisper_context *wctx, whisper_state *state, const decode_job &job) {
+        auto &sf = ss.speculation;
+        {
+            std::lock_guard<std::mutex> lock(sf.mu);
+            if (sf.stale(job.speculation_id)) {
+                return;
+            }
+            sf.running = job.speculation_id;
+        }
+        const speculation_ticket ticket{&sf, job.speculation_id};
         std::vector<Piece> pieces;
-        std::string full_text;
+        const bool ok = decode_pieces(ss, wctx, state, job.samples(), job.n_samples(), job.start_sample,
+                                      job.segment_index, true, job.partial_seq, nullptr, pieces,
+                                      mel_cache_for(ss, job.segment_index, job.start_sample, true), &ticket);
+        {
+            std::lock_guard<std::mutex> lock(sf.mu);
+            sf.running = 0;
+            if (ok && !sf.stale(job.speculation_id)) {
+                sf.done = job.speculation_id;
+                sf.pieces = std::move(pieces);
+            }
+        }
+        sf.cv.notify_all();
+    };
 
-        const int64_t segment_start_ms = (segment_start_sample * 1000LL) / sample_rate;
-        const int64_t segment_end_ms = segment_start_ms + ((int64_t)audio_segment.size() * 1000LL) / sample_rate;
-        const int64_t duration_ms = std::max<int64_t>(0, segment_end_ms - segment_start_ms);
+    // --stream-final-full-pass chunk (see enqueue_full_pass_chunk). The chunk's earlier decode is
+    // reused when it covered the same audio with the same dictionary and the same context, the
+    // previous chunk's last tokens; otherwise the chunk is decoded again with that context. Chunks of
+    // a session decode in order on one worker at a time, like incremental partials, so a chunk whose
+    // text changes on 'E' invalidates every later chunk through their context.
+    auto emit_full_pass_chunk = [&](stream_session &ss, whisper_context *wctx, whisper_state *state, const decode_job &job,
+                                    std::string &out) {
+        constexpr size_t kContextTokens = 64;
+
+        const size_t chunk = (size_t)job.full_pass_chunk;
+        auto &results = ss.full_pass_results;
+        if (results.size() <= chunk) {
+            results.resize(chunk + 1);
+        }
+        const int64_t end_sample = job.start_sample + (int64_t)job.n_samples();
+        const auto dict = std::atomic_load(&dictionary);
+        std::vector<whisper_token> context;
+        if (chunk > 0) {
+            const auto &prev = results[chunk - 1].pieces;
+            for (size_t i = prev.size() - std::min(prev.size(), kContextTokens); i < prev.size(); ++i) {
+                context.push_back(prev[i].id);
+            }
+        }
+        const uint64_t context_hash = hash_tokens(context);
+        full_pass_result &r = results[chunk];
+        const bool reuse = r.dict && r.start_sample == job.start_sample && r.end_sample == end_sample &&
+            r.context_hash == context_hash && (r.dict == dict || r.dict->raw == dict->raw);
+        if (params.debug && job.is_final) {
+            fprintf(stderr, "full pass chunk %zu: %s\n", chunk, reuse ? "reusing earlier decode" : "decoding");
+        }
+        if (!reuse) {
+            std::vector<float> spilled;
+            const float *samples = job.samples();
+            if (job.spill) {
+                if (!job.spill->read(job.start_sample, job.n_spilled, spilled)) {
+                    r = full_pass_result{};
+                    return;
+                }
+                samples = spilled.data();
+            }
+            std::vector<Piece> pieces;
+            if (!decode_pieces(ss, wctx, state, samples, job.n_samples(), job.start_sample,
+                               (int)chunk, true, 0, &context, pieces)) {
+                r = full_pass_result{};
+                return;
+            }
+            r.start_sample = job.start_sample;
+            r.end_sample = end_sample;
+            r.dict = dict;
+            r.context_hash = context_hash;
+            r.pieces = std::move(pieces);
+        }
+        if (!job.is_final) {
+            return;
+        }
+        format_segment(ss, (int)chunk, job.start_sample, job.n_samples(), true, job.avg_prob, 0,
+                       r.pieces, r.pieces.size(), out);
+    };
 
-        const int n_segments = whisper_full_n_segments(ctx);
-        for (int s = 0; s < n_segments; ++s) {
-            const int n_tok = whisper_full_n_tokens(ctx, s);
-            for (int i = 0; i < n_tok; ++i) {
-                auto td = whisper_full_get_token_data(ctx, s, i);
-                const char *pc = whisper_token_to_str(ctx, td.id);
-                if (!pc) continue;
-                std::string piece = pc;
-                if (is_control_piece(piece)) continue;
+	// Appends the segment record to write to `out`; nothing when there is nothing to emit.
+	auto emit_transcription = [&](stream_session &ss,
+	                                  whisper_context *wctx,
+	                                  whisper_state *state,
+	                                  const float *samples,
+	                                  size_t n_samples,
+	                                  int segment_idx,
+	                                  int64_t segment_start_sample,
+	                                  bool is_final,
+	                                  double avg_prob_now,
+	                                  int partial_seq,
+	                                  uint64_t speculation_id,
+	                                  std::string &out) {
+        if (n_samples == 0) {
+            return;
+        }
+        // With --partial-model the partial worker owns incremental_state; it resets it itself when
+        // the next segment starts.
+        if (is_final && !partial_ctx && ss.incremental_state.segment_index == segment_idx) {
+            ss.incremental_state.reset(-1, 0);
+        }
 
-                bool leading = (!piece.empty() && std::isspace(static_cast<unsigned char>(piece[0])));
-                int64_t t0 = td.t0 >= 0 ? segment_start_ms + (int64_t)td.t0 * 10 : -1;
-                int64_t t1 = td.t1 >= 0 ? segment_start_ms + (int64_t)td.t1 * 10 : -1;
+        // Per-worker scratch: keeps its capacity from one decode to the next.
+        thread_local std::vector<Piece> pieces;
+        const bool ok = (speculation_id && take_speculation(ss, speculation_id, pieces)) ||
+            decode_pieces(ss, wctx, state, samples, n_samples, segment_start_sample,
+                          segment_idx, is_final, partial_seq, nullptr, pieces,
+                          mel_cache_for(ss, segment_idx, segment_start_sample, is_final));
+        if (is_final && partial_ctx) {
+            // Partials of this segment race on the other worker; settle them before the final is
+            // formatted so none is written after it (or against a stale delta base).
+            partial_queue.retire_segment(ss.id, segment_idx);
+        }
+        if (!ok) {
+            return;
+        }
+        format_segment(ss, segment_idx, segment_start_sample, n_samples, is_final, avg_prob_now,
+                       partial_seq, pieces, is_final ? pieces.size() : 0, out);
+    };
+
+    // Partial for --incremental-partials: only the audio after the committed prefix is decoded, so
+    // the cost stays flat as the segment grows. The final still decodes the whole segment. Partials
+    // of a session only ever run one at a time (a single decode worker, the --partial-model worker, or
+    // --server session affinity), so the session's incremental_state needs no lock.
+    auto emit_incremental_partial = [&](stream_session &ss,
+                                        whisper_context *wctx,
+                                        whisper_state *state,
+                                        const float *samples,
+                                        size_t n_samples,
+                                        int segment_idx,
+                                        int64_t segment_start_sample,
+                                        double avg_prob_now,
+                                        int partial_seq,
+                                        std::string &out) {
+        constexpr size_t kContextTokens = 64;
+
+        auto &st = ss.incremental_state;
+        if (st.segment_index != segment_idx || st.segment_start_sample != segment_start_sample) {
+            st.reset(segment_idx, segment_start_sample);
+        }
+
+        const int64_t segment_end_sample = segment_start_sample + (int64_t)n_samples;
+        int64_t window_begin = std::clamp(st.committed_end_sample, segment_start_sample, segment_end_sample);
+        LogMelCache *mel_cache = mel_cache_for(ss, segment_idx, segment_start_sample, false);
+        if (mel_cache) {
+            // Back to the segment's 10 ms hop grid so the window keeps sharing mel frames.
+            window_begin -= (window_begin - segment_start_sample) % LogMelCache::kHop;
+        }
+        if (segment_end_sample - window_begin < (int64_t)vad_chunk_samples) {
+            return;
+        }
+
+        // Per-worker scratch: keeps its capacity from one partial to the next.
+        thread_local std::vector<whisper_token> context;
+        thread_local std::vector<Piece> hyp;
+        context.clear();
+        const size_t n_context = std::min(st.committed.size(), kContextTokens);
+        for (size_t i = st.committed.size() - n_context; i < st.committed.size(); ++i) {
+            context.push_back(st.committed[i].id);
+        }
+
+        if (!decode_pieces(ss,
+                           wctx,
+                           state,
+                           samples + (window_begin - segment_start_sample),
+                           (size_t)(segment_end_sample - window_begin),
+                           window_begin, segment_idx, false, partial_seq, &context, hyp, mel_cache)) {
+            return;
+        }
 
-                pieces.push_back({piece, t0, t1, leading});
-                full_text += piece;
+        const int64_t force_before_ms = ((segment_end_sample - partial_window_samples) * 1000LL) / sample_rate;
+        const size_t n_commit = incremental_commit_count(st.tail, hyp, force_before_ms);
+        if (n_commit > 0) {
+            int64_t boundary_ms = hyp[n_commit - 1].t1_ms;
+            if (hyp[n_commit].t0_ms >= 0) {
+                boundary_ms = std::min(boundary_ms, hyp[n_commit].t0_ms);
             }
+            st.committed_end_sample = std::clamp<int64_t>(boundary_ms * sample_rate / 1000, window_begin, segment_end_sample);
+            st.committed.insert(st.committed.end(), hyp.begin(), hyp.begin() + (std::ptrdiff_t)n_commit);
         }
+        st.tail.assign(std::make_move_iterator(hyp.begin() + (std::ptrdiff_t)n_commit),
+                       std::make_move_iterator(hyp.end()));
 
-        printf("{\"event\":\"segment\",\"segment_index\":%d,\"start_ms\":%lld,\"end_ms\":%lld,\"duration_ms\":%lld,\"avg_vad\":%.6f,\"final\":%s,\"partial_seq\":%d,\"text\":\"%s\",\"tokens\":[",
-               segment_idx,
-               (long long)segment_start_ms,
-               (long long)segment_end_ms,
-               (long long)duration_ms,
-               avg_prob_now,
-               is_final ? "true" : "false",
-               partial_seq,
-               escape_json(full_text).c_str());
+        format_segment(ss, segment_idx, segment_start_sample, n_samples, false, avg_prob_now,
+                       partial_seq, piece_seq(st.committed, st.tail), st.committed.size(), out);
+    };
 
-        for (size_t i = 0; i < pieces.size(); ++i) {
-            if (i) printf(",");
-            const auto &p = pieces[i];
-            printf("{\"text\":\"%s\",\"t0_ms\":%lld,\"t1_ms\":%lld,\"leading_space\":%s}",
-                   escape_json(p.text).c_str(),
-                   (long long)p.t0_ms,
-                   (long long)p.t1_ms,
-                   p.leading_space ? "true" : "false");
+    // Copies samples[0, n_samples) into the job unless `borrow` is set (see decode_job). A final may
+    // name the speculation it commits.
+    auto enqueue_decode = [&](stream_session &ss,
+                              const float *samples,
+                              size_t n_samples,
+                              int segment_idx,
+                              int64_t segment_start_sample,
+                              bool is_final,
+                              double avg_prob_now,
+                              int partial_seq,
+                              bool borrow = false,
+                              uint64_t speculation_id = 0) {
+        if (n_samples == 0) {
+            return;
+        }
+        decode_job job;
+        job.session = ss.shared_from_this();
+        job.segment_index = segment_idx;
+        job.start_sample = segment_start_sample;
+        job.is_final = is_final;
+        job.incremental = !is_final && params.incremental_partials;
+        job.avg_prob = avg_prob_now;
+        job.partial_seq = partial_seq;
+        job.queued_at = std::chrono::steady_clock::now();
+        if (is_final) {
+            job.speech_end_at = ss.last_voice_wall;
+            job.speculation_id = speculation_id;
+        }
+        if (n_decode_workers > 1 && !use_server) {
+            // Only finals are queued in this mode, so every ticket reaches a worker. --server keeps
+            // each session in order through the queue's session affinity instead.
+            job.output_ticket = ordered_output.take_ticket();
+        }
+        if (borrow) {
+            job.borrowed = samples;
+            job.n_borrowed = n_samples;
+        } else {
+            job.audio.assign(samples, samples + n_samples);
+        }
+        if (!is_final && partial_ctx) {
+            partial_queue.push(std::move(job));
+        } else {
+            decode_queue.push(std::move(job));
+        }
+    };
+
+    // --stream-final-full-pass splits the held job at the silence after kept segments into chunks of
+    // at most kFullPassChunkSamples, so no segment straddles a cut. A chunk is decoded as soon as it
+    // closes, which writes nothing (is_final false; the queue drops it only under back-pressure, after
+    // every plain partial). On 'E' every chunk is queued again as a final, and one whose earlier
+    // decode still applies is just written.
+    constexpr int64_t kFullPassChunkSamples = (int64_t)WHISPER_CHUNK_SIZE * WHISPER_SAMPLE_RATE;
+    auto enqueue_full_pass_chunk = [&](stream_session &ss, int chunk, int64_t start, int64_t end, bool is_final, bool borrow) {
+        decode_job job;
+        job.session = ss.shared_from_this();
+        job.segment_index = -1; // not a VAD segment; the queue tells chunks apart by full_pass_chunk
+        job.full_pass_chunk = chunk;
+        job.start_sample = start;
+        job.is_final = is_final;
+        job.queued_at = std::chrono::steady_clock::now();
+        if (is_final) {
+            job.speech_end_at = ss.last_voice_wall;
+        }
+        if (start < ss.timeline.begin()) {
+            job.spill = ss.spill;
+            job.n_spilled = (size_t)(end - start);
+        } else if (borrow) {
+            job.borrowed = ss.timeline.data(start);
+            job.n_borrowed = (size_t)(end - start);
+        } else {
+            job.audio.assign(ss.timeline.data(start), ss.timeline.data(end));
         }
+        decode_queue.push(std::move(job));
+    };
 
-        printf("]}\n");
-        fflush(stdout);
+    // --memory-budget-mb: once the held job is over budget, the closed chunks (already queued with
+    // their own copy) leave the timeline for the spill store. The open chunk stays float32 in RAM.
+    const size_t memory_budget_bytes = (size_t)params.memory_budget_mb << 20;
+    auto spill_closed_chunks = [&](stream_session &ss) {
+        const int64_t from = ss.timeline.begin();
+        const int64_t to = ss.full_pass_chunk_start;
+        if (memory_budget_bytes == 0 || to <= from ||
+            (size_t)(ss.timeline.end() - from) * sizeof(float) <= memory_budget_bytes) {
+            return;
+        }
+        if (!ss.spill) {
+            ss.spill = std::make_shared<PcmSpill>();
+        }
+        if (ss.spill->append(from, ss.timeline.data(from), (size_t)(to - from))) {
+            ss.timeline.release_before(to);
+        }
+    };
+
+    // --memory-budget-mb also caps a single PCM frame, which lands in the timeline whole. An
+    // oversized frame is reported to its session and dropped; the job and the process keep going.
+    auto frame_fits_budget = [&](const stream_session &ss, uint32_t n) {
+        if (memory_budget_bytes == 0 || (size_t)n * sizeof(float) <= memory_budget_bytes) {
+            return true;
+        }
+        fprintf(stderr, "error: %u-sample PCM frame exceeds --memory-budget-mb %d, dropped\n", n, params.memory_budget_mb);
+        emit_session_event(ss, string_printf("{\"event\":\"error\",\"error\":\"pcm frame exceeds --memory-budget-mb\",\"samples\":%u,\"memory_budget_mb\":%d}\n",
+                                             n, params.memory_budget_mb));
+        return false;
+    };
+    // Reads past a dropped frame's payload; false on EOF.
+    auto discard_stdin = [](size_t n) {
+        char scratch[16384];
+        while (n > 0) {
+            const size_t want = std::min(n, sizeof(scratch));
+            if (fread(scratch, 1, want, stdin) != want) {
+                return false;
+            }
+            n -= want;
+        }
+        return true;
+    };
+
+    // 'E' with --stream-final-full-pass. The open tail is only decoded when it holds a kept segment,
+    // or when it's the whole job, so trailing silence doesn't get a chunk of its own. `borrow` as for
+    // enqueue_decode.
+    auto finish_full_pass = [&](stream_session &ss, bool borrow) {
+        for (size_t c = 0; c < ss.full_pass_chunks.size(); ++c) {
+            enqueue_full_pass_chunk(ss, (int)c, ss.full_pass_chunks[c].first, ss.full_pass_chunks[c].second, true, borrow);
+        }
+        const int64_t tail_start = std::max(ss.full_pass_chunk_start, ss.timeline.begin());
+        if (ss.timeline.end() > tail_start && (ss.full_pass_chunks.empty() || ss.full_pass_speech_end > tail_start)) {
+            enqueue_full_pass_chunk(ss, (int)ss.full_pass_chunks.size(), tail_start, ss.timeline.end(), true, borrow);
+        }
+    };
+
+    // Speech resumed (or the segment ended another way): the open speculation won't be committed.
+    auto cancel_speculation = [&](stream_session &ss) {
+        if (ss.speculation_id != 0) {
+            ss.speculation.cancelled.store(ss.speculation_id, std::memory_order_relaxed);
+            ss.speculation_id = 0;
+        }
+    };
+
+    // Once the post-padding has arrived, queues the final the segment would get if the silence holds:
+    // the segment up to last_voice_sample + post-padding, the same samples that final keeps. It only
+    // gets ahead of endpointing while --min-silence-ms is still running past the post-padding.
+    auto speculate_final = [&](stream_session &ss) {
+        const int64_t wanted_end = ss.last_voice_sample + static_cast<int64_t>(post_padding_samples);
+        if (wanted_end - ss.segment_start_sample < static_cast<int64_t>(min_segment_samples)) {
+            return;
+        }
+        decode_job job;
+        job.session = ss.shared_from_this();
+        job.segment_index = ss.active_segment_index >= 0 ? ss.active_segment_index : ss.segment_index;
+        job.start_sample = ss.segment_start_sample;
+        job.is_final = true;
+        job.speculative = true;
+        job.speculation_id = ++ss.speculation_seq;
+        job.partial_seq = ss.partial_sequence;
+        job.queued_at = std::chrono::steady_clock::now();
+        job.audio.assign(ss.timeline.data(ss.segment_start_sample), ss.timeline.data(ss.segment_start_sample) + (wanted_end - ss.segment_start_sample));
+        ss.speculation_id = job.speculation_id;
+        ss.speculation_end_sample = wanted_end;
+        ss.metrics->count_speculation();
+        decode_queue.push(std::move(job));
     };
 
     // Emit an initial dictionary status line so the UI can confirm what the transcriber loaded,
     // even before the first decode happens.
-    reload_dictionary_if_needed(-1, -1, false, true);
-
-    auto flush_segment = [&](bool forced_flush, bool mark_final = true) {
-        if (!in_segment || current_segment.empty()) {
-            current_segment.clear();
-            segment_prob_sum = 0.0;
-            segment_prob_count = 0;
-            in_segment = false;
+    reload_dictionary(true);
+    std::unique_ptr<DictionaryFileWatcher> dictionary_watcher;
+    if (!params.dictionary_path.empty()) {
+        dictionary_watcher = std::make_unique<DictionaryFileWatcher>(params.dictionary_path, params.dictionary_poll_ms,
+                                                                     [&]() { reload_dictionary(false); });
+        dictionary_watcher->start();
+    }
+
+    auto flush_segment = [&](stream_session &ss, bool forced_flush, bool mark_final = true) {
+        // No voice since the speculation started, so it decoded this same final (checked against the
+        // kept audio below).
+        uint64_t speculation_id = !forced_flush && mark_final ? ss.speculation_id : 0;
+        if (speculation_id == 0) {
+            cancel_speculation(ss);
+        }
+        ss.speculation_id = 0;
+
+        const int64_t current_segment_samples = ss.processed_samples_total - ss.segment_start_sample;
+        if (!ss.in_segment || current_segment_samples <= 0) {
+            ss.segment_prob_sum = 0.0;
+            ss.segment_prob_count = 0;
+            ss.in_segment = false;
             return;
         }
 
-        size_t keep_samples = current_segment.size();
+        size_t keep_samples = static_cast<size_t>(current_segment_samples);
         if (!forced_flush) {
-            int64_t wanted_end_sample = last_voice_sample + static_cast<int64_t>(post_padding_samples);
-            if (wanted_end_sample < segment_start_sample) {
-                wanted_end_sample = segment_start_sample;
+            int64_t wanted_end_sample = ss.last_voice_sample + static_cast<int64_t>(post_padding_samples);
+            if (wanted_end_sample < ss.segment_start_sample) {
+                wanted_end_sample = ss.segment_start_sample;
             }
-            size_t desired = static_cast<size_t>(std::max<int64_t>(0, wanted_end_sample - segment_start_sample));
-            if (desired > current_segment.size()) desired = current_segment.size();
+            size_t desired = static_cast<size_t>(std::max<int64_t>(0, wanted_end_sample - ss.segment_start_sample));
+            if (desired > keep_samples) desired = keep_samples;
             keep_samples = desired;
         }
 
@@ -1350,176 +3136,515 @@ int main(int argc, char **argv) {
             if (params.debug) {
                 fprintf(stderr, "discarding short segment (%zu samples)\n", keep_samples);
             }
-            current_segment.clear();
-            segment_prob_sum = 0.0;
-            segment_prob_count = 0;
-            in_segment = false;
-            pre_roll.clear();
+            ss.segment_prob_sum = 0.0;
+            ss.segment_prob_count = 0;
+            ss.in_segment = false;
+            ss.pre_roll_floor = ss.processed_samples_total;
             return;
         }
 
-        std::vector<float> audio_segment(current_segment.begin(), current_segment.begin() + keep_samples);
-        std::vector<float> leftover;
-        if (keep_samples < current_segment.size()) {
-            leftover.assign(current_segment.begin() + static_cast<std::ptrdiff_t>(keep_samples), current_segment.end());
-        }
-
-        const double avg_prob = segment_prob_count > 0 ? (segment_prob_sum / segment_prob_count) : 0.0;
+        const double avg_prob = ss.segment_prob_count > 0 ? (ss.segment_prob_sum / ss.segment_prob_count) : 0.0;
 
-        emit_transcription(audio_segment,
-                           active_segment_index >= 0 ? active_segment_index : segment_index,
-                           segment_start_sample,
-                           mark_final,
-                           avg_prob,
-                           partial_sequence);
+        if (speculation_id != 0 && ss.segment_start_sample + static_cast<int64_t>(keep_samples) != ss.speculation_end_sample) {
+            ss.speculation.cancelled.store(speculation_id, std::memory_order_relaxed);
+            speculation_id = 0;
+        }
 
-        pre_roll.clear();
-        for (float sample : leftover) {
-            pre_roll.push_back(sample);
-            if (pre_roll.size() > pre_padding_samples) {
-                pre_roll.pop_front();
+        enqueue_decode(ss, ss.timeline.data(ss.segment_start_sample),
+                       keep_samples,
+                       ss.active_segment_index >= 0 ? ss.active_segment_index : ss.segment_index,
+                       ss.segment_start_sample,
+                       mark_final,
+                       avg_prob,
+                       ss.partial_sequence,
+                       false,
+                       speculation_id);
+
+        // Audio after the kept part stays available as pre-roll for the next segment.
+        ss.pre_roll_floor = ss.segment_start_sample + static_cast<int64_t>(keep_samples);
+
+        if (stream_full_pass_mode) {
+            // Close the chunk here unless one more segment of up to max length would still fit.
+            ss.full_pass_speech_end = ss.pre_roll_floor;
+            if (ss.pre_roll_floor - ss.full_pass_chunk_start + static_cast<int64_t>(max_segment_samples) > kFullPassChunkSamples) {
+                ss.full_pass_chunks.emplace_back(ss.full_pass_chunk_start, ss.pre_roll_floor);
+                enqueue_full_pass_chunk(ss, (int)ss.full_pass_chunks.size() - 1, ss.full_pass_chunk_start, ss.pre_roll_floor, false, false);
+                ss.full_pass_chunk_start = ss.pre_roll_floor;
+                spill_closed_chunks(ss);
             }
         }
 
-        current_segment.clear();
-        segment_prob_sum = 0.0;
-        segment_prob_count = 0;
-        in_segment = false;
-        partial_sequence = 0;
-        last_partial_emit_sample = 0;
-        active_segment_index = -1;
-        ++segment_index;
-        segment_start_sample = processed_samples_total;
-        last_voice_sample = processed_samples_total;
+        ss.segment_prob_sum = 0.0;
+        ss.segment_prob_count = 0;
+        ss.in_segment = false;
+        ss.partial_sequence = 0;
+        ss.last_partial_emit_sample = 0;
+        ss.active_segment_index = -1;
+        ++ss.segment_index;
+        ss.segment_start_sample = ss.processed_samples_total;
+        ss.last_voice_sample = ss.processed_samples_total;
     };
 
-    auto process_pending_chunks = [&]() {
-        while (pending_samples.size() >= vad_chunk_samples) {
-            auto it_end = pending_samples.begin();
-            std::advance(it_end, vad_chunk_samples);
-            chunk_buffer.assign(pending_samples.begin(), it_end);
-            pending_samples.erase(pending_samples.begin(), it_end);
+    // Endpointing step for the VAD chunk at the cursor, given its speech probability.
+    auto consume_vad_chunk = [&](stream_session &ss, float prob) {
+        const int64_t chunk_start_sample = ss.processed_samples_total;
+        ss.processed_samples_total += (int64_t) vad_chunk_samples;
+        int64_t chunk_end_ms = (ss.processed_samples_total * 1000LL) / sample_rate;
+
+        if (params.emit_vad_events) {
+            emit_session_event(ss, string_printf("{\"event\":\"vad\",\"audio_time_ms\":%lld,\"prob\":%.6f,\"vad_chunk_samples\":%zu,\"vad_sample_rate\":%d}\n",
+                                     (long long)chunk_end_ms,
+                                     prob,
+                                     vad_chunk_samples,
+                                     sample_rate));
+        }
 
-            float prob = 0.0f;
-            try {
-                prob = vad->infer(chunk_buffer.data(), chunk_buffer.size());
-            } catch (const std::exception &ex) {
-                fprintf(stderr, "VAD inference failed: %s\n", ex.what());
-                continue;
+        if (!ss.in_segment && prob >= params.start_threshold) {
+            if (params.debug) {
+                fprintf(stderr, "segment %d start at %lld ms (prob=%.3f)\n", ss.segment_index, (long long)chunk_end_ms, prob);
             }
+            ss.segment_start_sample = std::max<int64_t>(ss.pre_roll_floor, chunk_start_sample - static_cast<int64_t>(pre_padding_samples));
+            if (ss.segment_start_sample < 0) ss.segment_start_sample = 0;
+            ss.active_segment_index = ss.segment_index;
+            ss.partial_sequence = 0;
+            ss.last_partial_emit_sample = ss.segment_start_sample;
+
+            ss.last_voice_sample = ss.processed_samples_total;
+            ss.last_voice_wall = std::chrono::steady_clock::now();
+            ss.segment_prob_sum = prob;
+            ss.segment_prob_count = 1;
+            ss.in_segment = true;
+            return;
+        }
 
-            processed_samples_total += (int64_t) vad_chunk_samples;
-            int64_t chunk_end_ms = (processed_samples_total * 1000LL) / sample_rate;
+        if (ss.in_segment) {
+            ss.segment_prob_sum += prob;
+            ss.segment_prob_count += 1;
+            if (prob >= params.stop_threshold) {
+                ss.last_voice_sample = ss.processed_samples_total;
+                ss.last_voice_wall = std::chrono::steady_clock::now();
+                cancel_speculation(ss);
+            }
 
-            if (params.emit_vad_events) {
-                printf("{\"event\":\"vad\",\"audio_time_ms\":%lld,\"prob\":%.6f,\"vad_chunk_samples\":%zu,\"vad_sample_rate\":%d}\n",
-                       (long long)chunk_end_ms,
-                       prob,
-                       vad_chunk_samples,
-                       sample_rate);
+            const size_t current_segment_samples = static_cast<size_t>(ss.processed_samples_total - ss.segment_start_sample);
+            if (enable_partials && current_segment_samples >= min_segment_samples) {
+                const size_t backlog = partial_ctx ? partial_queue.backlog() : decode_queue.backlog();
+                const double interval_ms = partial_cadence.next_interval_ms(
+                        (double)current_segment_samples * 1000.0 / sample_rate, backlog);
+                const int64_t interval_samples = std::max<int64_t>(1, (int64_t)(interval_ms * sample_rate / 1000.0));
+                if (ss.processed_samples_total - ss.last_partial_emit_sample >= interval_samples) {
+                    // A partial that would land after the final is wasted decode time.
+                    const int64_t silence_so_far = ss.processed_samples_total - ss.last_voice_sample;
+                    const int64_t until_silence_flush = silence_so_far > 0
+                        ? static_cast<int64_t>(std::max(min_silence_samples, post_padding_samples)) - silence_so_far
+                        : std::numeric_limits<int64_t>::max();
+                    const int64_t until_max_flush = static_cast<int64_t>(max_segment_samples) - static_cast<int64_t>(current_segment_samples);
+                    if (std::min(until_silence_flush, until_max_flush) <= interval_samples) {
+                        partial_cadence.count_skipped();
+                    } else {
+                        const double avg_prob_now = ss.segment_prob_count > 0 ? (ss.segment_prob_sum / ss.segment_prob_count) : 0.0;
+                        enqueue_decode(ss, ss.timeline.data(ss.segment_start_sample),
+                                       current_segment_samples,
+                                       ss.active_segment_index >= 0 ? ss.active_segment_index : ss.segment_index,
+                                       ss.segment_start_sample,
+                                       false,
+                                       avg_prob_now,
+                                       ss.partial_sequence);
+                        partial_cadence.count_enqueued();
+                        ++ss.partial_sequence;
+                    }
+                    ss.last_partial_emit_sample = ss.processed_samples_total;
+                }
             }
 
-            if (!in_segment && prob >= params.start_threshold) {
+            int64_t segment_samples = ss.processed_samples_total - ss.segment_start_sample;
+            int64_t silence_samples = ss.processed_samples_total - ss.last_voice_sample;
+
+            bool over_max = segment_samples >= static_cast<int64_t>(max_segment_samples);
+            bool enough_silence = silence_samples >= static_cast<int64_t>(min_silence_samples);
+            bool has_post = silence_samples >= static_cast<int64_t>(post_padding_samples);
+
+            if (over_max) {
                 if (params.debug) {
-                    fprintf(stderr, "segment %d start at %lld ms (prob=%.3f)\n", segment_index, (long long)chunk_end_ms, prob);
+                    fprintf(stderr, "segment %d forced flush (max length)\n", ss.segment_index);
                 }
-                current_segment.assign(pre_roll.begin(), pre_roll.end());
-                segment_start_sample = processed_samples_total - static_cast<int64_t>(pre_roll.size()) - static_cast<int64_t>(vad_chunk_samples);
-                if (segment_start_sample < 0) segment_start_sample = 0;
-                active_segment_index = segment_index;
-                partial_sequence = 0;
-                last_partial_emit_sample = segment_start_sample;
-                current_segment.insert(current_segment.end(), chunk_buffer.begin(), chunk_buffer.end());
-                pre_roll.clear();
-
-                last_voice_sample = processed_samples_total;
-                segment_prob_sum = prob;
-                segment_prob_count = 1;
-                in_segment = true;
-                continue;
+                flush_segment(ss, true, !stream_full_pass_mode);
+            } else if (enough_silence && has_post) {
+                if (params.debug) {
+                    fprintf(stderr, "segment %d flush after silence (prob=%.3f)\n", ss.segment_index, prob);
+                }
+                flush_segment(ss, false, !stream_full_pass_mode);
+            } else if (speculative_finals && ss.speculation_id == 0 && silence_samples >= static_cast<int64_t>(vad_chunk_samples) &&
+                       ss.timeline.end() >= ss.last_voice_sample + static_cast<int64_t>(post_padding_samples)) {
+                if (params.debug) {
+                    fprintf(stderr, "segment %d speculative final once post-padding arrived (prob=%.3f)\n", ss.segment_index, prob);
+                }
+                speculate_final(ss);
             }
+        }
+    };
 
-            if (in_segment) {
-                current_segment.insert(current_segment.end(), chunk_buffer.begin(), chunk_buffer.end());
-                segment_prob_sum += prob;
-                segment_prob_count += 1;
-                if (prob >= params.stop_threshold) {
-                    last_voice_sample = processed_samples_total;
-                }
+    // File jobs already have all their audio, so VAD runs over up to --vad-batch windows per call and
+    // endpointing replays over the returned probabilities. Live input stays one window per call.
+    const size_t vad_batch_windows = file_job_input
+        ? static_cast<size_t>(params.vad_batch_windows)
+        : 1;
+
+    uint64_t capture_position = 0; // mic capture: next sample to read from the SDL ring
+    const int stats_ms = params.stats_ms > 0 ? params.stats_ms : (params.metrics ? 1000 : 0);
+    // force: emit now, whatever the interval (a job's end, once its decodes are done).
+    auto maybe_emit_stats = [&](stream_session &ss, bool force = false) {
+        if (stats_ms <= 0) {
+            return;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (!force && now - ss.last_stats < std::chrono::milliseconds(stats_ms)) {
+            return;
+        }
+        ss.last_stats = now;
+        const auto cadence = partial_cadence.snapshot();
+        const auto m = ss.metrics->take();
+        std::string metrics;
+        if (params.metrics) {
+            // Audio the endpointing hasn't reached yet, captured-but-unread included.
+            const uint64_t captured_unread = use_mic_capture ? audio.total_samples() - capture_position : 0;
+            const int64_t vad_lag_samples = (int64_t)captured_unread + (ss.timeline.end() - ss.processed_samples_total);
+            metrics = string_printf(",\"decodes\":%zu,\"rtf\":%.4f,\"encode_ms_avg\":%.2f,\"decode_ms_avg\":%.2f,\"decode_wall_ms_avg\":%.2f,\"vad_lag_ms\":%lld,\"partial_latency_ms_avg\":%.1f,\"partial_latency_ms_max\":%.1f,\"final_latency_ms_avg\":%.1f,\"final_latency_ms_max\":%.1f,\"speech_end_to_final_ms_avg\":%.1f,\"speech_end_to_final_ms_max\":%.1f,\"capture_ring_fill\":%.4f,\"timeline_ms\":%lld,\"peak_rss_bytes\":%lld",
+                                    m.n_decodes,
+                                    m.audio_ms > 0.0 ? m.wall_ms / m.audio_ms : 0.0,
+                                    m.n_timed ? m.encode_ms / (double)m.n_timed : 0.0,
+                                    m.n_timed ? m.decode_ms / (double)m.n_timed : 0.0,
+                                    m.n_decodes ? m.wall_ms / (double)m.n_decodes : 0.0,
+                                    (long long)(vad_lag_samples * 1000LL / sample_rate),
+                                    m.partial.avg_ms(),
+                                    m.partial.max_ms,
+                                    m.final_from_enqueue.avg_ms(),
+                                    m.final_from_enqueue.max_ms,
+                                    m.final_from_speech_end.avg_ms(),
+                                    m.final_from_speech_end.max_ms,
+                                    use_mic_capture ? (double)std::min<uint64_t>(captured_unread, audio.capacity_samples()) / (double)std::max<size_t>(1, audio.capacity_samples()) : 0.0,
+                                    (long long)((ss.timeline.end() - ss.timeline.begin()) * 1000LL / sample_rate),
+                                    (long long)peak_rss_bytes());
+#if defined(OPENFLOW_ALLOC_STATS)
+            // Heap allocations between a record's decode finishing and its hand-off to stdout.
+            metrics += string_printf(",\"emit_records\":%zu,\"emit_allocs\":%llu,\"emit_allocs_max\":%llu",
+                                     m.emit_records,
+                                     (unsigned long long)m.emit_allocs,
+                                     (unsigned long long)m.emit_allocs_max);
+#endif
+        }
+        if (params.metrics) {
+            metrics += string_printf(",\"held_audio_bytes\":%zu,\"held_audio_peak_bytes\":%zu,\"spilled_audio_bytes\":%zu",
+                                     ss.timeline.resident_bytes(),
+                                     std::max(ss.held_audio_peak_bytes, ss.timeline.resident_bytes()),
+                                     ss.spill ? ss.spill->bytes() : (size_t)0);
+            ss.held_audio_peak_bytes = ss.timeline.resident_bytes();
+        }
+        if (speculative_finals) {
+            metrics += string_printf(",\"speculative_finals\":%zu,\"speculative_hits\":%zu",
+                                     m.speculations,
+                                     m.speculative_hits);
+        }
+        emit_session_event(ss, string_printf("{\"event\":\"stats\",\"audio_time_ms\":%lld,\"partials_enabled\":%s,\"adaptive_step\":%s,\"partial_interval_ms\":%.1f,\"decode_ms_per_audio_s\":%.1f,\"decode_backlog\":%zu,\"partial_backlog\":%zu,\"partials_enqueued\":%zu,\"partials_skipped\":%zu,\"partials_superseded\":%zu%s}\n",
+                                 (long long)((ss.processed_samples_total * 1000LL) / sample_rate),
+                                 enable_partials ? "true" : "false",
+                                 partial_cadence.adaptive() ? "true" : "false",
+                                 cadence.interval_ms,
+                                 cadence.ms_per_audio_s,
+                                 decode_queue.backlog(),
+                                 partial_queue.backlog(),
+                                 cadence.enqueued,
+                                 cadence.skipped,
+                                 decode_queue.superseded_partials() + partial_queue.superseded_partials(),
+                                 metrics.c_str()));
+    };
 
-                const int64_t current_segment_end_sample = segment_start_sample + static_cast<int64_t>(current_segment.size());
-                if (enable_partials &&
-                    current_segment.size() >= min_segment_samples &&
-                    current_segment_end_sample - last_partial_emit_sample >= step_samples) {
-                    const double avg_prob_now = segment_prob_count > 0 ? (segment_prob_sum / segment_prob_count) : 0.0;
-                    emit_transcription(current_segment,
-                                       active_segment_index >= 0 ? active_segment_index : segment_index,
-                                       segment_start_sample,
-                                       false,
-                                       avg_prob_now,
-                                       partial_sequence);
-                    last_partial_emit_sample = current_segment_end_sample;
-                    ++partial_sequence;
+    auto process_pending_chunks = [&](stream_session &ss) {
+        ss.held_audio_peak_bytes = std::max(ss.held_audio_peak_bytes, ss.timeline.resident_bytes());
+        while (true) {
+            const size_t n_available = static_cast<size_t>((ss.timeline.end() - ss.processed_samples_total) / static_cast<int64_t>(vad_chunk_samples));
+            if (n_available == 0) {
+                break;
+            }
+            const size_t n_windows = std::min(n_available, vad_batch_windows);
+
+            try {
+                if (n_windows == 1) {
+                    ss.vad_probs.assign(1, ss.vad->infer(ss.timeline.data(ss.processed_samples_total), vad_chunk_samples));
+                } else {
+                    ss.vad->infer_batch(ss.timeline.data(ss.processed_samples_total), n_windows, ss.vad_probs);
                 }
+            } catch (const std::exception &ex) {
+                // Keep the timeline contiguous: the chunks stay part of the audio, they just get no
+                // say in endpointing.
+                fprintf(stderr, "VAD inference failed: %s\n", ex.what());
+                ss.processed_samples_total += static_cast<int64_t>(n_windows * vad_chunk_samples);
+                continue;
+            }
 
-                int64_t segment_samples = processed_samples_total - segment_start_sample;
-                int64_t silence_samples = processed_samples_total - last_voice_sample;
+            for (float prob : ss.vad_probs) {
+                consume_vad_chunk(ss, prob);
+            }
+        }
 
-                bool over_max = segment_samples >= static_cast<int64_t>(max_segment_samples);
-                bool enough_silence = silence_samples >= static_cast<int64_t>(min_silence_samples);
-                bool has_post = silence_samples >= static_cast<int64_t>(post_padding_samples);
+        // The full pass needs the whole job; otherwise keep only the open segment or the pre-roll.
+        if (!stream_full_pass_mode) {
+            const int64_t keep_from = ss.in_segment
+                ? ss.segment_start_sample
+                : std::max<int64_t>(ss.pre_roll_floor, ss.processed_samples_total - static_cast<int64_t>(pre_padding_samples));
+            ss.timeline.release_before(keep_from);
+        }
+        maybe_emit_stats(ss);
+    };
 
-                if (over_max) {
-                    if (params.debug) {
-                        fprintf(stderr, "segment %d forced flush (max length)\n", segment_index);
-                    }
-                    flush_segment(true, !stream_full_pass_mode);
-                } else if (enough_silence && has_post) {
-                    if (params.debug) {
-                        fprintf(stderr, "segment %d flush after silence (prob=%.3f)\n", segment_index, prob);
-                    }
-                    flush_segment(false, !stream_full_pass_mode);
-                }
+    // Worker 0 decodes on the context's built-in state; the rest share its weights through their
+    // own whisper_state (KV cache + compute buffers each).
+    std::vector<whisper_state *> decode_states(1, nullptr);
+    for (int i = 1; i < n_decode_workers; ++i) {
+        whisper_state *state = whisper_init_state(ctx);
+        if (!state) {
+            fprintf(stderr, "warning: whisper_init_state failed; decoding with %d worker(s)\n", i);
+            break;
+        }
+        decode_states.push_back(state);
+    }
+
+    // The context and state are read per job: a model swap replaces them while the queue is idle,
+    // and the queue's lock orders that before the next pop.
+    auto run_decode_worker = [&](DecodeQueue &queue, whisper_context *const &worker_ctx, whisper_state *const &worker_state) {
+        if (params.vad_background) {
+            set_thread_role(thread_role::decode);
+        }
+        decode_job job;
+        // Reused for every record this worker writes, so a steady stream formats without allocating.
+        std::string line;
+        while (queue.pop(job)) {
+            whisper_context *wctx = worker_ctx;
+            whisper_state *state = worker_state;
+            stream_session &ss = *job.session;
+            line.clear();
+            t_emit_alloc_mark = thread_allocations();
+            if (!job.marker.empty()) {
+                line = std::move(job.marker);
+            } else if (job.speculative) {
+                run_speculation(ss, wctx, state, job);
+            } else if (job.full_pass_chunk >= 0) {
+                emit_full_pass_chunk(ss, wctx, state, job, line);
+            } else if (job.incremental) {
+                emit_incremental_partial(ss, wctx, state, job.samples(), job.n_samples(), job.segment_index,
+                                         job.start_sample, job.avg_prob, job.partial_seq, line);
             } else {
-                for (float sample : chunk_buffer) {
-                    pre_roll.push_back(sample);
-                    if (pre_roll.size() > pre_padding_samples) {
-                        pre_roll.pop_front();
-                    }
+                emit_transcription(ss, wctx, state, job.samples(), job.n_samples(), job.segment_index,
+                                   job.start_sample, job.is_final, job.avg_prob, job.partial_seq,
+                                   job.speculation_id, line);
+            }
+            const bool emitted = !line.empty() && job.n_samples() > 0;
+            const uint64_t emit_allocs = thread_allocations() - t_emit_alloc_mark;
+            if (job.output_ticket >= 0) {
+                ordered_output.complete(job.output_ticket, std::move(line));
+            } else {
+                write_stdout(line);
+            }
+            if (params.metrics && emitted) {
+                ss.metrics->add_emitted(job, std::chrono::steady_clock::now(), emit_allocs);
+            }
+            queue.done(job);
+            job.session.reset();
+        }
+    };
+
+    std::vector<std::thread> decode_workers;
+    decode_workers.reserve(decode_states.size() + 1);
+    for (size_t i = 0; i < decode_states.size(); ++i) {
+        decode_workers.emplace_back([&, i]() { run_decode_worker(decode_queue, ctx, decode_states[i]); });
+    }
+    whisper_state *const partial_state = nullptr;
+    if (partial_ctx) {
+        decode_workers.emplace_back([&]() { run_decode_worker(partial_queue, partial_ctx, partial_state); });
+    }
+
+    // Model hot-swap. Loading, state setup and warm-up run on the loader thread and cost the stream
+    // nothing; installing is a pointer swap plus re-tokenizing the dictionary for the new vocabulary.
+    model_swap swap;
+    auto free_model = [](whisper_context *wctx, std::vector<whisper_state *> &states) {
+        for (whisper_state *state : states) {
+            if (state) whisper_free_state(state);
+        }
+        states.clear();
+        if (wctx) whisper_free(wctx);
+    };
+    auto model_error = [&](const std::string &path, const std::string &error) {
+        emit_event("{\"event\":\"model_error\",\"path\":\"" + escape_json(path) + "\",\"error\":\"" +
+                   escape_json(error) + "\"}\n");
+    };
+    auto model_audio_ctx = [&](const std::string &path) {
+#if defined(OPENFLOW_COREML)
+        if (std::filesystem::exists(coreml_encoder_path(path))) return 0;
+#else
+        (void) path;
+#endif
+        return requested_audio_ctx;
+    };
+    auto load_model = [&](const std::string &path) {
+        const auto t_load = std::chrono::steady_clock::now();
+        whisper_context *next = whisper_init_from_file_with_params(path.c_str(), cparams);
+        const double load_ms = ms_since(t_load);
+        std::vector<whisper_state *> states;
+        std::string error;
+        if (!next) {
+            error = "failed to initialize whisper context";
+        } else if (partial_ctx && (whisper_n_vocab(next) != whisper_n_vocab(partial_ctx) ||
+                                   whisper_is_multilingual(next) != whisper_is_multilingual(partial_ctx))) {
+            error = "does not share the vocabulary of --partial-model";
+        } else {
+            // Same worker layout as the current model: slot 0 decodes on the context's own state.
+            states.push_back(nullptr);
+            while (states.size() < decode_states.size()) {
+                whisper_state *state = whisper_init_state(next);
+                if (!state) {
+                    error = "whisper_init_state failed";
+                    break;
                 }
+                states.push_back(state);
+            }
+        }
+        if (!error.empty()) {
+            free_model(next, states);
+            {
+                std::lock_guard<std::mutex> lock(swap.mu);
+                swap.loading = false;
+            }
+            model_error(path, error);
+            return;
+        }
+        double next_warmup_ms = 0.0;
+        if (params.warmup) {
+            const auto t_warm = std::chrono::steady_clock::now();
+            warm_up(next, model_audio_ctx(path));
+            next_warmup_ms = ms_since(t_warm);
+        }
+        {
+            std::lock_guard<std::mutex> lock(swap.mu);
+            swap.loading = false;
+            swap.ctx = next;
+            swap.states = std::move(states);
+        }
+        emit_event(string_printf("{\"event\":\"model_ready\",\"path\":\"%s\",\"model_load_ms\":%.1f,\"warmup_ms\":%.1f}\n",
+                                 escape_json(path).c_str(), load_ms, next_warmup_ms));
+    };
+    // Starts loading `path` in the background; the current model keeps decoding until the swap. A
+    // loaded model still waiting for the end of a job is dropped in favour of the newer request.
+    auto request_model = [&](const std::string &path) {
+        whisper_context *superseded = nullptr;
+        std::vector<whisper_state *> superseded_states;
+        std::string superseded_path;
+        {
+            std::lock_guard<std::mutex> lock(swap.mu);
+            if (swap.loading) {
+                model_error(path, "another model is still loading");
+                return;
+            }
+            if (!std::filesystem::exists(path)) {
+                model_error(path, "model not found");
+                return;
             }
+            if (swap.ctx) {
+                superseded = swap.ctx;
+                superseded_states = std::move(swap.states);
+                superseded_path = swap.path;
+                swap.ctx = nullptr;
+                swap.states.clear();
+            }
+            if (swap.loader.joinable()) {
+                swap.loader.join();
+            }
+            swap.loading = true;
+            swap.path = path;
+            emit_event("{\"event\":\"model_loading\",\"path\":\"" + escape_json(path) + "\"}\n");
+            swap.loader = std::thread([&load_model, path]() { load_model(path); });
+        }
+        if (superseded) {
+            // Never installed, so no decode ever ran on it.
+            free_model(superseded, superseded_states);
+            model_error(superseded_path, "superseded by a later model request before it was installed");
+        }
+    };
+    // Between jobs: installs a loaded model, if there is one. Every decode of the old model has
+    // finished once the queues are idle, so it is freed here.
+    auto install_model = [&]() {
+        whisper_context *next = nullptr;
+        std::vector<whisper_state *> states;
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(swap.mu);
+            if (!swap.ctx) return;
+            next = swap.ctx;
+            states = std::move(swap.states);
+            path = swap.path;
+            swap.ctx = nullptr;
         }
+        decode_queue.wait_idle();
+        partial_queue.wait_idle();
+        const std::string previous = params.model;
+        {
+            // The dictionary watcher tokenizes on ctx under this lock.
+            std::lock_guard<std::mutex> lock(dictionary_reload_mu);
+            std::vector<whisper_state *> old_states(decode_states.begin(), decode_states.end());
+            free_model(ctx, old_states);
+            ctx = next;
+            std::copy(states.begin(), states.end(), decode_states.begin());
+            prompt_token_budget = (size_t) std::max(0, whisper_n_text_ctx(ctx) / 2 - 1);
+            dictionary_token_cache.clear();
+            params.model = path;
+            params.audio_ctx = model_audio_ctx(path);
+        }
+        reload_dictionary(true);
+        emit_event("{\"event\":\"model_swap\",\"path\":\"" + escape_json(path) + "\",\"previous\":\"" +
+                   escape_json(previous) + "\"}\n");
+    };
+
+    // Streams a file job through VAD one batch at a time; segments are queued for decoding while the
+    // rest of the file is still unread. The tail is zero-padded to a whole VAD window.
+    auto feed_wav_source = [&](stream_session &ss, MappedWavSource &wav) {
+        const size_t block_samples = vad_batch_windows * vad_chunk_samples;
+        while (wav.remaining() > 0) {
+            const size_t n = std::min(block_samples, wav.remaining());
+            wav.read(ss.timeline.extend(n), n);
+            process_pending_chunks(ss);
+        }
+        const size_t rem = wav.total_samples() % vad_chunk_samples;
+        if (rem) {
+            ss.timeline.append_zeros(vad_chunk_samples - rem);
+        }
+        process_pending_chunks(ss);
     };
 
+    int exit_code = 0;
+    stream_session &ss = *default_session;
+    // This thread reads the input and runs VAD and endpointing; decodes are on the workers.
+    if (params.vad_background) {
+        set_thread_role(thread_role::vad);
+    }
     if (use_mic_capture) {
+        std::vector<float> window_pcm;
         while (sdl_poll_events()) {
-            std::vector<float> window_pcm;
-            int64_t audio_time_ms = 0;
-            audio.get(fetch_window_ms, window_pcm, audio_time_ms);
+            const size_t lost = audio.read_since(capture_position, window_pcm);
+            if (lost > 0) {
+                fprintf(stderr, "warning: capture ring overrun, dropped %zu samples\n", lost);
+            }
 
-            if (audio_time_ms <= last_fetch_time_ms) {
+            if (window_pcm.empty()) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(5));
                 continue;
             }
 
-            int64_t delta_ms = audio_time_ms - last_fetch_time_ms;
-            size_t new_samples = static_cast<size_t>((delta_ms * sample_rate) / 1000);
-            if (new_samples > window_pcm.size()) {
-                new_samples = window_pcm.size();
-            }
-            if (new_samples > 0) {
-                const size_t start = window_pcm.size() - new_samples;
-                for (size_t i = start; i < window_pcm.size(); ++i) {
-                    pending_samples.push_back(window_pcm[i]);
-                }
-            }
-            last_fetch_time_ms = audio_time_ms;
+            ss.timeline.append(window_pcm.data(), window_pcm.size());
 
-            process_pending_chunks();
+            process_pending_chunks(ss);
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
 
-        flush_segment(true);
+        flush_segment(ss, true);
         audio.pause();
     } else if (use_stdin_audio) {
         std::string line;
@@ -1530,46 +3655,46 @@ int main(int argc, char **argv) {
             if (line == "__quit__") {
                 break;
             }
+            if (line.rfind("__model__ ", 0) == 0) {
+                request_model(line.substr(strlen("__model__ ")));
+                continue;
+            }
 
-            reset_segment_state();
+            install_model();
+            reset_segment_state(ss);
 
-            std::vector<float> offline_pcm;
-            int sr_in = 0;
-            if (!read_wav_mono_f32(line, offline_pcm, sr_in)) {
-                fprintf(stderr, "error: failed to open audio file '%s'\n", line.c_str());
+            MappedWavSource wav;
+            if (!wav.open(line, sample_rate)) {
                 continue;
             }
-            if (sr_in != sample_rate) {
-                offline_pcm = resample_linear(offline_pcm, sr_in, sample_rate);
-            }
 
-            printf("{\"event\":\"job_start\",\"path\":\"%s\"}\n", escape_json(line).c_str());
-            fflush(stdout);
+            emit_event("{\"event\":\"job_start\",\"path\":\"" + escape_json(line) + "\"}\n");
 
-            for (float s : offline_pcm) {
-                pending_samples.push_back(s);
+            feed_wav_source(ss, wav);
+            flush_segment(ss, true);
+            decode_queue.wait_idle();
+            partial_queue.wait_idle();
+            if (params.metrics) {
+                maybe_emit_stats(ss, true);
             }
-            const size_t rem = pending_samples.size() % vad_chunk_samples;
-            if (rem) {
-                const size_t pad = vad_chunk_samples - rem;
-                for (size_t i = 0; i < pad; ++i) pending_samples.push_back(0.0f);
-            }
-            process_pending_chunks();
-            flush_segment(true);
 
-            printf("{\"event\":\"job_end\",\"path\":\"%s\"}\n", escape_json(line).c_str());
-            fflush(stdout);
+            emit_event("{\"event\":\"job_end\",\"path\":\"" + escape_json(line) + "\"}\n");
         }
     } else if (use_stdin_pcm) {
         auto reset_state_and_emit = [&]() {
-            reset_segment_state();
+            reset_segment_state(ss);
         };
 
         auto read_exact = [&](void *dst, size_t n) -> bool {
             return fread(dst, 1, n, stdin) == n;
         };
 
-        while (true) {
+        PcmRingReader ring;
+        if (!params.pcm_ring.empty() && !ring.open(params.pcm_ring)) {
+            exit_code = 1;
+        }
+
+        while (exit_code == 0) {
             uint8_t tag = 0;
             if (!read_exact(&tag, 1)) {
                 break;
@@ -1578,30 +3703,46 @@ int main(int argc, char **argv) {
                 break;
             }
             if (tag == 'B') {
+                install_model();
                 reset_state_and_emit();
-                printf("{\"event\":\"job_start\"}\n");
-                fflush(stdout);
+                emit_event("{\"event\":\"job_start\"}\n");
                 continue;
             }
             if (tag == 'E') {
                 if (stream_full_pass_mode) {
                     // Keep UI updates from any pending tail audio, but reserve "final=true" for
-                    // one full-pass decode over the complete held stream.
-                    flush_segment(true, false);
-                    if (!full_job_audio.empty()) {
-                        emit_transcription(full_job_audio,
-                                           0,
-                                           0,
-                                           true,
-                                           0.0,
-                                           0);
-                    }
-                    full_job_audio.clear();
+                    // the full pass over the held stream's chunks.
+                    flush_segment(ss, true, false);
+                    // The full pass finalizes every segment of the job at once, so let the partials
+                    // still on the other worker go out first.
+                    partial_queue.wait_idle();
+                    // The full pass borrows the timeline instead of copying the chunks; the
+                    // wait_idle() below keeps it untouched until the decodes are done.
+                    finish_full_pass(ss, true);
                 } else {
-                    flush_segment(true);
+                    flush_segment(ss, true);
+                }
+                decode_queue.wait_idle();
+                partial_queue.wait_idle();
+                if (params.metrics) {
+                    // The job's finals land in this window, not the next job's.
+                    maybe_emit_stats(ss, true);
+                }
+                emit_event("{\"event\":\"job_end\"}\n");
+                install_model();
+                continue;
+            }
+            if (tag == 'M') {
+                // u32 length | model path (UTF-8, no terminator)
+                uint32_t n = 0;
+                if (!read_exact(&n, sizeof(uint32_t))) {
+                    break;
+                }
+                std::string path(n, '\0');
+                if (n > 0 && !read_exact(path.data(), n)) {
+                    break;
                 }
-                printf("{\"event\":\"job_end\"}\n");
-                fflush(stdout);
+                request_model(path);
                 continue;
             }
             if (tag == 'J') {
@@ -1612,49 +3753,190 @@ int main(int argc, char **argv) {
                 if (n == 0) {
                     continue;
                 }
-                std::vector<float> samples(n);
-                if (!read_exact(samples.data(), n * sizeof(float))) {
+                if (!frame_fits_budget(ss, n)) {
+                    if (!discard_stdin((size_t)n * sizeof(float))) {
+                        break;
+                    }
+                    continue;
+                }
+                // Read the frame straight into the timeline; there's no per-frame buffer.
+                if (!read_exact(ss.timeline.extend(n), n * sizeof(float))) {
                     break;
                 }
-                for (float s : samples) {
-                    pending_samples.push_back(s);
+                process_pending_chunks(ss);
+                continue;
+            }
+            if (tag == 'R') {
+                // Doorbell: the ring holds samples up to `end`. One copy, ring -> timeline.
+                uint64_t end = 0;
+                if (!read_exact(&end, sizeof(uint64_t))) {
+                    break;
                 }
-                if (stream_full_pass_mode) {
-                    full_job_audio.insert(full_job_audio.end(), samples.begin(), samples.end());
+                const int64_t n = ring.is_open() ? ring.pending(end) : -1;
+                if (n < 0) {
+                    fprintf(stderr, "error: bad PCM ring doorbell (end=%llu)\n", (unsigned long long) end);
+                    exit_code = 1;
+                    break;
+                }
+                if (n > 0) {
+                    ring.read_to(end, ss.timeline.extend((size_t) n));
+                    process_pending_chunks(ss);
                 }
-                process_pending_chunks();
                 continue;
             }
         }
-    } else {
-        std::vector<float> offline_pcm;
-        int sr_in = 0;
-        if (!read_wav_mono_f32(params.audio_file, offline_pcm, sr_in)) {
-            whisper_free(ctx);
-            return 1;
-        }
-        if (sr_in != sample_rate) {
-            offline_pcm = resample_linear(offline_pcm, sr_in, sample_rate);
-        }
-        if (params.debug) {
-            fprintf(stderr,
-                    "offline audio: '%s' -> %zu samples @ %d Hz\n",
-                    params.audio_file.c_str(),
-                    offline_pcm.size(),
-                    sample_rate);
+    } else if (use_server) {
+        // Frames are `u32 session | u8 tag | payload` with the --stdin-pcm tags, plus X to close a
+        // session. A session opens on its first frame. B starts a fresh generation of it, so the
+        // previous job's decodes finish against their own state while the new job streams; only
+        // the VAD carries over. job_end and session_close go through the decode queue so they
+        // follow the session's last segment without stalling the other sessions' input.
+        std::unordered_map<uint32_t, std::shared_ptr<stream_session>> sessions;
+
+        auto read_exact = [&](void *dst, size_t n) -> bool {
+            return fread(dst, 1, n, stdin) == n;
+        };
+
+        auto emit_in_order = [&](stream_session &session, const std::string &json_line) {
+            decode_job marker;
+            marker.session = session.shared_from_this();
+            marker.segment_index = -1;
+            marker.is_final = true;
+            marker.marker = session_json(session, json_line);
+            decode_queue.push(std::move(marker));
+        };
+
+        while (true) {
+            uint32_t id = 0;
+            uint8_t tag = 0;
+            if (!read_exact(&id, sizeof(id)) || !read_exact(&tag, 1)) {
+                break;
+            }
+            if (tag == 'Q') {
+                break;
+            }
+
+            auto it = sessions.find(id);
+            if (tag == 'X') {
+                if (it != sessions.end()) {
+                    emit_in_order(*it->second, "{\"event\":\"session_close\"}\n");
+                    sessions.erase(it);
+                }
+                continue;
+            }
+            if (tag == 'M') {
+                // Sessions never go idle together, so there is no point between jobs to swap at.
+                uint32_t n = 0;
+                if (!read_exact(&n, sizeof(uint32_t))) {
+                    break;
+                }
+                std::string path(n, '\0');
+                if (n > 0 && !read_exact(path.data(), n)) {
+                    break;
+                }
+                model_error(path, "model swaps are not supported with --server");
+                continue;
+            }
+            if (it == sessions.end() || tag == 'B') {
+                auto next = std::make_shared<stream_session>();
+                next->id = (int)id;
+                if (it != sessions.end()) {
+                    next->vad = std::move(it->second->vad);
+                    next->metrics = it->second->metrics;
+                    next->last_stats = it->second->last_stats;
+                } else {
+                    try {
+                        next->vad = std::make_unique<SileroVadRunner>(params.vad_model_path, sample_rate, vad_use_gpu, vad_threads);
+                    } catch (const std::exception &ex) {
+                        fprintf(stderr, "error: session %u: failed to initialize Silero VAD: %s\n", id, ex.what());
+                        exit_code = 1;
+                        break;
+                    }
+                }
+                it = sessions.insert_or_assign(id, std::move(next)).first;
+                if (tag != 'B') {
+                    emit_session_event(*it->second, "{\"event\":\"session_open\"}\n");
+                }
+            }
+            stream_session &session = *it->second;
+
+            if (tag == 'B') {
+                emit_session_event(session, "{\"event\":\"job_start\"}\n");
+            } else if (tag == 'E') {
+                if (stream_full_pass_mode) {
+                    flush_segment(session, true, false);
+                    // Copied, not borrowed: the reader keeps going while this decodes.
+                    finish_full_pass(session, false);
+                } else {
+                    flush_segment(session, true);
+                }
+                emit_in_order(session, "{\"event\":\"job_end\"}\n");
+            } else if (tag == 'J') {
+                uint32_t n = 0;
+                if (!read_exact(&n, sizeof(uint32_t))) {
+                    break;
+                }
+                if (n == 0) {
+                    continue;
+                }
+                if (!frame_fits_budget(session, n)) {
+                    if (!discard_stdin((size_t)n * sizeof(float))) {
+                        break;
+                    }
+                    continue;
+                }
+                if (!read_exact(session.timeline.extend(n), n * sizeof(float))) {
+                    break;
+                }
+                process_pending_chunks(session);
+            } else {
+                fprintf(stderr, "error: unknown --server frame tag 0x%02x for session %u\n", (unsigned)tag, id);
+                exit_code = 1;
+                break;
+            }
         }
-        for (float s : offline_pcm) {
-            pending_samples.push_back(s);
+    } else {
+        MappedWavSource wav;
+        if (!wav.open(params.audio_file, sample_rate)) {
+            exit_code = 1;
+        } else {
+            if (params.debug) {
+                fprintf(stderr,
+                        "offline audio: '%s' @ %d Hz -> %zu samples @ %d Hz\n",
+                        params.audio_file.c_str(),
+                        wav.source_rate(),
+                        wav.total_samples(),
+                        sample_rate);
+            }
+            feed_wav_source(ss, wav);
+            flush_segment(ss, true);
         }
-        const size_t rem = pending_samples.size() % vad_chunk_samples;
-        if (rem) {
-            const size_t pad = vad_chunk_samples - rem;
-            for (size_t i = 0; i < pad; ++i) pending_samples.push_back(0.0f);
+    }
+
+    dictionary_watcher.reset();
+    decode_queue.close();
+    partial_queue.close();
+    for (auto &worker : decode_workers) {
+        worker.join();
+    }
+    if (params.debug) {
+        fprintf(stderr, "decode queue: %zu superseded partials dropped\n",
+                decode_queue.superseded_partials() + partial_queue.superseded_partials());
+    }
+    if (swap.loader.joinable()) {
+        swap.loader.join();
+    }
+    free_model(swap.ctx, swap.states);
+    for (whisper_state *state : decode_states) {
+        if (state) {
+            whisper_free_state(state);
         }
-        process_pending_chunks();
-        flush_segment(true);
     }
+    logits_writer.stop();
 
+    if (partial_ctx) {
+        whisper_free(partial_ctx);
+    }
     whisper_free(ctx);
-    return 0;
+    return exit_code;
 }
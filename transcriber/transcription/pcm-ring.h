@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+// Shared-memory PCM ring (--pcm-ring)
+//
+
+// The producer (the app) creates the file and maps it MAP_SHARED; this side maps the same pages.
+// Layout, little-endian:
+//
+//   0   u32  magic 'OFPR'
+//   4   u32  capacity in float32 samples
+//   8   u64  read position, written by the transcriber only
+//   64  f32  capacity samples; absolute sample i lives at slot i % capacity
+//
+// The read position is atomic: stored here with memory_order_release once the slots are copied out,
+// and loaded by the producer with acquire ordering (openflow_pcm_ring_read_position in
+// Sources/CPCMRing) before it writes into the slots it frees.
+//
+// Positions are absolute sample counts since the ring was created. The producer never writes past
+// read + capacity, so it can't overwrite samples that haven't been consumed. The write position
+// isn't stored in the ring: the producer copies samples in and then sends an `R u64 end` doorbell
+// on stdin, so the pipe orders the samples before the doorbell and 'J' fallback frames stay in
+// sequence with ring data.
+class PcmRingReader {
+public:
+    static constexpr uint32_t kMagic = 0x5250464f; // "OFPR"
+    static constexpr size_t kHeaderBytes = 64;
+
+    PcmRingReader() = default;
+    PcmRingReader(const PcmRingReader &) = delete;
+    PcmRingReader &operator=(const PcmRingReader &) = delete;
+
+    ~PcmRingReader() {
+        close();
+    }
+
+    // Maps `path` and validates its header. Prints the reason and returns false on failure.
+    bool open(const std::string &path) {
+        close();
+
+        const int fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0) {
+            fprintf(stderr, "error: failed to open PCM ring '%s'\n", path.c_str());
+            return false;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size <= kHeaderBytes) {
+            fprintf(stderr, "error: PCM ring '%s' is too small\n", path.c_str());
+            ::close(fd);
+            return false;
+        }
+        void *map = mmap(nullptr, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "error: failed to map PCM ring '%s'\n", path.c_str());
+            return false;
+        }
+        map_ = static_cast<uint8_t *>(map);
+        map_size_ = (size_t) st.st_size;
+
+        uint32_t magic = 0;
+        uint32_t capacity = 0;
+        std::memcpy(&magic, map_, sizeof(magic));
+        std::memcpy(&capacity, map_ + 4, sizeof(capacity));
+        if (magic != kMagic || capacity == 0 || kHeaderBytes + (size_t) capacity * sizeof(float) > map_size_) {
+            fprintf(stderr, "error: '%s' is not a PCM ring\n", path.c_str());
+            close();
+            return false;
+        }
+        capacity_ = capacity;
+        samples_ = reinterpret_cast<const float *>(map_ + kHeaderBytes);
+        read_pos_ = reinterpret_cast<std::atomic<uint64_t> *>(map_ + 8);
+        read_ = read_pos_->load(std::memory_order_relaxed);
+        return true;
+    }
+
+    void close() {
+        if (map_) {
+            munmap(map_, map_size_);
+        }
+        map_ = nullptr;
+        map_size_ = 0;
+        samples_ = nullptr;
+        read_pos_ = nullptr;
+        capacity_ = 0;
+        read_ = 0;
+    }
+
+    bool is_open() const {
+        return map_ != nullptr;
+    }
+
+    // Samples a doorbell for `end` would hand over; negative if the producer claims more than it
+    // could have written.
+    int64_t pending(uint64_t end) const {
+        if (end < read_ || end - read_ > capacity_) {
+            return -1;
+        }
+        return (int64_t) (end - read_);
+    }
+
+    // Copies [read position, end) to dst and releases the slots back to the producer. The caller
+    // checks pending(end) first and sizes dst from it.
+    void read_to(uint64_t end, float *dst) {
+        const size_t n = (size_t) (end - read_);
+        const size_t pos = (size_t) (read_ % capacity_);
+        const size_t n0 = std::min(n, (size_t) capacity_ - pos);
+        std::memcpy(dst, samples_ + pos, n0 * sizeof(float));
+        std::memcpy(dst + n0, samples_, (n - n0) * sizeof(float));
+        read_ = end;
+        read_pos_->store(read_, std::memory_order_release);
+    }
+
+private:
+    uint8_t *map_ = nullptr;
+    size_t map_size_ = 0;
+    const float *samples_ = nullptr;
+    std::atomic<uint64_t> *read_pos_ = nullptr;
+    uint32_t capacity_ = 0;
+    uint64_t read_ = 0;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// Held-audio spill store (--memory-budget-mb)
+//
+
+// Samples moved out of a stream's timeline, kept as int16 in an unlinked temp file mapped
+// MAP_SHARED: the pages are file-backed, so the kernel can write them out instead of the process
+// holding them. When no temp file can be created the samples stay in memory, still at half the
+// size of float32. Samples are appended in timeline order and addressed by the same absolute
+// indices; append() and read() may run on different threads.
+class PcmSpill {
+public:
+    PcmSpill() = default;
+    PcmSpill(const PcmSpill &) = delete;
+    PcmSpill &operator=(const PcmSpill &) = delete;
+
+    ~PcmSpill() {
+        if (map_) {
+            munmap(map_, capacity_ * sizeof(int16_t));
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    // Absolute index one past the last spilled sample.
+    int64_t end() const {
+        std::lock_guard<std::mutex> lock(mu_);
+        return begin_ + (int64_t) n_;
+    }
+
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mu_);
+        return n_ * sizeof(int16_t);
+    }
+
+    // Appends samples[0, n) as absolute indices [abs, abs + n). The first call fixes where the store
+    // begins; later calls must continue at end(). Returns false if the samples couldn't be stored.
+    bool append(int64_t abs, const float *samples, size_t n) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (n_ == 0) {
+            begin_ = abs;
+        } else if (abs != begin_ + (int64_t) n_) {
+            return false;
+        }
+        int16_t *dst = reserve(n_ + n);
+        if (!dst) {
+            return false;
+        }
+        dst += n_;
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = (int16_t) std::lrint(std::clamp(samples[i], -1.0f, 1.0f) * 32767.0f);
+        }
+        n_ += n;
+        return true;
+    }
+
+    // Float copy of absolute samples [abs, abs + n); false if they weren't all spilled.
+    bool read(int64_t abs, size_t n, std::vector<float> &out) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (abs < begin_ || abs + (int64_t) n > begin_ + (int64_t) n_) {
+            return false;
+        }
+        const int16_t *src = (map_ ? map_ : mem_.data()) + (abs - begin_);
+        out.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = (float) src[i] / 32767.0f;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t kGrowSamples = 16000 * 60; // one minute per file extension
+
+    // Room for n_total samples; returns the storage base (which may move) or nullptr.
+    int16_t *reserve(size_t n_total) {
+        if (fd_ < 0 && !file_failed_ && !open_file()) {
+            file_failed_ = true;
+        }
+        if (file_failed_) {
+            mem_.resize(n_total);
+            return mem_.data();
+        }
+        if (n_total <= capacity_) {
+            return map_;
+        }
+
+        const size_t capacity = (n_total + kGrowSamples - 1) / kGrowSamples * kGrowSamples;
+        if (ftruncate(fd_, (off_t) (capacity * sizeof(int16_t))) != 0) {
+            return nullptr;
+        }
+        // No mremap on macOS: map the grown file again and drop the old view.
+        void *map = mmap(nullptr, capacity * sizeof(int16_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            return nullptr;
+        }
+        if (map_) {
+            munmap(map_, capacity_ * sizeof(int16_t));
+        }
+        map_ = static_cast<int16_t *>(map);
+        capacity_ = capacity;
+        return map_;
+    }
+
+    bool open_file() {
+        const char *dir = getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/openflow-spill-XXXXXX";
+        fd_ = mkstemp(path.data());
+        if (fd_ < 0) {
+            fprintf(stderr, "warning: no temp file for held audio; keeping it in memory as int16\n");
+            return false;
+        }
+        unlink(path.c_str());
+        return true;
+    }
+
+    mutable std::mutex mu_;
+    int fd_ = -1;
+    bool file_failed_ = false;
+    int16_t *map_ = nullptr;
+    size_t capacity_ = 0; // samples the mapping holds
+    std::vector<int16_t> mem_;
+    int64_t begin_ = 0;
+    size_t n_ = 0;
+};
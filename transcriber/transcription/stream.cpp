@@ -1,9 +1,9 @@
-// transcriber_simple.cpp
+// transcriber: low-latency sliding-window streaming on openflow_core
 #include "common-sdl.h"
+#include "openflow-core.h"
 #include "whisper.h"
 
 #include <algorithm>
-#include <cctype>
 #include <chrono>
 #include <cmath>
 #include <cstdio>
@@ -15,11 +15,17 @@
 #include <vector>
 
 struct streaming_params {
-    int32_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+    int32_t n_threads = default_decode_threads();
     int32_t step_ms = 150;
+    int32_t step_min_ms = -1; // adaptive step bounds; -1 = --step
+    int32_t step_max_ms = -1;
     int32_t length_ms = 3000;
+    int32_t keep_ms = 200;
     int32_t capture_id = -1;
     int32_t min_decode_ms = 200;
+    int32_t audio_ctx = -1; // encoder positions per decode; 0 = full 30 s window, -1 = sized to the window
+    float vad_thold = 0.50f;
+    int32_t vad_silence_ms = 600;
     std::string language = "en";
     std::string model = "models/ggml-base.en.bin";
     bool use_gpu = true;
@@ -32,13 +38,19 @@ static void print_usage(char **argv, const streaming_params &p) {
     fprintf(stderr, "  -h, --help            show this help\n");
     fprintf(stderr, "  --model F             model path [%s]\n", p.model.c_str());
     fprintf(stderr, "  --step N              step size in ms [%d]\n", p.step_ms);
-    fprintf(stderr, "  --length N            window length in ms [%d]\n", p.length_ms);
+    fprintf(stderr, "  --step-min N / --step-max N  bounds for an adaptive step sized to the decode time [--step]\n");
+    fprintf(stderr, "  --length N            max uncommitted audio decoded per step, in ms [%d]\n", p.length_ms);
+    fprintf(stderr, "  --keep N              ms of committed audio decoded again as overlap [%d]\n", p.keep_ms);
     fprintf(stderr, "  --min-decode N        minimum audio ms before decode [%d]\n", p.min_decode_ms);
+    fprintf(stderr, "  --audio-ctx N|auto    encoder positions per decode (1500 = 30 s); auto sizes it to the window [auto]\n");
     fprintf(stderr, "  --lang XX             language code (en, auto, ...) [%s]\n", p.language.c_str());
     fprintf(stderr, "  --threads N           decoder threads [%d]\n", p.n_threads);
     fprintf(stderr, "  -d,  --debug          debug prints [%d]\n", p.debug);
-    fprintf(stderr, "  --silero-vad PATH     Silero VAD ggml model (enables speech probability output)\n");
-    fprintf(stderr, "\nOutputs NDJSON with raw tokens + absolute timestamps every step.\n");
+    fprintf(stderr, "  --silero-vad PATH     Silero VAD ggml model (speech probability output, no decodes in silence)\n");
+    fprintf(stderr, "  --vad-thold P         speech probability threshold [%.2f]\n", p.vad_thold);
+    fprintf(stderr, "  --vad-silence-ms N    silence that commits the tentative tokens and pauses decoding [%d]\n", p.vad_silence_ms);
+    fprintf(stderr, "\nOutputs NDJSON every step: \"committed\" tokens are final and sent once, \"tokens\" is the\n");
+    fprintf(stderr, "tentative rest of the window. Token times are absolute ms since capture start.\n");
 }
 
 static bool parse_args(int argc, char **argv, streaming_params &p) {
@@ -52,10 +64,19 @@ static bool parse_args(int argc, char **argv, streaming_params &p) {
             p.model = need(a.c_str());
         } else if (a == "--step") {
             p.step_ms = std::max(1, atoi(need(a.c_str())));
+        } else if (a == "--step-min") {
+            p.step_min_ms = std::max(10, atoi(need(a.c_str())));
+        } else if (a == "--step-max") {
+            p.step_max_ms = std::max(10, atoi(need(a.c_str())));
         } else if (a == "--length") {
             p.length_ms = std::max(100, atoi(need(a.c_str())));
+        } else if (a == "--keep") {
+            p.keep_ms = std::max(0, atoi(need(a.c_str())));
         } else if (a == "--min-decode") {
             p.min_decode_ms = std::max(1, atoi(need(a.c_str())));
+        } else if (a == "--audio-ctx") {
+            const std::string v = need(a.c_str());
+            p.audio_ctx = v == "auto" ? -1 : std::max<int32_t>(0, atoi(v.c_str()));
         } else if (a == "--lang") {
             p.language = need(a.c_str());
         } else if (a == "--threads") {
@@ -64,6 +85,10 @@ static bool parse_args(int argc, char **argv, streaming_params &p) {
             p.debug = true;
         } else if (a == "--silero-vad") {
             p.vad_model_path = need(a.c_str());
+        } else if (a == "--vad-thold") {
+            p.vad_thold = std::clamp((float)atof(need(a.c_str())), 0.0f, 1.0f);
+        } else if (a == "--vad-silence-ms") {
+            p.vad_silence_ms = std::max(0, atoi(need(a.c_str())));
         } else {
             fprintf(stderr, "error: unknown argument '%s'\n", a.c_str());
             return false;
@@ -72,90 +97,33 @@ static bool parse_args(int argc, char **argv, streaming_params &p) {
     return true;
 }
 
-static inline bool is_control_piece(const std::string &s) {
-    if (s.size() >= 2 && s[0] == '<' && s[1] == '|') return true; // <|...|>
-    if (s.size() >= 3 && s[0] == '[' && s[1] == '_') return true; // [_...]
-    return false;
-}
-
-struct VadContextDeleter {
-    void operator()(whisper_vad_context *ctx) const {
-        if (ctx) {
-            whisper_vad_free(ctx);
-        }
-    }
-};
-
-class SileroVadRunner {
-public:
-    SileroVadRunner(const std::string &model_path, int sample_rate, bool use_gpu, int n_threads)
-        : sample_rate_(sample_rate),
-          context_(nullptr, VadContextDeleter{}) {
-        if (sample_rate_ != WHISPER_SAMPLE_RATE) {
-            throw std::runtime_error("Silero VAD expects 16 kHz audio");
-        }
-
-        struct whisper_vad_context_params ctx_params = whisper_vad_default_context_params();
-        ctx_params.n_threads = std::max(1, n_threads);
-        (void)use_gpu;
-        ctx_params.use_gpu = false;
-
-        context_.reset(whisper_vad_init_from_file_with_params(model_path.c_str(), ctx_params));
-        if (!context_) {
-            throw std::runtime_error("Failed to initialize Silero VAD context");
-        }
-
-        chunk_size_ = expected_chunk_size();
-        std::vector<float> probe(chunk_size_, 0.0f);
-        if (!whisper_vad_detect_speech(context_.get(), probe.data(), static_cast<int>(probe.size()))) {
-            throw std::runtime_error("Failed to probe Silero VAD probability window");
-        }
-        if (whisper_vad_n_probs(context_.get()) != 1) {
-            throw std::runtime_error("Silero VAD returned unexpected probability count during probe");
-        }
-    }
-
-    size_t chunk_size() const { return chunk_size_; }
-
-    float infer(const float *samples, size_t n_samples) {
-        if (!samples) {
-            throw std::runtime_error("Silero VAD received null audio chunk");
-        }
-        if (n_samples == 0) {
-            throw std::runtime_error("Silero VAD received empty audio chunk");
-        }
-
-        if (!whisper_vad_detect_speech(context_.get(), samples, static_cast<int>(n_samples))) {
-            throw std::runtime_error("Silero VAD failed to process audio chunk");
-        }
-
-        int n_probs = whisper_vad_n_probs(context_.get());
-        if (n_probs <= 0) {
-            throw std::runtime_error("Silero VAD returned no probabilities");
-        }
-
-        float *probs = whisper_vad_probs(context_.get());
-        if (!probs) {
-            throw std::runtime_error("Silero VAD returned invalid probabilities");
+// Index of the first hypothesis token past what is already committed. Each window starts --keep
+// before the commit point, so the decoder usually reads the last committed words again: the longest
+// run that repeats the committed suffix (starting within the first few tokens) is skipped. Without
+// such a run, tokens that end before the commit point are dropped by time.
+static size_t stitch_overlap(const std::vector<Piece> &committed, const std::vector<Piece> &hyp, int64_t committed_end_ms) {
+    constexpr size_t kMaxSkew = 4; // tokens the decoder may emit before the repeated words
+    size_t best_len = 0;
+    size_t best_end = 0;
+    for (size_t s = 0; s < std::min(kMaxSkew, hyp.size()); ++s) {
+        for (size_t k = std::min(committed.size(), hyp.size() - s); k > best_len; --k) {
+            const size_t c0 = committed.size() - k;
+            size_t j = 0;
+            while (j < k && hyp[s + j].id == committed[c0 + j].id) ++j;
+            if (j == k) {
+                best_len = k;
+                best_end = s + k;
+                break;
+            }
         }
-
-        return probs[n_probs - 1];
-    }
-
-    float infer(const float *samples) {
-        return infer(samples, chunk_size_);
     }
-
-private:
-    size_t expected_chunk_size() const {
-        // Silero 16k models operate on 512-sample frames (32 ms at 16 kHz).
-        return 512;
+    if (best_len > 0) {
+        return best_end;
     }
-
-    int sample_rate_;
-    size_t chunk_size_ = 0;
-    std::unique_ptr<whisper_vad_context, VadContextDeleter> context_;
-};
+    size_t i = 0;
+    while (i < hyp.size() && hyp[i].t1_ms >= 0 && hyp[i].t1_ms <= committed_end_ms) ++i;
+    return i;
+}
 
 int main(int argc, char **argv) {
     ggml_backend_load_all();
@@ -163,8 +131,13 @@ int main(int argc, char **argv) {
     streaming_params params;
     if (!parse_args(argc, argv, params)) return 1;
 
-    audio_async audio(params.length_ms);
-    if (!audio.init(params.capture_id, WHISPER_SAMPLE_RATE)) {
+    constexpr int sample_rate = WHISPER_SAMPLE_RATE;
+    auto ms_to_samples = [](int64_t ms) { return ms * sample_rate / 1000; };
+    auto samples_to_ms = [](int64_t n) { return n * 1000 / sample_rate; };
+
+    // The ring only has to cover the gap between two reads of this loop.
+    audio_async audio(std::max(10000, params.length_ms + params.keep_ms));
+    if (!audio.init(params.capture_id, sample_rate)) {
         fprintf(stderr, "audio.init() failed\n");
         return 1;
     }
@@ -206,8 +179,8 @@ int main(int argc, char **argv) {
     if (want_vad) {
         try {
             vad = std::make_unique<SileroVadRunner>(vad_model_path.string(),
-                                                    WHISPER_SAMPLE_RATE,
-                                                    params.use_gpu,
+                                                    sample_rate,
+                                                    false,
                                                     params.n_threads);
             vad_chunk_samples = vad->chunk_size();
             fprintf(stderr, "Silero VAD initialized (chunk=%zu samples)\n", vad_chunk_samples);
@@ -217,165 +190,200 @@ int main(int argc, char **argv) {
         }
     }
 
-    int64_t last_decode_audio_ms = 0;
+    // Sliding window: every step decodes [committed_end - keep, now). Tokens two consecutive decodes
+    // agree on are committed (and those about to leave the --length window are forced), so the
+    // window slides forward with the committed text instead of re-decoding a fixed span. The last
+    // committed tokens go back to whisper as prompt.
+    constexpr size_t kContextTokens = 64;
+    const int64_t length_samples = ms_to_samples(params.length_ms);
+    const int64_t keep_samples = ms_to_samples(params.keep_ms);
+    const int64_t min_decode_samples = ms_to_samples(params.min_decode_ms);
+    const int64_t silence_samples = ms_to_samples(params.vad_silence_ms);
+    PartialCadence cadence(params.step_ms,
+                           params.step_min_ms > 0 ? params.step_min_ms : params.step_ms,
+                           params.step_max_ms > 0 ? params.step_max_ms : params.step_ms,
+                           true);
+
+    SampleTimeline timeline;
+    uint64_t capture_position = 0;
+    int64_t committed_end = 0;    // audio before this sample is transcribed for good
+    int64_t last_step_end = 0;
+    std::vector<Piece> committed; // last kContextTokens committed tokens: prompt and overlap reference
+    std::vector<Piece> tail;      // uncommitted hypothesis of the previous step
+
+    int64_t vad_cursor = 0;
+    int64_t last_speech_end = -1;
+    bool has_vad_prob = false;
+    float vad_prob = 0.0f;
+
+    std::vector<float> captured;
+    std::vector<float> vad_probs;
+    std::vector<whisper_token> prompt;
+    std::vector<Piece> hyp;
+    std::vector<Piece> fresh; // hypothesis past the overlap with the committed text
+    std::vector<Piece> newly_committed;
+    std::vector<float> waveform;
+    std::string line;
 
     while (sdl_poll_events()) {
-        std::vector<float> window_pcm;
-        int64_t audio_time_ms = 0;
-        audio.get(params.length_ms, window_pcm, audio_time_ms);
-
-        if ((audio_time_ms - last_decode_audio_ms) < params.step_ms) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            continue;
+        const size_t lost = audio.read_since(capture_position, captured);
+        if (lost > 0) {
+            fprintf(stderr, "warning: capture ring overrun, dropped %zu samples\n", lost);
         }
-        last_decode_audio_ms = audio_time_ms;
-
-        const int need_samples = (int)((int64_t)params.min_decode_ms * WHISPER_SAMPLE_RATE / 1000);
-        if ((int)window_pcm.size() < need_samples) continue;
-
-        bool has_vad_prob = false;
-        float vad_prob = 0.0f;
-        if (vad && window_pcm.size() >= vad_chunk_samples) {
-            const float *chunk_ptr = window_pcm.data() + window_pcm.size() - vad_chunk_samples;
-            vad_prob = vad->infer(chunk_ptr, vad_chunk_samples);
-            has_vad_prob = true;
+        timeline.append(captured.data(), captured.size());
+        const int64_t end = timeline.end();
+
+        if (vad && end - vad_cursor >= (int64_t)vad_chunk_samples) {
+            const size_t n_windows = (size_t)(end - vad_cursor) / vad_chunk_samples;
+            try {
+                vad->infer_batch(timeline.data(vad_cursor), n_windows, vad_probs);
+                for (size_t w = 0; w < n_windows; ++w) {
+                    if (vad_probs[w] >= params.vad_thold) {
+                        last_speech_end = vad_cursor + (int64_t)((w + 1) * vad_chunk_samples);
+                    }
+                }
+                vad_prob = vad_probs.back();
+                has_vad_prob = true;
+            } catch (const std::exception &ex) {
+                fprintf(stderr, "VAD inference failed: %s\n", ex.what());
+            }
+            vad_cursor += (int64_t)(n_windows * vad_chunk_samples);
         }
 
-        // Compute absolute start of this window (ms since start of capture)
-        const int64_t window_pcm_ms = (int64_t)window_pcm.size() * 1000LL / WHISPER_SAMPLE_RATE;
-        const int64_t window_start_ms = std::max<int64_t>(0, audio_time_ms - window_pcm_ms);
-
-        whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-        wparams.print_progress = false;
-        wparams.print_special = false;
-        wparams.print_realtime = false;
-        wparams.print_timestamps = false;
-        wparams.no_context = true;
-        wparams.single_segment = true;
-        wparams.max_tokens = 120;
-        wparams.language = params.language.c_str();
-        wparams.n_threads = params.n_threads;
-        wparams.token_timestamps = true;
-        wparams.thold_pt = 0.01f;
-        wparams.entropy_thold = 2.40f;
-        wparams.logprob_thold = -1.0f;
-        wparams.no_speech_thold = 0.0f;
-
-        if (whisper_full(ctx, wparams, window_pcm.data(), window_pcm.size()) != 0) {
-            fprintf(stderr, "whisper_full failed\n");
-            break;
+        const double step_now_ms = cadence.next_interval_ms((double)samples_to_ms(end - committed_end), 0);
+        if (end - last_step_end < ms_to_samples((int64_t)step_now_ms)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
         }
+        last_step_end = end;
+
+        newly_committed.clear();
+        fresh.clear();
+        double decode_ms = 0.0;
+        const bool silent = vad && (last_speech_end < 0 || end - last_speech_end >= silence_samples);
+        if (silent) {
+            // Nothing new is being said: the tentative tokens become final and silence isn't decoded.
+            newly_committed.swap(tail);
+            committed_end = end;
+        } else {
+            if (end - committed_end > 2 * length_samples) {
+                // The decoder never settled on a word boundary: keep the window bounded anyway.
+                newly_committed.swap(tail);
+                committed_end = end - length_samples;
+            }
+            const int64_t window_begin = std::max(timeline.begin(), committed_end - keep_samples);
+            if (end - window_begin < min_decode_samples) {
+                continue;
+            }
+            const size_t n_window = (size_t)(end - window_begin);
+
+            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+            wparams.print_progress = false;
+            wparams.print_special = false;
+            wparams.print_realtime = false;
+            wparams.print_timestamps = false;
+            wparams.no_context = true;
+            wparams.single_segment = true;
+            wparams.max_tokens = 120;
+            wparams.language = params.language.c_str();
+            wparams.n_threads = params.n_threads;
+            wparams.token_timestamps = true;
+            wparams.thold_pt = 0.01f;
+            wparams.entropy_thold = 2.40f;
+            wparams.logprob_thold = -1.0f;
+            wparams.no_speech_thold = 0.0f;
+            if (params.audio_ctx > 0) {
+                wparams.audio_ctx = params.audio_ctx;
+            } else if (params.audio_ctx < 0) {
+                wparams.audio_ctx = auto_audio_ctx(n_window, whisper_n_audio_ctx(ctx));
+            }
+            prompt.clear();
+            for (const Piece &p : committed) {
+                prompt.push_back(p.id);
+            }
+            wparams.prompt_tokens = prompt.empty() ? nullptr : prompt.data();
+            wparams.prompt_n_tokens = (int)prompt.size();
 
-        // Collect raw tokens (with leading-space flag) and ABSOLUTE token times
-        struct Piece {
-            std::string text;
-            int64_t t0_ms;
-            int64_t t1_ms;
-            bool leading_space;
-        };
-        std::vector<Piece> pieces;
-
-        const int n_segments = whisper_full_n_segments(ctx);
-        for (int s = 0; s < n_segments; ++s) {
-            const int64_t seg_base_ms = (int64_t)whisper_full_get_segment_t0(ctx, s) * 10; // 10ms units → ms
-            const int n_tok = whisper_full_n_tokens(ctx, s);
-            for (int i = 0; i < n_tok; ++i) {
-                auto td = whisper_full_get_token_data(ctx, s, i);
-                const char *pc = whisper_token_to_str(ctx, td.id);
-                if (!pc) continue;
-                std::string piece = pc;
-                if (is_control_piece(piece)) continue;
-
-                // determine leading-space
-                bool leading_space = (!piece.empty() && std::isspace((unsigned char)piece[0]));
-
-                // absolute token times
-                int64_t t0 = (td.t0 >= 0) ? ((int64_t)td.t0 * 10) : -1;
-                int64_t t1 = (td.t1 >= 0) ? ((int64_t)td.t1 * 10) : -1;
-                t0 = (t0 < 0) ? -1 : (t0 + seg_base_ms + window_start_ms);
-                t1 = (t1 < 0) ? -1 : (t1 + seg_base_ms + window_start_ms);
-
-                pieces.push_back({piece, t0, t1, leading_space});
+            const auto t_decode = std::chrono::steady_clock::now();
+            if (whisper_full(ctx, wparams, timeline.data(window_begin), (int)n_window) != 0) {
+                fprintf(stderr, "whisper_full failed\n");
+                break;
             }
+            decode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_decode).count();
+            cadence.observe(decode_ms, (double)samples_to_ms((int64_t)n_window));
+
+            hyp.clear();
+            collect_pieces(ctx, nullptr, samples_to_ms(window_begin), hyp);
+            const size_t first = stitch_overlap(committed, hyp, samples_to_ms(committed_end));
+            fresh.assign(std::make_move_iterator(hyp.begin() + (std::ptrdiff_t)first),
+                         std::make_move_iterator(hyp.end()));
+
+            const size_t n_commit = incremental_commit_count(tail, fresh, samples_to_ms(end - length_samples));
+            if (n_commit > 0) {
+                newly_committed.insert(newly_committed.end(),
+                                       std::make_move_iterator(fresh.begin()),
+                                       std::make_move_iterator(fresh.begin() + (std::ptrdiff_t)n_commit));
+                fresh.erase(fresh.begin(), fresh.begin() + (std::ptrdiff_t)n_commit);
+                committed_end = std::max(committed_end, ms_to_samples(newly_committed.back().t1_ms));
+            }
+            tail = fresh;
         }
 
-        // emit NDJSON
-        auto esc = [](const std::string &s) {
-            std::string o;
-            o.reserve(s.size() + 8);
-            for (char c : s) {
-                switch (c) {
-                case '\\':
-                    o += "\\\\";
-                    break;
-                case '\"':
-                    o += "\\\"";
-                    break;
-                case '\n':
-                    o += "\\n";
-                    break;
-                case '\r':
-                    o += "\\r";
-                    break;
-                case '\t':
-                    o += "\\t";
-                    break;
-                default:
-                    o.push_back(c);
-                    break;
-                }
-            }
-            return o;
-        };
+        committed.insert(committed.end(), newly_committed.begin(), newly_committed.end());
+        if (committed.size() > kContextTokens) {
+            committed.erase(committed.begin(), committed.end() - (std::ptrdiff_t)kContextTokens);
+        }
 
-        // Downsample the PCM window to a compact waveform envelope for visualization.
+        // Compact waveform envelope of the last --length of audio, for visualization.
         static const int WAVEFORM_BINS = 120;
-        std::vector<float> waveform;
-        waveform.reserve(WAVEFORM_BINS);
-        const size_t total_samples = window_pcm.size();
+        const int64_t wave_begin = std::max(timeline.begin(), end - length_samples);
+        const size_t total_samples = (size_t)(end - wave_begin);
         const size_t samples_per_bin = std::max<size_t>(1, total_samples / WAVEFORM_BINS);
+        const float *wave = timeline.data(wave_begin);
 
         float max_abs_sample = 0.0f;
-        for (float sample : window_pcm) {
-            max_abs_sample = std::max(max_abs_sample, std::fabs(sample));
+        for (size_t i = 0; i < total_samples; ++i) {
+            max_abs_sample = std::max(max_abs_sample, std::fabs(wave[i]));
         }
 
+        waveform.clear();
         for (int b = 0; b < WAVEFORM_BINS; ++b) {
             const size_t start = static_cast<size_t>(b) * samples_per_bin;
             if (start >= total_samples) break;
-            const size_t end = std::min(total_samples, start + samples_per_bin);
+            const size_t stop = std::min(total_samples, start + samples_per_bin);
             float peak = 0.0f;
-            for (size_t i = start; i < end; ++i) {
-                peak = std::max(peak, std::fabs(window_pcm[i]));
+            for (size_t i = start; i < stop; ++i) {
+                peak = std::max(peak, std::fabs(wave[i]));
             }
             waveform.push_back(peak);
         }
 
-        printf("{\"event\":\"data\",\"audio_time_ms\":%lld,\"window_start_ms\":%lld,\"step_ms\":%d,\"length_ms\":%d,\"waveform_stride\":%zu,\"waveform_max\":%.6f",
-               (long long)audio_time_ms, (long long)window_start_ms, params.step_ms, params.length_ms,
-               samples_per_bin, max_abs_sample);
+        line.clear();
+        line += string_printf("{\"event\":\"data\",\"audio_time_ms\":%lld,\"window_start_ms\":%lld,\"committed_end_ms\":%lld,\"step_ms\":%.0f,\"length_ms\":%d,\"decode_ms\":%.1f,\"waveform_stride\":%zu,\"waveform_max\":%.6f",
+                              (long long)samples_to_ms(end),
+                              (long long)samples_to_ms(std::max(timeline.begin(), committed_end - keep_samples)),
+                              (long long)samples_to_ms(committed_end),
+                              step_now_ms, params.length_ms, decode_ms,
+                              samples_per_bin, max_abs_sample);
         if (has_vad_prob) {
-            printf(",\"vad_prob\":%.6f,\"vad_chunk_samples\":%zu,\"vad_sample_rate\":%d",
-                   vad_prob, vad_chunk_samples, WHISPER_SAMPLE_RATE);
+            line += string_printf(",\"vad_prob\":%.6f,\"vad_chunk_samples\":%zu,\"vad_sample_rate\":%d",
+                                  vad_prob, vad_chunk_samples, sample_rate);
         }
-        printf(",\"waveform\":[");
-
+        line += ",\"waveform\":[";
         for (size_t i = 0; i < waveform.size(); ++i) {
-            if (i) printf(",");
-            printf("%.6f", waveform[i]);
-        }
-        printf("],\"tokens\":[");
-
-        for (size_t i = 0; i < pieces.size(); ++i) {
-            if (i) printf(",");
-            const auto &p = pieces[i];
-            printf("{\"text\":\"%s\",\"t0_ms\":%lld,\"t1_ms\":%lld,\"leading_space\":%s}",
-                   esc(p.text).c_str(),
-                   (long long)p.t0_ms, (long long)p.t1_ms,
-                   p.leading_space ? "true" : "false");
+            char buf[32];
+            const int n = snprintf(buf, sizeof(buf), "%s%.6f", i ? "," : "", waveform[i]);
+            line.append(buf, (size_t)n);
         }
-        printf("]}\n");
-        fflush(stdout);
+        line += "],\"committed\":";
+        append_tokens_json(line, newly_committed);
+        line += ",\"tokens\":";
+        append_tokens_json(line, tail);
+        line += "}\n";
+        write_stdout(line);
+
+        // Keep the overlap the next window starts with and the audio the waveform shows.
+        timeline.release_before(std::min(committed_end - keep_samples, end - length_samples));
     }
 
     audio.pause();
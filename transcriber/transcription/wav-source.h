@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+// WAV file input
+//
+
+inline uint16_t read_u16_le(const uint8_t *p) {
+    return (uint16_t) p[0] | ((uint16_t) p[1] << 8);
+}
+
+inline uint32_t read_u32_le(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Memory-mapped WAV reader that converts, downmixes and resamples on demand, so a file job never
+// holds more than the block being fed to the VAD. Output matches linear interpolation over the
+// whole file: n_out = round(n_frames * sr_out / sr_in), sample i taken at source position i / ratio.
+class MappedWavSource {
+public:
+    MappedWavSource() = default;
+    MappedWavSource(const MappedWavSource &) = delete;
+    MappedWavSource &operator=(const MappedWavSource &) = delete;
+
+    ~MappedWavSource() {
+        close();
+    }
+
+    // Maps `path` and validates its header. Prints the reason and returns false on failure.
+    bool open(const std::string &path, int sample_rate_out) {
+        close();
+
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "error: failed to open audio file '%s'\n", path.c_str());
+            return false;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            fprintf(stderr, "error: audio file '%s' is empty\n", path.c_str());
+            ::close(fd);
+            return false;
+        }
+        void *map = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "error: failed to map audio file '%s'\n", path.c_str());
+            return false;
+        }
+        map_ = static_cast<const uint8_t *>(map);
+        map_size_ = (size_t) st.st_size;
+        madvise(map, map_size_, MADV_SEQUENTIAL);
+
+        if (!parse_header(path)) {
+            close();
+            return false;
+        }
+
+        sample_rate_out_ = sample_rate_out;
+        if (sample_rate_in_ == sample_rate_out_ || n_frames_ == 0) {
+            ratio_ = 1.0;
+            n_out_ = n_frames_;
+        } else {
+            ratio_ = (double) sample_rate_out_ / (double) sample_rate_in_;
+            n_out_ = (size_t) std::max<int64_t>(1, (int64_t) std::llround((double) n_frames_ * ratio_));
+        }
+        produced_ = 0;
+        return true;
+    }
+
+    void close() {
+        if (map_) {
+            munmap(const_cast<uint8_t *>(map_), map_size_);
+        }
+        map_ = nullptr;
+        map_size_ = 0;
+        data_ = nullptr;
+        n_frames_ = 0;
+        n_out_ = 0;
+        produced_ = 0;
+    }
+
+    int source_rate() const {
+        return sample_rate_in_;
+    }
+
+    // Output samples (at sample_rate_out) the whole file resamples to.
+    size_t total_samples() const {
+        return n_out_;
+    }
+
+    size_t remaining() const {
+        return n_out_ - produced_;
+    }
+
+    // Writes the next min(n, remaining()) output samples to dst and returns how many were written.
+    size_t read(float *dst, size_t n) {
+        n = std::min(n, remaining());
+        if (ratio_ == 1.0) {
+            for (size_t k = 0; k < n; ++k) {
+                dst[k] = frame(produced_ + k);
+            }
+        } else {
+            for (size_t k = 0; k < n; ++k) {
+                const double pos = (double) (produced_ + k) / ratio_;
+                const size_t i0 = std::min((size_t) std::floor(pos), n_frames_ - 1);
+                const size_t i1 = std::min(i0 + 1, n_frames_ - 1);
+                const double t = pos - (double) i0;
+                dst[k] = (float) ((1.0 - t) * (double) frame(i0) + t * (double) frame(i1));
+            }
+        }
+        produced_ += n;
+        return n;
+    }
+
+private:
+    bool parse_header(const std::string &path) {
+        if (map_size_ < 44 || std::memcmp(map_, "RIFF", 4) != 0 || std::memcmp(map_ + 8, "WAVE", 4) != 0) {
+            fprintf(stderr, "error: '%s' is not a RIFF/WAVE file\n", path.c_str());
+            return false;
+        }
+
+        uint16_t audio_format = 0;
+        uint32_t sample_rate = 0;
+        size_t data_off = 0;
+        size_t data_size = 0;
+
+        size_t off = 12;
+        while (off + 8 <= map_size_) {
+            const char *tag = reinterpret_cast<const char *>(map_ + off);
+            const uint32_t chunk_sz = read_u32_le(map_ + off + 4);
+            const size_t chunk_data_off = off + 8;
+            if (chunk_data_off + chunk_sz > map_size_) break;
+
+            if (std::memcmp(tag, "fmt ", 4) == 0 && chunk_sz >= 16) {
+                audio_format = read_u16_le(map_ + chunk_data_off + 0);
+                num_channels_ = read_u16_le(map_ + chunk_data_off + 2);
+                sample_rate = read_u32_le(map_ + chunk_data_off + 4);
+                bits_per_sample_ = read_u16_le(map_ + chunk_data_off + 14);
+            } else if (std::memcmp(tag, "data", 4) == 0) {
+                data_off = chunk_data_off;
+                data_size = chunk_sz;
+            }
+
+            off = chunk_data_off + chunk_sz;
+            if (off & 1) off++; // align to word boundary
+        }
+
+        if (!data_off || !data_size) {
+            fprintf(stderr, "error: '%s' has no data chunk\n", path.c_str());
+            return false;
+        }
+        if (!sample_rate || !num_channels_) {
+            fprintf(stderr, "error: '%s' missing fmt chunk\n", path.c_str());
+            return false;
+        }
+        if (audio_format != 1 && audio_format != 3) {
+            fprintf(stderr, "error: '%s' unsupported WAV format %u (only PCM=1 or float=3)\n", path.c_str(), (unsigned) audio_format);
+            return false;
+        }
+
+        if (audio_format == 1 && bits_per_sample_ == 16) {
+            encoding_ = encoding::pcm16;
+        } else if (audio_format == 1 && bits_per_sample_ == 32) {
+            encoding_ = encoding::pcm32;
+        } else if (audio_format == 3 && bits_per_sample_ == 32) {
+            encoding_ = encoding::float32;
+        } else {
+            fprintf(stderr,
+                    "error: '%s' unsupported WAV encoding format=%u bits=%u\n",
+                    path.c_str(),
+                    (unsigned) audio_format,
+                    (unsigned) bits_per_sample_);
+            return false;
+        }
+
+        frame_bytes_ = (size_t) num_channels_ * (size_t) (bits_per_sample_ / 8);
+        data_ = map_ + data_off;
+        n_frames_ = data_size / frame_bytes_;
+        sample_rate_in_ = (int) sample_rate;
+        return true;
+    }
+
+    // Source frame i downmixed to mono.
+    float frame(size_t i) const {
+        const uint8_t *p = data_ + i * frame_bytes_;
+        const size_t step = bits_per_sample_ / 8;
+        double sum = 0.0;
+        for (uint16_t ch = 0; ch < num_channels_; ++ch, p += step) {
+            switch (encoding_) {
+                case encoding::pcm16: {
+                    int16_t s;
+                    std::memcpy(&s, p, sizeof(s));
+                    sum += (double) s / 32768.0;
+                    break;
+                }
+                case encoding::pcm32: {
+                    int32_t s;
+                    std::memcpy(&s, p, sizeof(s));
+                    sum += (double) s / 2147483648.0;
+                    break;
+                }
+                case encoding::float32: {
+                    float s;
+                    std::memcpy(&s, p, sizeof(s));
+                    sum += (double) s;
+                    break;
+                }
+            }
+        }
+        return (float) (sum / std::max<int>(1, (int) num_channels_));
+    }
+
+    enum class encoding { pcm16, pcm32, float32 };
+
+    const uint8_t *map_ = nullptr;
+    size_t map_size_ = 0;
+    const uint8_t *data_ = nullptr;
+    size_t frame_bytes_ = 0;
+    size_t n_frames_ = 0;
+    uint16_t num_channels_ = 0;
+    uint16_t bits_per_sample_ = 0;
+    encoding encoding_ = encoding::pcm16;
+    int sample_rate_in_ = 0;
+    int sample_rate_out_ = 0;
+    double ratio_ = 1.0;
+    size_t n_out_ = 0;
+    size_t produced_ = 0;
+};